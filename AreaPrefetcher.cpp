@@ -0,0 +1,190 @@
+﻿#include "AreaPrefetcher.h"
+#include "ResourceManager.h"
+#include "GameContext.h"
+#include "TMDModel.h"
+#include <cmath>
+
+void AreaPrefetcher::SetRadii(float prefetch, float cancel)
+{
+    prefetchRadius = prefetch;
+    // Без запаса между радиусами игрок на границе дёргал бы загрузку каждый кадр
+    cancelRadius = (cancel > prefetch) ? cancel : prefetch * 1.5f;
+}
+
+void AreaPrefetcher::SetAreaManifest(int area, PrefetchManifest manifest)
+{
+    // Указатель на манифест держат задания - уже запущенную локацию не трогаем
+    if (areaJobs.count(area)) return;
+    areas[area] = std::move(manifest);
+}
+
+void AreaPrefetcher::SetSectorManifest(int sectorX, int sectorY, PrefetchManifest manifest)
+{
+    const int key = SectorKey(sectorX, sectorY);
+    if (sectorJobs.count(key)) return;
+    sectors[key] = std::move(manifest);
+}
+
+void AreaPrefetcher::AddTrigger(const Vector3& position, int targetArea)
+{
+    triggers.push_back(Trigger{ position, targetArea, -1.0f });
+}
+
+size_t AreaPrefetcher::AddTriggers(const std::vector<ObjectInstance>& objects, const std::vector<ObjectClass>& classes)
+{
+    size_t added = 0;
+    for (const auto& object : objects)
+    {
+        const size_t classIndex = static_cast<size_t>(object.ID);
+        if (classIndex >= classes.size() || classes[classIndex].ClassType != ObjectClassType::LoadTrigger)
+            continue;
+        // Номер локации назначения - первый байт флагов экземпляра
+        AddTrigger(GetObjectPosition(object), object.Flags[0]);
+        ++added;
+    }
+    return added;
+}
+
+Vector3 AreaPrefetcher::GetObjectPosition(const ObjectInstance& object)
+{
+    // Карта PS1: X - запад/восток, Z - север/юг, Y - высота (вниз). В мир - как вершины TMD: (x, -y, -z)
+    const float x = float(object.WEXTilePos * PSX_TILE_UNITS + object.FineWEXPos);
+    const float z = float(object.NSYTilePos * PSX_TILE_UNITS + object.FineNSYPos);
+    const float y = float(object.FineZPos);
+    return Vector3{ x * TMD_WORLD_SCALE, -y * TMD_WORLD_SCALE, -z * TMD_WORLD_SCALE };
+}
+
+void AreaPrefetcher::GetSector(const Vector3& position, int& sectorX, int& sectorY)
+{
+    const float sectorSize = float(PSX_TILE_UNITS * SECTOR_TILES) * TMD_WORLD_SCALE;
+    sectorX = (int)std::floor(position.x / sectorSize);
+    sectorY = (int)std::floor(-position.z / sectorSize);
+}
+
+void AreaPrefetcher::Update(const Vector3& playerPos, float deltaTime)
+{
+    // --- Триггеры загрузки ---
+    for (auto& trigger : triggers)
+    {
+        const float dx = trigger.position.x - playerPos.x;
+        const float dz = trigger.position.z - playerPos.z;
+        const float distance = std::sqrt(dx * dx + dz * dz);
+
+        // Скорость сближения: идёт к триггеру - начинаем раньше, за PREFETCH_LEAD_SECONDS
+        float lead = 0.0f;
+        if (trigger.lastDistance >= 0.0f && deltaTime > 0.0f) {
+            const float approach = (trigger.lastDistance - distance) / deltaTime;
+            if (approach > 0.0f) lead = approach * PREFETCH_LEAD_SECONDS;
+        }
+        trigger.lastDistance = distance;
+
+        auto job = areaJobs.find(trigger.targetArea);
+        if (job == areaJobs.end())
+        {
+            if (distance > prefetchRadius + lead) continue;
+            auto manifest = areas.find(trigger.targetArea);
+            if (manifest == areas.end() || manifest->second.empty()) continue;
+            areaJobs.emplace(trigger.targetArea, Start(manifest->second, true));
+        }
+        else if (distance > cancelRadius)
+        {
+            // Развернулся. В одну локацию может вести несколько триггеров - отменяем, только если далеко от всех
+            bool nearOther = false;
+            for (const auto& other : triggers) {
+                if (&other == &trigger || other.targetArea != trigger.targetArea || other.lastDistance < 0.0f) continue;
+                if (other.lastDistance <= cancelRadius) { nearOther = true; break; }
+            }
+            if (nearOther) continue;
+            Cancel(job->second);
+            areaJobs.erase(job);
+        }
+    }
+
+    // --- Соседние секторы текущей карты ---
+    if (sectors.empty()) return;
+
+    int sx = 0, sy = 0;
+    GetSector(playerPos, sx, sy);
+
+    for (int y = sy - 1; y <= sy + 1; ++y)
+    {
+        for (int x = sx - 1; x <= sx + 1; ++x)
+        {
+            const int key = SectorKey(x, y);
+            if (sectorJobs.count(key)) continue;
+            auto manifest = sectors.find(key);
+            if (manifest == sectors.end() || manifest->second.empty()) continue;
+            sectorJobs.emplace(key, Start(manifest->second, false));
+        }
+    }
+
+    // Дальше второго кольца - отменяем то, что не успело доехать (запас против дребезга на границе)
+    for (auto it = sectorJobs.begin(); it != sectorJobs.end();)
+    {
+        const int x = it->first >> 16;
+        const int y = (int16_t)(it->first & 0xFFFF);
+        if (std::abs(x - sx) > 2 || std::abs(y - sy) > 2) {
+            Cancel(it->second);
+            it = sectorJobs.erase(it);
+        }
+        else ++it;
+    }
+}
+
+AreaPrefetcher::Job AreaPrefetcher::Start(const PrefetchManifest& manifest, bool retain)
+{
+    Job job;
+    job.cancel = GpuUploadQueue::MakeCancelToken();
+    job.manifest = &manifest;
+    job.retained = retain;
+
+    const UploadPriority priority = UploadPriority::Prefetch;
+
+    for (const auto& archive : manifest.archives)
+        ResourceManager::RequestTFile(archive, priority, job.cancel);
+
+    // Банки распаковываются в VabCache: LoadVab при переходе включит их без декодирования
+    for (const auto& vab : manifest.vabs)
+        Game::g_Audio.RequestVab(vab.path, vab.vh, vab.vb, priority, job.cancel);
+
+    for (const auto& file : manifest.textures) {
+        if (retain) ResourceManager::RetainKF(file.path, file.index);
+        ResourceManager::RequestKFTextures(file.path, file.index, priority, job.cancel);
+    }
+    for (const auto& file : manifest.models) {
+        if (retain) ResourceManager::RetainKF(file.path, file.index);
+        ResourceManager::RequestKFModel(file.path, file.index, priority, job.cancel);
+    }
+    return job;
+}
+
+void AreaPrefetcher::Cancel(Job& job)
+{
+    job.cancel->store(true);
+    if (!job.manifest) return;
+
+    // Пропущенные загрузки оставили бы в кеше TextureDB с заглушками - секторы остались бы без текстур
+    for (const auto& file : job.manifest->textures) {
+        if (job.retained) ResourceManager::ReleaseKF(file.path, file.index);
+        else ResourceManager::CancelKF(file.path, file.index);
+    }
+    if (!job.retained) return;
+    for (const auto& file : job.manifest->models)
+        ResourceManager::ReleaseKF(file.path, file.index);
+}
+
+void AreaPrefetcher::Clear()
+{
+    triggers.clear();
+    areaJobs.clear();
+    sectorJobs.clear();
+    areas.clear();
+    sectors.clear();
+}
+
+void AreaPrefetcher::CancelAll()
+{
+    for (auto& job : areaJobs) Cancel(job.second);
+    for (auto& job : sectorJobs) Cancel(job.second);
+    Clear();
+}
@@ -0,0 +1,112 @@
+﻿#pragma once
+#include "raylib.h"
+#include "object.h"
+#include "GpuUploadQueue.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Клетка карты в единицах PS1 (ResolveCurrentMetaTile: x >> 11)
+constexpr int   PSX_TILE_UNITS = 2048;
+// Сектор карты для предзагрузки - квадрат SECTOR_TILES x SECTOR_TILES клеток
+constexpr int   SECTOR_TILES = 8;
+// Радиусы по умолчанию (мировые единицы, клетка = 2.0)
+constexpr float PREFETCH_RADIUS = 24.0f;
+constexpr float PREFETCH_CANCEL_RADIUS = 36.0f;
+// Насколько заранее (в секундах ходьбы) начинать, если игрок идёт к триггеру
+constexpr float PREFETCH_LEAD_SECONDS = 2.0f;
+
+// Файл из архива .T
+struct PrefetchFile
+{
+    std::string path;
+    int index = 0;
+};
+
+// Звуковой банк: пара VH/VB из архива
+struct PrefetchVab
+{
+    std::string path;
+    int vh = -1;
+    int vb = -1;
+};
+
+// Что нужно локации (или сектору), чтобы переход попал в тёплый кеш
+struct PrefetchManifest
+{
+    std::vector<std::string> archives;      // архивы целиком (FDAT, RTMD...)
+    std::vector<PrefetchFile> textures;     // TIM/RTIM -> TextureDB + VRAM
+    std::vector<PrefetchFile> models;       // TMD/RTMD/MO
+    std::vector<PrefetchVab> vabs;          // звуковые банки -> VabCache
+
+    bool empty() const { return archives.empty() && textures.empty() && models.empty() && vabs.empty(); }
+};
+
+/*
+   Предзагрузка локаций по триггерам загрузки (ObjectClassType::LoadTrigger) и соседним секторам.
+   Update() раз в кадр (там же, где оригинал делает UpdatePlayerMapContext):
+   - игрок подошёл к триггеру ближе радиуса (или дойдёт за PREFETCH_LEAD_SECONDS) -
+     ресурсы целевой локации ставятся в очередь с приоритетом Prefetch и удерживаются
+     ResourceManager'ом через переход;
+   - отошёл дальше радиуса отмены (развернулся) - загрузка отменяется, удержание снимается;
+   - секторы вокруг игрока (3x3) грузятся так же, дальше второго кольца - отменяются.
+   Что лежит в локации/секторе, сообщает загрузчик карты (SetAreaManifest / SetSectorManifest).
+*/
+class AreaPrefetcher
+{
+public:
+    AreaPrefetcher() = default;
+
+    AreaPrefetcher(const AreaPrefetcher&) = delete;
+    AreaPrefetcher& operator=(const AreaPrefetcher&) = delete;
+
+    void SetRadii(float prefetch, float cancel);
+
+    void SetAreaManifest(int area, PrefetchManifest manifest);
+    void SetSectorManifest(int sectorX, int sectorY, PrefetchManifest manifest);
+
+    void AddTrigger(const Vector3& position, int targetArea);
+    // Все LoadTrigger среди объектов карты; возвращает число добавленных
+    size_t AddTriggers(const std::vector<ObjectInstance>& objects, const std::vector<ObjectClass>& classes);
+
+    void Update(const Vector3& playerPos, float deltaTime);
+
+    // Переход состоялся: загруженное остаётся в кешах, триггеры и секторы старой карты забываются
+    void Clear();
+    // Выход из игры/загрузка сохранения: ещё не доехавшее отменяется
+    void CancelAll();
+
+    bool IsPrefetching(int area) const { return areaJobs.count(area) != 0; }
+    size_t GetActiveCount() const { return areaJobs.size() + sectorJobs.size(); }
+
+    // Мировая позиция объекта карты (клетка + смещение внутри неё)
+    static Vector3 GetObjectPosition(const ObjectInstance& object);
+    static void GetSector(const Vector3& position, int& sectorX, int& sectorY);
+
+private:
+    struct Trigger {
+        Vector3 position;
+        int targetArea;
+        float lastDistance;
+    };
+
+    struct Job {
+        GpuUploadQueue::CancelToken cancel;
+        const PrefetchManifest* manifest = nullptr;
+        bool retained = false;
+    };
+
+    static int SectorKey(int x, int y) { return (x << 16) | (y & 0xFFFF); }
+
+    static Job Start(const PrefetchManifest& manifest, bool retain);
+    static void Cancel(Job& job);
+
+    float prefetchRadius = PREFETCH_RADIUS;
+    float cancelRadius = PREFETCH_CANCEL_RADIUS;
+
+    std::vector<Trigger> triggers;
+    std::unordered_map<int, PrefetchManifest> areas;
+    std::unordered_map<int, PrefetchManifest> sectors;
+    std::unordered_map<int, Job> areaJobs;
+    std::unordered_map<int, Job> sectorJobs;
+};
@@ -0,0 +1,342 @@
+﻿#include "AudioBench.h"
+#include "soundbank.h"
+#include "PsxAdpcm.h"
+#include "PositionalAudio.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+namespace AudioBench
+{
+    // Каждый замер крутится не меньше этого времени - короткие дают шум таймера
+    constexpr double BENCH_MIN_SECONDS = 0.25;
+    constexpr unsigned int BENCH_BLOCK = 1024;   // кадров за вызов микшера, как у устройства
+
+    using Clock = std::chrono::steady_clock;
+
+    // Повторяет body, пока не наберётся BENCH_MIN_SECONDS; секунды на один вызов
+    template<class F>
+    static double TimePerCall(F&& body, int& iterations)
+    {
+        body(); // прогрев: кеши, пул потоков, первые выделения
+        iterations = 0;
+        const auto start = Clock::now();
+        double elapsed = 0.0;
+        do {
+            body();
+            ++iterations;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        } while (elapsed < BENCH_MIN_SECONDS);
+        return elapsed / iterations;
+    }
+
+    static uint32_t NextRandom(uint32_t& state)
+    {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    }
+
+    static void Put16(ByteArray& data, size_t offset, uint16_t value)
+    {
+        data[offset] = (uint8_t)value;
+        data[offset + 1] = (uint8_t)(value >> 8);
+    }
+
+    ByteArray MakeVag(size_t blocks, uint32_t seed, bool looped)
+    {
+        ByteArray vag(blocks * ADPCM_BLOCK_BYTES);
+        for (size_t b = 0; b < blocks; ++b) {
+            uint8_t* block = vag.data() + b * ADPCM_BLOCK_BYTES;
+            // Все пять фильтров и сдвиги 0..12 - ветки декодера как на настоящих банках
+            block[0] = (uint8_t)(((NextRandom(seed) % 5) << 4) | (NextRandom(seed) % 13));
+            block[1] = (b + 1 == blocks) ? ADPCM_FLAG_END : 0;
+            if (looped && b == 0) block[1] |= ADPCM_FLAG_LOOP_START;
+            if (looped && b + 1 == blocks) block[1] |= ADPCM_FLAG_REPEAT;
+            for (size_t i = 2; i < ADPCM_BLOCK_BYTES; ++i)
+                block[i] = (uint8_t)NextRandom(seed);
+        }
+        return vag;
+    }
+
+    void MakeVab(int vagCount, size_t blocksPerVag, ByteArray& vh, ByteArray& vb)
+    {
+        // Раскладка та же, что читает DecodeVab: программа на VAG, по одному тону
+        const int programs = vagCount < 128 ? vagCount : 128;
+        const size_t tableAddr = 2080 + (size_t)programs * 512 + 2;
+        vh.assign(tableAddr + 256 * 2, 0);
+        const uint8_t magic[4] = { 0x70, 0x42, 0x41, 0x56 }; // "VABp"
+        memcpy(vh.data(), magic, 4);
+        Put16(vh, 18, (uint16_t)programs);
+        Put16(vh, 22, (uint16_t)vagCount);
+        vh[24] = 127;
+
+        for (int p = 0; p < programs; ++p) {
+            vh[32 + p * 16] = 1;         // тонов
+            vh[32 + p * 16 + 1] = 127;   // громкость программы
+            const size_t tone = 2080 + (size_t)p * 512;
+            vh[tone + 2] = 127;
+            vh[tone + 4] = 60;
+            vh[tone + 6] = 0;
+            vh[tone + 7] = 127;
+            Put16(vh, tone + 16, SPU_DEFAULT_ADSR1);
+            Put16(vh, tone + 18, SPU_DEFAULT_ADSR2);
+            Put16(vh, tone + 22, (uint16_t)(p + 1));
+        }
+
+        vb.clear();
+        for (int i = 0; i < vagCount; ++i) {
+            const ByteArray vag = MakeVag(blocksPerVag, 0x1234u + i);
+            Put16(vh, tableAddr + i * 2, (uint16_t)(vag.size() / 8));
+            vb.insert(vb.end(), vag.begin(), vag.end());
+        }
+    }
+
+    ByteArray MakeSeq(int noteCount)
+    {
+        // Заголовок: магия, версия, TPQN 480, темп 500000 мкс, размер такта
+        ByteArray seq = { 0x70, 0x51, 0x45, 0x53, 0, 0, 0, 1, 0x01, 0xE0, 0x07, 0xA1, 0x20, 0x04, 0x02 };
+        seq.insert(seq.end(), { 0x00, 0xC0, 0x00 });
+        for (int i = 0; i < noteCount; ++i) {
+            const uint8_t channel = (uint8_t)(i & 0x0F);
+            const uint8_t note = (uint8_t)(36 + i % 48);
+            seq.insert(seq.end(), { 0x01, (uint8_t)(0x90 | channel), note, 100 });   // через тик
+            seq.insert(seq.end(), { 0x00, (uint8_t)(0x90 | channel), note, 0 });     // NoteOff сразу
+        }
+        seq.insert(seq.end(), { 0x01, 0xFF, 0x2F, 0x00 });
+        return seq;
+    }
+
+    static void BenchAdpcm(std::vector<Result>& results)
+    {
+        const ByteArray vag = MakeVag(64 * 1024, 1);   // 1 МБ
+        const size_t count = PsxAdpcm::CountSamples(vag.data(), vag.size());
+        std::vector<int16_t> pcm16(count);
+        std::vector<float> pcmFloat(count);
+        const double mb = vag.size() / 1e6;
+
+        int iterations = 0;
+        double t = TimePerCall([&] { PsxAdpcm::Decode(vag.data(), vag.size(), pcm16.data()); }, iterations);
+        results.push_back({ "adpcm_decode_int16", mb / t, "MB/s", iterations });
+        t = TimePerCall([&] { PsxAdpcm::Decode(vag.data(), vag.size(), pcmFloat.data()); }, iterations);
+        results.push_back({ "adpcm_decode_float", mb / t, "MB/s", iterations });
+    }
+
+    static void BenchLoadVab(std::vector<Result>& results)
+    {
+        // Порядок KF: несколько десятков VAG по десяткам КБ
+        ByteArray vh, vb;
+        MakeVab(64, 2048, vh, vb);
+
+        AudioSystem audio;
+        audio.InitOffline();
+        short frame[2];
+        bool ok = true;
+        // Снятый банк держится до StopAll в микшере: кадр микшера и Update его отпускают
+        auto load = [&] {
+            ok &= audio.LoadVab(vh, vb);
+            audio.Render(frame, 1);
+            audio.Update();
+        };
+
+        const SampleFormat formats[] = { SampleFormat::Int16, SampleFormat::Float, SampleFormat::Adpcm };
+        const char* names[] = { "int16", "float", "adpcm" };
+        for (int f = 0; f < 3; ++f) {
+            audio.SetSampleFormat(formats[f]);
+            int iterations = 0;
+            const double t = TimePerCall(load, iterations);
+            if (!ok) std::cerr << "Bench: synthetic VAB was not loaded" << std::endl;
+
+            char name[64];
+            snprintf(name, sizeof(name), "vab_load_%s", names[f]);
+            results.push_back({ name, t * 1e3, "ms", iterations });
+            const VabBank* bank = audio.GetBank(MUSIC_BANK);
+            snprintf(name, sizeof(name), "vab_memory_%s", names[f]);
+            results.push_back({ name, bank ? bank->samples.GetMemoryBytes() / 1024.0 : 0.0, "KB", 1 });
+        }
+    }
+
+    static void BenchSeq(std::vector<Result>& results)
+    {
+        // Банк без тонов: меряется проход по событиям, а не голоса
+        const int notes = 50000;
+        const ByteArray seq = MakeSeq(notes);
+        const double events = 2.0 * notes + 2.0;   // + смена программы и конец трека
+
+        int iterations = 0;
+        std::shared_ptr<SeqTrack> track;
+        double t = TimePerCall([&] { track = SeqPlayer::Compile(seq); }, iterations);
+        results.push_back({ "seq_compile", events / t, "events/s", iterations });
+
+        auto bank = std::make_unique<VabBank>();
+        auto spu = std::make_unique<PsxSpu>();
+        spu->InitOffline();
+        SeqPlayer player;
+        player.Attach(spu.get());
+
+        short frame[2];
+        t = TimePerCall([&] {
+            player.Play(track.get(), 0, bank.get());
+            spu->GenerateAudio(frame, 1);   // применить SeqPlay
+            while (player.GetLoopCount() == 0 && player.IsPlaying()) {
+                player.FireDue(*spu);
+                player.Advance(player.FramesUntilEvent(1 << 30));
+            }
+        }, iterations);
+        results.push_back({ "seq_events", events / t, "events/s", iterations });
+    }
+
+    static void BenchMix(std::vector<Result>& results)
+    {
+        // Зацикленный шумовой тон - голоса не кончаются за время замера
+        SamplePool pool;
+        pool.Resize(1);
+        const ByteArray vag = MakeVag(4096, 7, true);
+        std::vector<int16_t> pcm(PsxAdpcm::CountSamples(vag.data(), vag.size()));
+        PsxAdpcm::Decode(vag.data(), vag.size(), pcm.data());
+        pool.Set(0, pcm, 0);
+        Tone tone;
+        tone.data = pool.Get(0);
+        tone.sampleCount = (uint32_t)tone.data.size();
+        tone.loop = true;
+
+        std::vector<short> buffer(BENCH_BLOCK * 2);
+        const int voiceCounts[] = { 8, 24, 64, SPU_VOICES_COUNT };
+        for (int voicesWanted : voiceCounts) {
+            for (int fm = 0; fm < 2; ++fm) {
+                for (int rev = 0; rev < 2; ++rev) {
+                    auto spu = std::make_unique<PsxSpu>();
+                    spu->InitOffline();
+                    spu->SetReverbMode(rev ? SPU_DEFAULT_REVERB : SpuReverbMode::Off);
+                    spu->SetVoiceLimit(SpuVoiceSource::Sfx, SPU_VOICES_COUNT);
+                    for (int v = 0; v < voicesWanted; ++v)
+                        spu->PlayNote(&tone, 0.5f + 0.01f * (v % 50), 0.05f, fm && v > 0, (v % 8) / 7.0f, 60, 0);
+
+                    int iterations = 0;
+                    const double t = TimePerCall([&] { spu->GenerateAudio(buffer.data(), BENCH_BLOCK); }, iterations);
+                    const int active = spu->GetSnapshot().activeCount;
+                    if (active != voicesWanted)
+                        TraceLog(LOG_WARNING, "Bench: %d of %d voices active", active, voicesWanted);
+
+                    char name[64];
+                    snprintf(name, sizeof(name), "mix_v%d_fm%d_rev%d", voicesWanted, fm, rev);
+                    results.push_back({ name, t * 1e9 / BENCH_BLOCK, "ns/frame", iterations });
+                }
+            }
+        }
+
+        // Тот же тон без предекодирования: цена распаковки блоков в колбэке
+        SamplePool raw;
+        raw.Resize(1);
+        raw.SetAdpcm(0, ByteArray(vag));
+        Tone streamed = tone;
+        streamed.data = raw.Get(0);
+        streamed.sampleCount = (uint32_t)streamed.data.size();
+
+        const int streamedVoices = 64;
+        auto spu = std::make_unique<PsxSpu>();
+        spu->InitOffline();
+        spu->SetReverbMode(SpuReverbMode::Off);
+        for (int v = 0; v < streamedVoices; ++v)
+            spu->PlayNote(&streamed, 0.5f + 0.01f * (v % 50), 0.05f, false, (v % 8) / 7.0f, 60, 0);
+        int iterations = 0;
+        const double t = TimePerCall([&] { spu->GenerateAudio(buffer.data(), BENCH_BLOCK); }, iterations);
+        char name[64];
+        snprintf(name, sizeof(name), "mix_v%d_adpcm", streamedVoices);
+        results.push_back({ name, t * 1e9 / BENCH_BLOCK, "ns/frame", iterations });
+    }
+
+    static void BenchPositional(std::vector<Result>& results)
+    {
+        // Длинные VAG: голоса не кончаются, пока идёт замер
+        ByteArray vh, vb;
+        MakeVab(4, 20000, vh, vb);
+        AudioSystem audio;
+        audio.InitOffline();
+        audio.LoadVab(vh, vb, SFX_BANK);
+
+        PositionalAudio positional;
+        positional.Attach(&audio);
+        positional.SetListener({ 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, -1.0f });
+
+        // Источники по кругу вокруг слушателя, все с доплером
+        std::vector<PositionalAudio::EmitterId> ids;
+        for (int i = 0; i < AUDIO_EMITTER_COUNT; ++i) {
+            const PositionalAudio::EmitterId id = positional.CreateEmitter({ 4.0f + (float)(i % 16), 0.0f, (float)(i / 16) },
+                AUDIO_MIN_DISTANCE, AUDIO_MAX_DISTANCE, 1.0f, true);
+            positional.Play(id, i % 4);
+            ids.push_back(id);
+        }
+        short frame[2];
+        audio.Render(frame, 1);
+
+        // Меряется только Update; кадр микшера после него разбирает очередь команд
+        const float dt = 1.0f / 60.0f;
+        double elapsed = 0.0;
+        int iterations = 0;
+        int commands = 0;
+        float angle = 0.0f;
+        do {
+            angle += 0.01f;
+            for (size_t i = 0; i < ids.size(); ++i) {
+                const float a = angle + (float)i * 0.1f;
+                const float r = 3.0f + (float)(i % 16);
+                positional.SetEmitterPosition(ids[i], { cosf(a) * r, 0.0f, sinf(a) * r });
+            }
+            const auto start = Clock::now();
+            positional.Update(dt);
+            elapsed += std::chrono::duration<double>(Clock::now() - start).count();
+            commands += positional.GetLastUpdateCommands();
+            ++iterations;
+            audio.Render(frame, 1);
+        } while (elapsed < BENCH_MIN_SECONDS && iterations < 200000);
+
+        if (commands == 0) std::cerr << "Bench: positional update sent no commands" << std::endl;
+        char name[64];
+        snprintf(name, sizeof(name), "positional_update_e%d", AUDIO_EMITTER_COUNT);
+        results.push_back({ name, elapsed * 1e9 / iterations / AUDIO_EMITTER_COUNT, "ns/emitter", iterations });
+    }
+
+    std::vector<Result> RunAll()
+    {
+        std::vector<Result> results;
+        BenchAdpcm(results);
+        BenchLoadVab(results);
+        BenchSeq(results);
+        BenchMix(results);
+        BenchPositional(results);
+        return results;
+    }
+
+    bool WriteJson(const std::vector<Result>& results, const std::string& path)
+    {
+        FILE* file = fopen(path.c_str(), "w");
+        if (!file) return false;
+        fprintf(file, "{\n  \"suite\": \"audio\",\n  \"results\": [\n");
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            fprintf(file, "    { \"name\": \"%s\", \"value\": %.4f, \"unit\": \"%s\", \"iterations\": %d }%s\n",
+                r.name.c_str(), r.value, r.unit.c_str(), r.iterations, (i + 1 < results.size()) ? "," : "");
+        }
+        fprintf(file, "  ]\n}\n");
+        return fclose(file) == 0;
+    }
+
+    int Main(int argc, char** argv)
+    {
+        const std::string path = (argc > 0) ? argv[0] : "audio_bench.json";
+        SetTraceLogLevel(LOG_WARNING);
+
+        const std::vector<Result> results = RunAll();
+        for (const Result& r : results)
+            printf("%-24s %14.2f %-9s (%d)\n", r.name.c_str(), r.value, r.unit.c_str(), r.iterations);
+
+        if (!WriteJson(results, path)) {
+            std::cerr << "Bench: cannot write " << path << std::endl;
+            return 1;
+        }
+        printf("Bench: results in %s\n", path.c_str());
+        return 0;
+    }
+}
@@ -0,0 +1,33 @@
+﻿#pragma once
+#include "types.h"
+#include <string>
+#include <vector>
+
+/*
+   Замеры звукового тракта без окна и звукового устройства: распаковка ADPCM,
+   LoadVab, разбор SEQ, микшер SPU и PositionalAudio. Данные синтетические (шум в VAG, плотный SEQ),
+   поэтому числа сравнимы между коммитами на одной машине.
+   Запуск: KF2_Port --bench [out.json] - таблица в консоль и JSON в файл.
+*/
+namespace AudioBench
+{
+    struct Result
+    {
+        std::string name;
+        double value = 0.0;
+        std::string unit;
+        int iterations = 0;
+    };
+
+    // Синтетика: VAG из blocks блоков (последний с флагом конца, looped - петля на весь VAG);
+    // VAB из vagCount таких VAG, программа на каждый VAG; SEQ из noteCount пар NoteOn/NoteOff и конца трека
+    ByteArray MakeVag(size_t blocks, uint32_t seed, bool looped = false);
+    void MakeVab(int vagCount, size_t blocksPerVag, ByteArray& vh, ByteArray& vb);
+    ByteArray MakeSeq(int noteCount);
+
+    std::vector<Result> RunAll();
+    bool WriteJson(const std::vector<Result>& results, const std::string& path);
+
+    // argv после "--bench"; код возврата для main
+    int Main(int argc, char** argv);
+}
@@ -1,8 +1,13 @@
-#include "GameContext.h"
+﻿#include "GameContext.h"
 
 void Game::ResetState()
 {
+    g_MorphAnimator.Clear();
+    for (int slot = 0; slot < MAX_ENTITIES; ++slot) Entity_Despawn(slot);
+    // Предзагруженное для новой локации переживает UnloadAll, старые триггеры - нет
+    g_AreaPrefetcher.Clear();
     ResourceManager::UnloadAll();
+    g_LevelArena.Reset();
     //std::memset(&g_Entities, 0, sizeof(g_Entities));
     //std::memset(&EquipmentDatabase, 0, sizeof(FileDescriptors));
     //std::memset(&MagicDefinitionTable, 0, sizeof(MagicDefinitionTable));
@@ -19,10 +24,13 @@ void Game::InitEventSystem()
 
 void Game::InitGraphicsSystem()
 {
+    g_UploadQueue.Init();
 }
 
 void Game::InitSoundSystem()
 {
+    g_Audio.InitSPUSystem();
+    g_PositionalAudio.Attach(&g_Audio);
 }
 
 void Game::InitProjectileSystem()
@@ -95,10 +103,44 @@ void Game::ControllerInput()
 
 void Game::Entities_UpdateAll()
 {
+    g_MorphAnimator.Update(GetFrameTime());
+}
+
+void Game::Entity_Spawn(int slot, const Vector3& position)
+{
+    if (slot < 0 || slot >= MAX_ENTITIES) return;
+    PositionalAudio::EmitterId& emitter = g_EntityEmitters[slot];
+    if (emitter >= 0)
+        g_PositionalAudio.SetEmitterPosition(emitter, position);
+    else
+        emitter = g_PositionalAudio.CreateEmitter(position);
+}
+
+void Game::Entity_Despawn(int slot)
+{
+    if (slot < 0 || slot >= MAX_ENTITIES || g_EntityEmitters[slot] < 0) return;
+    g_PositionalAudio.DestroyEmitter(g_EntityEmitters[slot]);
+    g_EntityEmitters[slot] = -1;
+}
+
+void Game::Entity_SetPosition(int slot, const Vector3& position)
+{
+    if (slot < 0 || slot >= MAX_ENTITIES) return;
+    g_PositionalAudio.SetEmitterPosition(g_EntityEmitters[slot], position);
+}
+
+uint32_t Game::Entity_PlaySound(int slot, int program, int note)
+{
+    if (slot < 0 || slot >= MAX_ENTITIES) return 0;
+    return g_PositionalAudio.Play(g_EntityEmitters[slot], program, note);
 }
 
 void Game::UpdatePlayerSystem()
 {
+    // Оригинал здесь же обновляет UpdatePlayerMapContext по позиции игрока
+    g_AreaPrefetcher.Update(g_Player.PlayerPos, GetFrameTime());
+    // Слушатель - игрок; взгляд вдоль -Z, пока у Player нет направления камеры
+    g_PositionalAudio.SetListener(g_Player.PlayerPos, Vector3{ 0.0f, 0.0f, -1.0f });
 }
 
 void Game::ProcessCurrentMode()
@@ -2,24 +2,58 @@
 #include "ResourceManager.h"
 
 #include "Entity.h"
+#include "MemoryArena.h"
+#include "MorphAnimation.h"
+#include "AreaPrefetcher.h"
+#include "PositionalAudio.h"
 #include <vector>
 
 
 namespace Game {
-    //   (  )
+    // Константы размеров (из твоего реверса)
     constexpr int MAX_ENTITIES = 200;
     constexpr int RESOURCE_BUFFER_SIZE = 389120;
+    // В порте данные распакованы (float, RGBA), поэтому блок арены больше оригинального буфера
+    constexpr size_t LEVEL_ARENA_SIZE = 16 * 1024 * 1024;
 
-    //   (  namespace)
+    // Глобальные переменные (инкапсулированные в namespace)
     inline std::array<Entity, MAX_ENTITIES> g_Entities;
     inline std::array<uint8_t, RESOURCE_BUFFER_SIZE> g_ResourceBuffer;
 
-    //       IDA
+    // Временные буферы декодеров текущей локации (сборка TMD/MO).
+    // Освобождается целиком в ResetState().
+    inline MemoryArena g_LevelArena{ LEVEL_ARENA_SIZE };
+
+    // Вершинная анимация всех MO-моделей уровня
+    inline MorphAnimator g_MorphAnimator;
+
+    // Звук: SPU, банки VAB, SEQ. Объявлен до очереди загрузки - её потоки (RequestVab)
+    // останавливаются раньше, чем разрушается звук
+    inline AudioSystem g_Audio;
+
+    // Звуки сущностей в мире; источник у каждой заспавненной сущности, слушатель - игрок.
+    // Update() раз в кадр из главного цикла, когда сущности и игрок уже сдвинулись
+    inline PositionalAudio g_PositionalAudio;
+    // Источник звука сущности по номеру её слота в g_Entities (-1 - нет).
+    // Рядом, а не в Entity: та повторяет раскладку оригинальной структуры
+    inline std::array<PositionalAudio::EmitterId, MAX_ENTITIES> g_EntityEmitters = [] {
+        std::array<PositionalAudio::EmitterId, MAX_ENTITIES> ids;
+        ids.fill(-1);
+        return ids;
+    }();
+
+    // Фоновая распаковка + загрузка в GPU по бюджету кадра (Process() раз в кадр из главного цикла)
+    inline GpuUploadQueue g_UploadQueue;
+
+    // Предзагрузка соседних локаций по триггерам загрузки (Update() из UpdatePlayerSystem)
+    inline AreaPrefetcher g_AreaPrefetcher;
+
+    // Те самые странные байтовые буферы из IDA
     inline uint8_t g_Scratchpad_80180138[24380];
 
     inline int32_t g_FrameCounter = 0;
     inline int16_t g_LanguageID = 0;
-    inline int32_t g_NextState = 0; // ,   *(_DWORD *)(v4 + 416)
+    inline int32_t g_NextState = 0; // То, что было *(_DWORD *)(v4 + 416)
 
     inline Player g_Player;
 
@@ -27,7 +61,7 @@ namespace Game {
 
     inline PsxRect ScreenSetting;
 
-    //  
+    // Функции управления
     void InitEventSystem();
 
     void InitGraphicsSystem();
@@ -56,6 +90,11 @@ namespace Game {
 
     void ControllerInput();
     void Entities_UpdateAll();
+    // Сущность в слоте g_Entities: источник звука создаётся и снимается вместе с ней
+    void Entity_Spawn(int slot, const Vector3& position);
+    void Entity_Despawn(int slot);
+    void Entity_SetPosition(int slot, const Vector3& position);
+    uint32_t Entity_PlaySound(int slot, int program, int note = 60);
     void UpdatePlayerSystem();
     void ProcessCurrentMode();
 
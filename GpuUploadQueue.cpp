@@ -0,0 +1,198 @@
+﻿#include "GpuUploadQueue.h"
+#include <chrono>
+
+namespace
+{
+    // Image, которым владеет задание: освобождается и при загрузке, и при отмене
+    struct OwnedImage {
+        Image image;
+        explicit OwnedImage(Image img) : image(img) {}
+        ~OwnedImage() { if (image.data) UnloadImage(image); }
+        OwnedImage(const OwnedImage&) = delete;
+        OwnedImage& operator=(const OwnedImage&) = delete;
+    };
+
+    double NowMs()
+    {
+        using namespace std::chrono;
+        return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+void GpuUploadQueue::Init(size_t workerCount)
+{
+    if (placeholder.id == 0) {
+        // Розово-чёрная шахматка - сразу видно, что текстура ещё не доехала
+        Image checker = GenImageChecked(16, 16, 4, 4, Color{ 255, 0, 255, 255 }, Color{ 0, 0, 0, 255 });
+        placeholder = LoadTextureFromImage(checker);
+        UnloadImage(checker);
+    }
+    if (!pool)
+        pool = std::make_unique<ThreadPool>(workerCount);
+}
+
+void GpuUploadQueue::Shutdown()
+{
+    // Сначала потоки: они ещё могут класть задания в очередь
+    pool.reset();
+
+    {
+        std::lock_guard<std::mutex> lock(decodeMutex);
+        for (auto& q : decodes) q.clear();
+    }
+    {
+        std::lock_guard<std::mutex> lock(uploadMutex);
+        for (auto& q : uploads) q.clear();
+    }
+    pendingDecodes = 0;
+
+    if (placeholder.id != 0) {
+        UnloadTexture(placeholder);
+        placeholder = Texture2D{ 0 };
+    }
+}
+
+void GpuUploadQueue::Decode(UploadPriority priority, std::function<void()> work, CancelToken cancel)
+{
+    // Без рабочих потоков (утилиты, Init не вызывали) распаковываем сразу
+    if (!pool) {
+        if (!IsCancelled(cancel)) work();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(decodeMutex);
+        decodes[(size_t)priority].push_back(DecodeTask{ std::move(cancel), std::move(work) });
+    }
+    ++pendingDecodes;
+
+    // Каждая задача пула берёт самую приоритетную распаковку, а не свою
+    pool->Submit([this]() { RunNextDecode(); });
+}
+
+void GpuUploadQueue::RunNextDecode()
+{
+    DecodeTask task;
+    {
+        std::lock_guard<std::mutex> lock(decodeMutex);
+        for (auto& q : decodes) {
+            if (!q.empty()) {
+                task = std::move(q.front());
+                q.pop_front();
+                break;
+            }
+        }
+    }
+
+    if (task.work && !IsCancelled(task.cancel))
+        task.work();
+
+    if (task.work) --pendingDecodes;
+}
+
+void GpuUploadQueue::Push(UploadPriority priority, Job job)
+{
+    std::lock_guard<std::mutex> lock(uploadMutex);
+    uploads[(size_t)priority].push_back(std::move(job));
+}
+
+void GpuUploadQueue::PushTexture(UploadPriority priority, Image image, std::shared_ptr<Texture2D> slot,
+    CancelToken cancel, std::function<void()> onReady)
+{
+    auto owned = std::make_shared<OwnedImage>(image);
+    const unsigned int placeholderId = placeholder.id;
+
+    Job job;
+    job.cancel = std::move(cancel);
+    job.step = [owned, slot, placeholderId, onReady]() {
+        Texture2D tex = LoadTextureFromImage(owned->image);
+        if (tex.id == 0) {
+            TraceLog(LOG_WARNING, "GpuUploadQueue: texture upload failed (%ix%i)", owned->image.width, owned->image.height);
+            return true;
+        }
+        // Повторная загрузка в тот же слот - старую текстуру освобождаем
+        if (slot->id != 0 && slot->id != placeholderId)
+            UnloadTexture(*slot);
+        *slot = tex;
+        if (onReady) onReady();
+        return true;
+    };
+    Push(priority, std::move(job));
+}
+
+void GpuUploadQueue::PushModel(UploadPriority priority, std::shared_ptr<Model> model,
+    CancelToken cancel, std::function<void()> onReady)
+{
+    auto next = std::make_shared<int>(0);
+
+    Job job;
+    job.cancel = std::move(cancel);
+    job.step = [model, next, onReady]() {
+        if (*next < model->meshCount) {
+            UploadMesh(&model->meshes[*next], false);
+            ++*next;
+        }
+        if (*next < model->meshCount) return false;
+        if (onReady) onReady();
+        return true;
+    };
+    Push(priority, std::move(job));
+}
+
+size_t GpuUploadQueue::Process(double budget)
+{
+    if (budget < 0.0) budget = budgetMs;
+
+    const double start = NowMs();
+    size_t done = 0;
+
+    for (;;)
+    {
+        Job job;
+        size_t level = 0;
+        {
+            std::lock_guard<std::mutex> lock(uploadMutex);
+            for (level = 0; level < uploads.size(); ++level) {
+                if (!uploads[level].empty()) break;
+            }
+            if (level == uploads.size()) break;
+
+            // Бюджет кончился - Immediate всё равно грузим, остальное ждёт следующего кадра
+            if (done > 0 && level != (size_t)UploadPriority::Immediate && NowMs() - start >= budget)
+                break;
+
+            job = std::move(uploads[level].front());
+            uploads[level].pop_front();
+        }
+
+        if (IsCancelled(job.cancel)) continue;
+
+        if (!job.step()) {
+            // Недогруженная модель встаёт первой в своём приоритете
+            std::lock_guard<std::mutex> lock(uploadMutex);
+            uploads[level].push_front(std::move(job));
+        }
+        ++done;
+    }
+
+    lastProcessMs = NowMs() - start;
+    return done;
+}
+
+std::shared_ptr<Texture2D> GpuUploadQueue::MakeTextureSlot() const
+{
+    const unsigned int placeholderId = placeholder.id;
+    return std::shared_ptr<Texture2D>(new Texture2D(placeholder), [placeholderId](Texture2D* t) {
+        if (t->id != 0 && t->id != placeholderId)
+            UnloadTexture(*t);
+        delete t;
+        });
+}
+
+size_t GpuUploadQueue::GetPendingUploads() const
+{
+    std::lock_guard<std::mutex> lock(uploadMutex);
+    size_t count = 0;
+    for (const auto& q : uploads) count += q.size();
+    return count;
+}
@@ -0,0 +1,102 @@
+﻿#pragma once
+#include "raylib.h"
+#include "ThreadPool.h"
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// Сколько миллисекунд кадра главный поток тратит на загрузку в GPU
+constexpr double GPU_UPLOAD_BUDGET_MS = 2.0;
+
+enum class UploadPriority : uint8_t
+{
+    Immediate = 0,  // нужно в этом кадре, бюджет не учитывается
+    High,           // то, что уже видно
+    Normal,
+    Prefetch,       // предзагрузка соседних локаций
+    Count
+};
+
+/*
+   Очередь загрузки ресурсов в GPU.
+   Распаковка (TextureDB, сборка мешей) идёт на рабочих потоках через Decode(),
+   результат кладётся в очередь заданий загрузки (PushTexture / PushModel),
+   главный поток разбирает её в Process() в пределах бюджета, от высшего приоритета к низшему.
+   Пока текстура не загружена, её слот показывает текстуру-заглушку.
+*/
+class GpuUploadQueue
+{
+public:
+    // Отмена: выставить в true - ещё не выполненные распаковки и загрузки выбрасываются
+    using CancelToken = std::shared_ptr<std::atomic<bool>>;
+    static CancelToken MakeCancelToken() { return std::make_shared<std::atomic<bool>>(false); }
+    static bool IsCancelled(const CancelToken& token) { return token && token->load(); }
+
+    GpuUploadQueue() = default;
+    ~GpuUploadQueue() { Shutdown(); }
+
+    GpuUploadQueue(const GpuUploadQueue&) = delete;
+    GpuUploadQueue& operator=(const GpuUploadQueue&) = delete;
+
+    // Только после InitWindow: создаёт заглушку и рабочие потоки
+    void Init(size_t workerCount = 0);
+    // Дожидается потоков и выбрасывает всё незагруженное
+    void Shutdown();
+
+    // --- Рабочие потоки ---
+    void Decode(UploadPriority priority, std::function<void()> work, CancelToken cancel = nullptr);
+
+    // image переходит во владение очереди. onReady вызывается в главном потоке после загрузки.
+    void PushTexture(UploadPriority priority, Image image, std::shared_ptr<Texture2D> slot,
+        CancelToken cancel = nullptr, std::function<void()> onReady = {});
+    // Меши грузятся по одному за шаг, чтобы крупная модель не съела бюджет кадра
+    void PushModel(UploadPriority priority, std::shared_ptr<Model> model,
+        CancelToken cancel = nullptr, std::function<void()> onReady = {});
+
+    // --- Главный поток ---
+    // Возвращает число выполненных заданий
+    size_t Process(double budgetMs = -1.0);
+    void SetBudget(double ms) { budgetMs = ms; }
+    double GetBudget() const { return budgetMs; }
+
+    // Слот с заглушкой; после загрузки содержимое слота подменяется настоящей текстурой
+    std::shared_ptr<Texture2D> MakeTextureSlot() const;
+    const Texture2D& GetPlaceholder() const { return placeholder; }
+    bool IsPlaceholder(const Texture2D& texture) const { return texture.id == placeholder.id; }
+
+    size_t GetPendingUploads() const;
+    size_t GetPendingDecodes() const { return pendingDecodes.load(); }
+    bool IsIdle() const { return GetPendingUploads() == 0 && GetPendingDecodes() == 0; }
+    double GetLastProcessMs() const { return lastProcessMs; }
+
+private:
+    struct Job {
+        CancelToken cancel;
+        // true - задание выполнено, false - нужен ещё шаг (следующий меш и т.п.)
+        std::function<bool()> step;
+    };
+
+    struct DecodeTask {
+        CancelToken cancel;
+        std::function<void()> work;
+    };
+
+    void Push(UploadPriority priority, Job job);
+    void RunNextDecode();
+
+    std::array<std::deque<Job>, (size_t)UploadPriority::Count> uploads;
+    std::array<std::deque<DecodeTask>, (size_t)UploadPriority::Count> decodes;
+    mutable std::mutex uploadMutex;
+    std::mutex decodeMutex;
+    std::atomic<size_t> pendingDecodes{ 0 };
+
+    Texture2D placeholder = { 0 };
+    double budgetMs = GPU_UPLOAD_BUDGET_MS;
+    double lastProcessMs = 0.0;
+
+    // Последним: разрушается первым, пока очереди ещё живы
+    std::unique_ptr<ThreadPool> pool;
+};
@@ -0,0 +1,170 @@
+﻿#include "MOModel.h"
+#include "utilities.h"
+#include <algorithm>
+#include <iostream>
+
+MOModel::MOModel(const ByteArray& data)
+{
+    try {
+        valid = load(data);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "MOModel: " << e.what() << std::endl;
+        targets.clear();
+        animations.clear();
+        valid = false;
+    }
+}
+
+std::vector<uint32_t> MOModel::readOffsetTable(const ByteArray& data, size_t tableOffset)
+{
+    // Таблица кончается там, где начинаются данные, на которые она ссылается
+    std::vector<uint32_t> offsets;
+    size_t end = data.size();
+    for (size_t pos = tableOffset; pos + 4 <= end; pos += 4)
+    {
+        uint32_t off = Utilities::as<uint32_t>(data, pos);
+        if (off <= pos || off >= data.size()) break;
+        offsets.push_back(off);
+        end = std::min<size_t>(end, off);
+    }
+    return offsets;
+}
+
+bool MOModel::load(const ByteArray& data)
+{
+    if (data.size() < 20) return false;
+
+    bool animated = Utilities::as<uint32_t>(data, 4) != 0;
+    uint32_t tmdOffset = Utilities::as<uint32_t>(data, 8);
+    uint32_t targetTable = Utilities::as<uint32_t>(data, 12);
+    uint32_t animTable = Utilities::as<uint32_t>(data, 16);
+
+    // 1. Сама модель
+    tmd = TMDModel(data, tmdOffset);
+    if (!tmd.isValid()) {
+        std::cerr << "MOModel: embedded TMD at 0x" << std::hex << tmdOffset << std::dec << " is invalid" << std::endl;
+        return false;
+    }
+
+    // Статичный MO - просто TMD в обёртке
+    if (!animated || targetTable == 0 || animTable == 0)
+        return true;
+
+    // 2. Морф-цели
+    for (uint32_t off : readOffsetTable(data, targetTable))
+    {
+        MorphTarget target;
+        if (!loadTarget(data, off, target)) break;
+        targets.push_back(std::move(target));
+    }
+
+    // 3. Анимации. Битый ключ (ссылка на несуществующую цель, выход за файл) пропускается;
+    // анимация без единого целого ключа остаётся пустой, чтобы номера следующих не сдвигались
+    for (uint32_t off : readOffsetTable(data, animTable))
+    {
+        Animation anim;
+        if (!loadAnimation(data, off, anim))
+            std::cerr << "MOModel: animation " << animations.size() << " has no valid keys" << std::endl;
+        animations.push_back(std::move(anim));
+    }
+
+    return true;
+}
+
+bool MOModel::loadTarget(const ByteArray& data, size_t offset, MorphTarget& out) const
+{
+    const size_t vertexCount = tmd.getVertexCount();
+
+    if (offset + 2 > data.size()) return false;
+    int count = Utilities::as<uint16_t>(data, offset);
+    size_t pos = offset + 2;
+    uint32_t vertex = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (pos + 4 > data.size()) return false;
+        int16_t x = Utilities::as<int16_t>(data, pos);
+
+        if (x == -32768) {
+            vertex += Utilities::as<uint16_t>(data, pos + 2);
+            pos += 4;
+            continue;
+        }
+
+        if (pos + 6 > data.size()) return false;
+        if (vertex >= vertexCount) return false;
+
+        TMDModel::Vertex v;
+        v.x = x;
+        v.y = Utilities::as<int16_t>(data, pos + 2);
+        v.z = Utilities::as<int16_t>(data, pos + 4);
+        v.pad = 0;
+        out.index.push_back(vertex);
+        out.pos.push_back(v);
+
+        ++vertex;
+        pos += 6;
+    }
+    return true;
+}
+
+bool MOModel::loadAnimation(const ByteArray& data, size_t offset, Animation& out) const
+{
+    if (offset + 4 > data.size()) return false;
+    uint16_t keyCount = Utilities::as<uint16_t>(data, offset);
+    if (offset + 4 + keyCount * 4 > data.size()) return false;
+
+    int skipped = 0;
+    for (uint16_t k = 0; k < keyCount; ++k)
+    {
+        const size_t keyOffset = Utilities::as<uint32_t>(data, offset + 4 + k * 4);
+        if (keyOffset + 8 > data.size()) { ++skipped; continue; }
+
+        Keyframe key;
+        key.reverse = Utilities::as<uint16_t>(data, keyOffset) != 0;
+        key.duration = Utilities::as<uint16_t>(data, keyOffset + 2);
+        key.target = Utilities::as<uint16_t>(data, keyOffset + 4);
+        uint16_t baseCount = Utilities::as<uint16_t>(data, keyOffset + 6);
+
+        // baseCount == 0: поза ключа - исходные вершины TMD
+        if (baseCount > 0) {
+            if (keyOffset + 8 + baseCount * 2 > data.size()) { ++skipped; continue; }
+            for (uint16_t b = 0; b < baseCount; ++b)
+                key.bases.push_back(Utilities::as<uint16_t>(data, keyOffset + 8 + b * 2));
+        }
+
+        bool inRange = key.target < targets.size();
+        for (uint16_t b : key.bases) inRange = inRange && b < targets.size();
+        if (!inRange) { ++skipped; continue; }
+
+        out.length += key.duration;
+        out.keys.push_back(std::move(key));
+    }
+    if (skipped > 0)
+        std::cerr << "MOModel: skipped " << skipped << " of " << keyCount << " keys at 0x" << std::hex << offset << std::dec << std::endl;
+    return !out.keys.empty();
+}
+
+bool MOModel::evaluate(size_t anim, uint32_t time, size_t& key, int32_t& weight) const
+{
+    if (anim >= animations.size() || animations[anim].keys.empty()) return false;
+    const auto& keys = animations[anim].keys;
+
+    uint32_t start = 0;
+    for (size_t k = 0; k < keys.size(); ++k)
+    {
+        uint32_t end = start + keys[k].duration;
+        if (time < end) {
+            int32_t t = static_cast<int32_t>(((time - start) << 12) / keys[k].duration);
+            key = k;
+            weight = keys[k].reverse ? 4096 - t : t;
+            return true;
+        }
+        start = end;
+    }
+
+    key = keys.size() - 1;
+    weight = 4096;
+    return true;
+}
@@ -0,0 +1,65 @@
+﻿#pragma once
+#include "TMDModel.h"
+#include <cstdint>
+#include <vector>
+
+/*
+   MO (morph object) - модель врагов/NPC с вершинной анимацией.
+   Раскладка восстановлена по MOLoadedCallback и SubmitDisplayListToGPU (sub_800365CC и соседи):
+     +0x04  не 0 - у модели есть анимации
+     +0x08  смещение TMD
+     +0x0C  смещение таблицы морф-целей (u32 смещения от начала файла)
+     +0x10  смещение таблицы анимаций (u32 смещения от начала файла)
+   Морф-цель: i16 count, затем count записей: (x, y, z) - абсолютная позиция очередной вершины,
+   или (-32768, n) - пропустить n вершин.
+   Анимация: u16 keyCount, u16 pad, u32 keyOffsets[keyCount].
+   Ключ: u16 reverse, u16 duration, u16 target, u16 baseCount, u16 bases[baseCount].
+   Поза ключа = исходные вершины TMD, поверх которых по очереди наложены bases,
+   затем идёт интерполяция к target с весом 0..4096 (4.12).
+   Количество целей/анимаций в файле не хранится - таблицы читаются до начала первых данных.
+*/
+class MOModel
+{
+public:
+    // Разреженная морф-цель: только те вершины, которые она задаёт
+    struct MorphTarget {
+        std::vector<uint32_t> index;         // сквозной индекс вершины TMD
+        std::vector<TMDModel::Vertex> pos;   // абсолютная позиция
+    };
+
+    struct Keyframe {
+        bool reverse = false;   // вес идёт от 4096 к 0
+        uint16_t duration = 0;  // в тиках
+        uint16_t target = 0;
+        std::vector<uint16_t> bases;
+    };
+
+    struct Animation {
+        std::vector<Keyframe> keys;
+        uint32_t length = 0;    // сумма duration
+    };
+
+    MOModel() = default;
+    explicit MOModel(const ByteArray& data);
+
+    bool isValid() const { return valid; }
+    const TMDModel& getTMD() const { return tmd; }
+    const std::vector<MorphTarget>& getTargets() const { return targets; }
+    const std::vector<Animation>& getAnimations() const { return animations; }
+    size_t getAnimationCount() const { return animations.size(); }
+
+    // sub_800365CC: ключ и вес (4.12) для момента time внутри анимации.
+    // После конца анимации возвращается последний ключ с весом 4096.
+    bool evaluate(size_t anim, uint32_t time, size_t& key, int32_t& weight) const;
+
+private:
+    bool load(const ByteArray& data);
+    bool loadTarget(const ByteArray& data, size_t offset, MorphTarget& out) const;
+    bool loadAnimation(const ByteArray& data, size_t offset, Animation& out) const;
+    static std::vector<uint32_t> readOffsetTable(const ByteArray& data, size_t tableOffset);
+
+    TMDModel tmd;
+    std::vector<MorphTarget> targets;
+    std::vector<Animation> animations;
+    bool valid = false;
+};
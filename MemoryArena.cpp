@@ -0,0 +1,167 @@
+﻿#include "MemoryArena.h"
+#include "raylib.h"
+#include <algorithm>
+
+namespace
+{
+    constexpr size_t CHUNK_ALIGN = 64;
+    constexpr size_t DEFAULT_CHUNK_SIZE = 4 * 1024 * 1024;
+
+    inline size_t AlignUp(size_t value, size_t align)
+    {
+        return (value + align - 1) & ~(align - 1);
+    }
+}
+
+MemoryArena::MemoryArena(size_t chunkSize)
+{
+    if (chunkSize > 0)
+        Init(chunkSize);
+}
+
+MemoryArena::~MemoryArena()
+{
+    Release();
+}
+
+void MemoryArena::Init(size_t size)
+{
+    Release();
+    chunkSize = (size > 0) ? size : DEFAULT_CHUNK_SIZE;
+    AddChunk(chunkSize);
+}
+
+bool MemoryArena::AddChunk(size_t minSize)
+{
+    Chunk chunk;
+    chunk.size = AlignUp(std::max(minSize, chunkSize), CHUNK_ALIGN);
+    chunk.data = static_cast<uint8_t*>(::operator new(chunk.size, std::align_val_t(CHUNK_ALIGN), std::nothrow));
+    if (!chunk.data) {
+        TraceLog(LOG_ERROR, "MemoryArena: failed to allocate chunk of %zu bytes", chunk.size);
+        return false;
+    }
+    chunks.push_back(chunk);
+    return true;
+}
+
+void* MemoryArena::Allocate(size_t size, size_t align)
+{
+    if (size == 0) size = 1;
+    // size + align для нового блока не должен переполниться
+    if (size > SIZE_MAX - align - CHUNK_ALIGN) throw std::bad_alloc();
+    if (chunkSize == 0) chunkSize = DEFAULT_CHUNK_SIZE;
+
+    // 1. Пробуем текущий блок, затем уже выделенные после него (остались с прошлого уровня)
+    for (; current < chunks.size(); ++current) {
+        Chunk& c = chunks[current];
+        uintptr_t base = reinterpret_cast<uintptr_t>(c.data);
+        size_t offset = AlignUp(base + c.used, align) - base;
+        if (offset + size <= c.size) {
+            c.used = offset + size;
+            peak = std::max(peak, GetUsed());
+            return c.data + offset;
+        }
+    }
+
+    // 2. Места нет - заводим новый блок (большие запросы получают блок под себя)
+    if (!AddChunk(size + align))
+        throw std::bad_alloc();
+
+    current = chunks.size() - 1;
+    Chunk& c = chunks[current];
+    uintptr_t base = reinterpret_cast<uintptr_t>(c.data);
+    size_t offset = AlignUp(base, align) - base;
+    c.used = offset + size;
+    peak = std::max(peak, GetUsed());
+    return c.data + offset;
+}
+
+void MemoryArena::RegisterFinalizer(void (*fn)(void*), void* ptr)
+{
+    Finalizer* f = static_cast<Finalizer*>(Allocate(sizeof(Finalizer), alignof(Finalizer)));
+    f->fn = fn;
+    f->ptr = ptr;
+    f->next = finalizers;
+    finalizers = f;
+}
+
+void MemoryArena::RunFinalizers(Finalizer* stopAt)
+{
+    // Деструкторы в обратном порядке создания (список и так LIFO)
+    while (finalizers && finalizers != stopAt) {
+        Finalizer* f = finalizers;
+        finalizers = f->next;
+        f->fn(f->ptr);
+    }
+}
+
+void MemoryArena::Reset()
+{
+    RunFinalizers();
+
+    // Уровень не поместился в один блок - склеиваем, чтобы в следующий раз хватило одного
+    if (chunks.size() > 1) {
+        size_t total = GetCapacity();
+        for (auto& c : chunks)
+            ::operator delete(c.data, std::align_val_t(CHUNK_ALIGN));
+        chunks.clear();
+        AddChunk(total);
+    }
+
+    for (auto& c : chunks)
+        c.used = 0;
+
+    current = 0;
+    ++generation;
+}
+
+void MemoryArena::Release()
+{
+    RunFinalizers();
+
+    for (auto& c : chunks)
+        ::operator delete(c.data, std::align_val_t(CHUNK_ALIGN));
+    chunks.clear();
+
+    current = 0;
+    ++generation;
+}
+
+MemoryArena::Marker MemoryArena::GetMarker() const
+{
+    Marker m;
+    m.chunk = current;
+    m.offset = (current < chunks.size()) ? chunks[current].used : 0;
+    m.generation = generation;
+    m.finalizers = finalizers;
+    return m;
+}
+
+void MemoryArena::Rewind(const Marker& marker)
+{
+    // Маркер от прошлого уровня уже ничего не значит
+    if (marker.generation != generation) return;
+
+    RunFinalizers(static_cast<Finalizer*>(marker.finalizers));
+
+    for (size_t i = marker.chunk + 1; i < chunks.size(); ++i)
+        chunks[i].used = 0;
+    if (marker.chunk < chunks.size())
+        chunks[marker.chunk].used = marker.offset;
+
+    current = marker.chunk;
+}
+
+size_t MemoryArena::GetUsed() const
+{
+    size_t used = 0;
+    for (const auto& c : chunks) used += c.used;
+    return used;
+}
+
+size_t MemoryArena::GetCapacity() const
+{
+    size_t capacity = 0;
+    for (const auto& c : chunks) capacity += c.size;
+    return capacity;
+}
@@ -0,0 +1,148 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+// Линейный (bump) аллокатор уровня.
+// Аналог g_ResourceBuffer[389120] + Heap_Init / FMOAllocateBuffer из GAME.EXE:
+// временные буферы декодеров локации (сборка мешей TMD, распаковка MO) берутся из больших
+// блоков и освобождаются откатом (ArenaScratchScope) или одним вызовом Reset() при смене карты.
+// Не потокобезопасен: используется только из игрового потока.
+class MemoryArena
+{
+public:
+    // Точка отката для временных (scratch) выделений
+    struct Marker {
+        size_t chunk = 0;
+        size_t offset = 0;
+        uint32_t generation = 0;
+        void* finalizers = nullptr;
+    };
+
+    explicit MemoryArena(size_t chunkSize = 0);
+    ~MemoryArena();
+
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+
+    // Heap_Init: задаёт размер блока и сразу резервирует первый
+    void Init(size_t chunkSize);
+
+    // FMOAllocateBuffer: выделение без освобождения по одному.
+    // Как operator new: nullptr не возвращает, нехватка памяти - std::bad_alloc
+    void* Allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    template<class T, class... Args>
+    T* New(Args&&... args)
+    {
+        void* mem = Allocate(sizeof(T), alignof(T));
+        T* obj = new (mem) T(std::forward<Args>(args)...);
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            // Узел финализатора не выделился - объект разрушаем сразу, иначе его деструктор потерян
+            try {
+                RegisterFinalizer([](void* p) { static_cast<T*>(p)->~T(); }, obj);
+            }
+            catch (...) {
+                obj->~T();
+                throw;
+            }
+        }
+        return obj;
+    }
+
+    // Массив POD-данных (вершины, индексы, сырые буферы декодеров)
+    template<class T>
+    T* NewArray(size_t count)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "MemoryArena::NewArray: only trivially destructible types");
+        if (count == 0) return nullptr;
+        return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    // Освобождает всё разом. Если уровень не влез в один блок,
+    // блоки склеиваются в один большой, чтобы следующая загрузка шла без фрагментации.
+    void Reset();
+    // Полностью отдаёт память системе
+    void Release();
+
+    Marker GetMarker() const;
+    void Rewind(const Marker& marker);
+
+    size_t GetUsed() const;
+    size_t GetCapacity() const;
+    size_t GetPeak() const { return peak; }
+    size_t GetChunkCount() const { return chunks.size(); }
+    // Меняется на каждом Reset() - маркер, снятый до него, больше не откатывает
+    uint32_t GetGeneration() const { return generation; }
+
+private:
+    struct Chunk {
+        uint8_t* data = nullptr;
+        size_t size = 0;
+        size_t used = 0;
+    };
+
+    struct Finalizer {
+        void (*fn)(void*);
+        void* ptr;
+        Finalizer* next;
+    };
+
+    void RegisterFinalizer(void (*fn)(void*), void* ptr);
+    void RunFinalizers(Finalizer* stopAt = nullptr);
+    bool AddChunk(size_t minSize);
+
+    std::vector<Chunk> chunks;
+    size_t current = 0;
+    size_t chunkSize = 0;
+    size_t peak = 0;
+    uint32_t generation = 0;
+    Finalizer* finalizers = nullptr;
+};
+
+
+// RAII-откат арены: всё, что выделено внутри области, освобождается на выходе.
+// Для временных буферов декодеров (распаковка, промежуточные вершины).
+class ArenaScratchScope
+{
+public:
+    explicit ArenaScratchScope(MemoryArena& a) : arena(a), marker(a.GetMarker()) {}
+    ~ArenaScratchScope() { arena.Rewind(marker); }
+
+    ArenaScratchScope(const ArenaScratchScope&) = delete;
+    ArenaScratchScope& operator=(const ArenaScratchScope&) = delete;
+
+private:
+    MemoryArena& arena;
+    MemoryArena::Marker marker;
+};
+
+
+// Адаптер для STL: std::vector<T, ArenaAllocator<T>> для временных массивов загрузчиков.
+// deallocate ничего не делает - память вернётся вместе с ареной.
+template<class T>
+struct ArenaAllocator
+{
+    using value_type = T;
+
+    MemoryArena* arena = nullptr;
+
+    explicit ArenaAllocator(MemoryArena& a) noexcept : arena(&a) {}
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena(other.arena) {}
+
+    T* allocate(size_t n)
+    {
+        if (n > SIZE_MAX / sizeof(T)) throw std::bad_array_new_length();
+        return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) noexcept {}
+
+    template<class U>
+    bool operator==(const ArenaAllocator<U>& other) const noexcept { return arena == other.arena; }
+    template<class U>
+    bool operator!=(const ArenaAllocator<U>& other) const noexcept { return arena != other.arena; }
+};
@@ -0,0 +1,434 @@
+﻿#include "MorphAnimation.h"
+#include "MemoryArena.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define MORPH_USE_SSE 1
+#endif
+
+namespace
+{
+    // out = from + delta * t, count кратно 4
+    inline void BlendPose(const float* from, const float* delta, float t, float* out, size_t count)
+    {
+#ifdef MORPH_USE_SSE
+        const __m128 vt = _mm_set1_ps(t);
+        for (size_t i = 0; i < count; i += 4) {
+            __m128 f = _mm_loadu_ps(from + i);
+            __m128 d = _mm_loadu_ps(delta + i);
+            _mm_storeu_ps(out + i, _mm_add_ps(f, _mm_mul_ps(d, vt)));
+        }
+#else
+        for (size_t i = 0; i < count; ++i)
+            out[i] = from[i] + delta[i] * t;
+#endif
+    }
+
+    template<class T>
+    T* CopyArray(const T* src, size_t count)
+    {
+        if (!src || count == 0) return nullptr;
+        T* dst = (T*)RL_MALLOC(count * sizeof(T));
+        std::memcpy(dst, src, count * sizeof(T));
+        return dst;
+    }
+
+    void UnloadKeepTextures(Model& m)
+    {
+        // Текстуры принадлежат кешу VRAM, выгружаем только меши
+        if (m.materials) {
+            for (int i = 0; i < m.materialCount; i++)
+                m.materials[i].maps[MATERIAL_MAP_DIFFUSE].texture.id = 1;
+        }
+        if (m.meshCount > 0 && m.meshes != nullptr)
+            UnloadModel(m);
+        m = Model{ 0 };
+    }
+}
+
+// ------------------------------------------------------------------
+// MorphModel
+// ------------------------------------------------------------------
+
+MorphModel::MorphModel(std::shared_ptr<MOModel> source, MemoryArena* scratch)
+    : mo(std::move(source))
+{
+    if (!mo || !mo->isValid()) return;
+
+    templ = mo->getTMD().buildModel(scratch, &groups);
+    if (templ.meshCount == 0) return;
+
+    // 1. Какие вершины вообще двигаются (задеты хоть одной целью)
+    std::vector<int32_t> compactIndex(mo->getTMD().getVertexCount(), -1);
+    for (const auto& target : mo->getTargets()) {
+        for (uint32_t v : target.index) {
+            if (compactIndex[v] < 0) compactIndex[v] = (int32_t)compactCount++;
+        }
+    }
+    paddedCount = (compactCount + 3) & ~size_t(3);
+
+    reorderMeshes(compactIndex);
+    buildPoses(compactIndex);
+}
+
+MorphModel::~MorphModel()
+{
+    // Шаблон в GPU не загружался - UnloadModel освободит только память CPU
+    UnloadKeepTextures(templ);
+}
+
+void MorphModel::reorderMeshes(const std::vector<int32_t>& compactIndex)
+{
+    animatedVertices.assign(templ.meshCount, 0);
+    meshCompact.resize(templ.meshCount);
+
+    for (int m = 0; m < templ.meshCount; ++m)
+    {
+        Mesh& mesh = templ.meshes[m];
+        auto& source = groups[m].sourceVertex;
+        const int count = mesh.vertexCount;
+
+        // Новый порядок: анимируемые вперёд, остальные за ними (порядок внутри сохраняется)
+        std::vector<int> newOrder;
+        newOrder.reserve(count);
+        for (int i = 0; i < count; ++i)
+            if (compactIndex[source[i]] >= 0) newOrder.push_back(i);
+        animatedVertices[m] = (int)newOrder.size();
+        for (int i = 0; i < count; ++i)
+            if (compactIndex[source[i]] < 0) newOrder.push_back(i);
+
+        std::vector<int> remap(count);
+        for (int i = 0; i < count; ++i) remap[newOrder[i]] = i;
+
+        std::vector<float> vertices(mesh.vertices, mesh.vertices + count * 3);
+        std::vector<float> normals(mesh.normals, mesh.normals + count * 3);
+        std::vector<float> texcoords(mesh.texcoords, mesh.texcoords + count * 2);
+        std::vector<unsigned char> colors(mesh.colors, mesh.colors + count * 4);
+        std::vector<uint32_t> oldSource = source;
+        std::vector<uint8_t> oldUV = groups[m].pageUV;
+
+        for (int i = 0; i < count; ++i) {
+            int o = newOrder[i];
+            std::memcpy(mesh.vertices + i * 3, &vertices[o * 3], 3 * sizeof(float));
+            std::memcpy(mesh.normals + i * 3, &normals[o * 3], 3 * sizeof(float));
+            std::memcpy(mesh.texcoords + i * 2, &texcoords[o * 2], 2 * sizeof(float));
+            std::memcpy(mesh.colors + i * 4, &colors[o * 4], 4);
+            source[i] = oldSource[o];
+            groups[m].pageUV[i * 2 + 0] = oldUV[o * 2 + 0];
+            groups[m].pageUV[i * 2 + 1] = oldUV[o * 2 + 1];
+        }
+        for (int i = 0; i < mesh.triangleCount * 3; ++i)
+            mesh.indices[i] = (unsigned short)remap[mesh.indices[i]];
+
+        meshCompact[m].resize(animatedVertices[m]);
+        for (int i = 0; i < animatedVertices[m]; ++i)
+            meshCompact[m][i] = (uint32_t)compactIndex[source[i]];
+    }
+}
+
+void MorphModel::buildPoses(const std::vector<int32_t>& compactIndex)
+{
+    const auto& targets = mo->getTargets();
+
+    // Исходные позиции анимируемых вершин (PS1 -> мировые координаты, как в buildModel)
+    std::vector<float> base[3];
+    for (auto& b : base) b.assign(paddedCount, 0.0f);
+
+    uint32_t global = 0;
+    for (const auto& obj : mo->getTMD().getObjects()) {
+        for (const auto& v : obj.vertices) {
+            int32_t c = compactIndex[global++];
+            if (c < 0) continue;
+            base[0][c] = v.x * TMD_WORLD_SCALE;
+            base[1][c] = -v.y * TMD_WORLD_SCALE;
+            base[2][c] = -v.z * TMD_WORLD_SCALE;
+        }
+    }
+
+    auto overwrite = [&](std::vector<float>* dst, const MOModel::MorphTarget& t) {
+        for (size_t i = 0; i < t.index.size(); ++i) {
+            int32_t c = compactIndex[t.index[i]];
+            dst[0][c] = t.pos[i].x * TMD_WORLD_SCALE;
+            dst[1][c] = -t.pos[i].y * TMD_WORLD_SCALE;
+            dst[2][c] = -t.pos[i].z * TMD_WORLD_SCALE;
+        }
+    };
+
+    const auto& anims = mo->getAnimations();
+    poses.resize(anims.size());
+
+    for (size_t a = 0; a < anims.size(); ++a)
+    {
+        poses[a].resize(anims[a].keys.size());
+        for (size_t k = 0; k < anims[a].keys.size(); ++k)
+        {
+            const auto& key = anims[a].keys[k];
+            KeyPose& pose = poses[a][k];
+
+            // sub_80036690 / sub_80036754: исходные вершины + bases по очереди
+            for (int c = 0; c < 3; ++c) pose.from[c] = base[c];
+            for (uint16_t b : key.bases) overwrite(pose.from, targets[b]);
+
+            // sub_800367D0: вершины target тянутся к нему, остальные стоят
+            std::vector<float> to[3] = { pose.from[0], pose.from[1], pose.from[2] };
+            overwrite(to, targets[key.target]);
+            for (int c = 0; c < 3; ++c) {
+                pose.delta[c].resize(paddedCount);
+                for (size_t i = 0; i < paddedCount; ++i)
+                    pose.delta[c][i] = to[c][i] - pose.from[c][i];
+            }
+        }
+    }
+}
+
+// ------------------------------------------------------------------
+// MorphAnimator
+// ------------------------------------------------------------------
+
+MorphAnimator::Handle MorphAnimator::Create(const std::shared_ptr<MorphModel>& model)
+{
+    if (!model || !model->isValid()) return INVALID_HANDLE;
+
+    Handle handle;
+    if (!freeSlots.empty()) {
+        handle = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else {
+        handle = (Handle)instances.size();
+        instances.emplace_back();
+    }
+
+    Instance& inst = instances[handle];
+    inst = Instance{};
+    inst.model = model;
+    inst.alive = true;
+
+    // Свои буферы вершин на каждый экземпляр, остальное - копия шаблона
+    const Model& src = model->templ;
+    Model& dst = inst.gpu;
+    dst.transform = src.transform;
+    dst.meshCount = src.meshCount;
+    dst.materialCount = src.materialCount;
+    dst.meshes = (Mesh*)RL_CALLOC(dst.meshCount, sizeof(Mesh));
+    dst.materials = (Material*)RL_CALLOC(dst.materialCount, sizeof(Material));
+    dst.meshMaterial = CopyArray(src.meshMaterial, dst.meshCount);
+
+    for (int m = 0; m < dst.meshCount; ++m)
+    {
+        const Mesh& s = src.meshes[m];
+        Mesh& d = dst.meshes[m];
+        d.vertexCount = s.vertexCount;
+        d.triangleCount = s.triangleCount;
+        d.vertices = CopyArray(s.vertices, s.vertexCount * 3);
+        d.normals = CopyArray(s.normals, s.vertexCount * 3);
+        d.texcoords = CopyArray(s.texcoords, s.vertexCount * 2);
+        d.colors = CopyArray(s.colors, s.vertexCount * 4);
+        d.indices = CopyArray(s.indices, s.triangleCount * 3);
+        UploadMesh(&d, true);
+    }
+    for (int i = 0; i < dst.materialCount; ++i) {
+        dst.materials[i] = LoadMaterialDefault();
+        dst.materials[i].maps[MATERIAL_MAP_DIFFUSE].texture = src.materials[i].maps[MATERIAL_MAP_DIFFUSE].texture;
+    }
+
+    order.push_back(handle);
+    return handle;
+}
+
+void MorphAnimator::Destroy(Handle handle)
+{
+    Instance* inst = Get(handle);
+    if (!inst) return;
+
+    UnloadKeepTextures(inst->gpu);
+    *inst = Instance{};
+    freeSlots.push_back(handle);
+    order.erase(std::remove(order.begin(), order.end(), handle), order.end());
+}
+
+void MorphAnimator::Clear()
+{
+    for (auto& inst : instances) {
+        if (inst.alive) UnloadKeepTextures(inst.gpu);
+    }
+    instances.clear();
+    freeSlots.clear();
+    order.clear();
+}
+
+MorphAnimator::Instance* MorphAnimator::Get(Handle handle)
+{
+    if (handle < 0 || handle >= (Handle)instances.size() || !instances[handle].alive) return nullptr;
+    return &instances[handle];
+}
+
+const MorphAnimator::Instance* MorphAnimator::Get(Handle handle) const
+{
+    if (handle < 0 || handle >= (Handle)instances.size() || !instances[handle].alive) return nullptr;
+    return &instances[handle];
+}
+
+void MorphAnimator::Play(Handle handle, size_t anim, bool loop, float speed)
+{
+    Instance* inst = Get(handle);
+    if (!inst || anim >= inst->model->getMO().getAnimationCount()) return;
+    // Все ключи анимации оказались битыми - проигрывать нечего
+    if (inst->model->getMO().getAnimations()[anim].keys.empty()) return;
+
+    inst->anim = anim;
+    inst->loop = loop;
+    inst->speed = speed;
+    inst->time = 0.0f;
+    inst->playing = true;
+    Advance(*inst, 0.0f);
+}
+
+void MorphAnimator::Stop(Handle handle)
+{
+    if (Instance* inst = Get(handle)) inst->playing = false;
+}
+
+void MorphAnimator::SetVisible(Handle handle, bool visible)
+{
+    if (Instance* inst = Get(handle)) inst->visible = visible;
+}
+
+bool MorphAnimator::IsFinished(Handle handle) const
+{
+    const Instance* inst = Get(handle);
+    return !inst || !inst->playing;
+}
+
+const Model* MorphAnimator::GetModel(Handle handle) const
+{
+    const Instance* inst = Get(handle);
+    return inst ? &inst->gpu : nullptr;
+}
+
+void MorphAnimator::Advance(Instance& inst, float ticks)
+{
+    const MOModel& mo = inst.model->getMO();
+    const uint32_t length = mo.getAnimations()[inst.anim].length;
+
+    inst.time += ticks * inst.speed;
+    if (length == 0) {
+        inst.time = 0.0f;
+    }
+    else if (inst.time >= (float)length) {
+        if (inst.loop) {
+            inst.time = std::fmod(inst.time, (float)length);
+        }
+        else {
+            inst.time = (float)length;
+            inst.playing = false;
+        }
+    }
+
+    mo.evaluate(inst.anim, (uint32_t)inst.time, inst.key, inst.weight);
+}
+
+void MorphAnimator::Update(float deltaTime)
+{
+    statBlends = 0;
+    statUploadBytes = 0;
+
+    const float ticks = deltaTime * MO_TICKS_PER_SECOND;
+
+    // 1. Время
+    for (Handle h : order) {
+        Instance& inst = instances[h];
+        if (inst.playing) Advance(inst, ticks);
+    }
+
+    // 2. Одинаковые позы рядом: толпа одинаковых врагов считается один раз
+    std::sort(order.begin(), order.end(), [&](Handle a, Handle b) {
+        const Instance& x = instances[a];
+        const Instance& y = instances[b];
+        if (x.model != y.model) return x.model < y.model;
+        if (x.anim != y.anim) return x.anim < y.anim;
+        if (x.key != y.key) return x.key < y.key;
+        return x.weight < y.weight;
+    });
+
+    // 3. Смешивание и загрузка
+    const MorphModel* poseModel = nullptr;
+    size_t poseAnim = SIZE_MAX, poseKey = SIZE_MAX;
+    int32_t poseWeight = -1;
+
+    for (Handle h : order)
+    {
+        Instance& inst = instances[h];
+        if (!inst.visible) continue;
+        SyncMaterials(inst);
+        if (inst.model->poses.empty()) continue;
+        if (inst.uploadedAnim == inst.anim && inst.uploadedKey == inst.key && inst.uploadedWeight == inst.weight) continue;
+
+        const MorphModel& model = *inst.model;
+        if (&model != poseModel || inst.anim != poseAnim || inst.key != poseKey || inst.weight != poseWeight)
+        {
+            const auto& key = model.poses[inst.anim][inst.key];
+            const float t = inst.weight / 4096.0f;
+            for (int c = 0; c < 3; ++c) {
+                pose[c].resize(model.paddedCount);
+                BlendPose(key.from[c].data(), key.delta[c].data(), t, pose[c].data(), model.paddedCount);
+            }
+            poseModel = &model;
+            poseAnim = inst.anim;
+            poseKey = inst.key;
+            poseWeight = inst.weight;
+            ++statBlends;
+        }
+
+        Upload(inst);
+        inst.uploadedAnim = inst.anim;
+        inst.uploadedKey = inst.key;
+        inst.uploadedWeight = inst.weight;
+    }
+}
+
+void MorphAnimator::SyncMaterials(Instance& inst)
+{
+    // Текстура шаблона могла догрузиться после создания экземпляра (была заглушка)
+    const Model& src = inst.model->templ;
+    for (int i = 0; i < inst.gpu.materialCount; ++i) {
+        Texture2D& dst = inst.gpu.materials[i].maps[MATERIAL_MAP_DIFFUSE].texture;
+        const Texture2D& tex = src.materials[i].maps[MATERIAL_MAP_DIFFUSE].texture;
+        if (dst.id != tex.id) dst = tex;
+    }
+}
+
+void MorphAnimator::Upload(Instance& inst)
+{
+    const MorphModel& model = *inst.model;
+
+    for (int m = 0; m < inst.gpu.meshCount; ++m)
+    {
+        Mesh& mesh = inst.gpu.meshes[m];
+        const auto& compact = model.meshCompact[m];
+        const int count = model.animatedVertices[m];
+
+        // Анимируемые вершины уже в начале буфера; грузим от первой изменившейся до последней
+        int first = count, last = -1;
+        float* v = mesh.vertices;
+        for (int i = 0; i < count; ++i, v += 3)
+        {
+            uint32_t c = compact[i];
+            float x = pose[0][c], y = pose[1][c], z = pose[2][c];
+            if (v[0] != x || v[1] != y || v[2] != z) {
+                v[0] = x; v[1] = y; v[2] = z;
+                if (first > i) first = i;
+                last = i;
+            }
+        }
+
+        if (last < first) continue;
+        int bytes = (last - first + 1) * 3 * sizeof(float);
+        // Буфер 0 - позиции
+        UpdateMeshBuffer(mesh, 0, mesh.vertices + first * 3, bytes, first * 3 * sizeof(float));
+        statUploadBytes += bytes;
+    }
+}
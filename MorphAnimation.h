@@ -0,0 +1,130 @@
+﻿#pragma once
+#include "MOModel.h"
+#include "raylib.h"
+#include <memory>
+#include <vector>
+
+class MemoryArena;
+
+// Длительности ключей MO в тиках игрового кадра
+constexpr float MO_TICKS_PER_SECOND = 30.0f;
+
+/*
+   Общие данные анимированной модели (один на MO, делится всеми экземплярами).
+   При загрузке:
+   - вершины каждого меша переставлены так, что анимируемые (задетые хоть одной морф-целью)
+     идут первыми - обновляемый диапазон буфера всегда непрерывный;
+   - для каждого ключа каждой анимации заранее собраны поза "from" и разница "delta" до target
+     (SoA float, уже в мировых координатах), так что кадр = from + delta * t.
+*/
+class MorphModel
+{
+public:
+    explicit MorphModel(std::shared_ptr<MOModel> mo, MemoryArena* scratch = nullptr);
+    ~MorphModel();
+
+    MorphModel(const MorphModel&) = delete;
+    MorphModel& operator=(const MorphModel&) = delete;
+
+    bool isValid() const { return templ.meshCount > 0; }
+    const MOModel& getMO() const { return *mo; }
+    const std::vector<TMDModel::MeshGroup>& getGroups() const { return groups; }
+    // Шаблон (только CPU): экземпляры копируют его меши к себе. Текстуры назначаются сюда.
+    Model& getTemplate() { return templ; }
+    size_t getAnimatedVertexCount() const { return compactCount; }
+
+private:
+    friend class MorphAnimator;
+
+    struct KeyPose {
+        std::vector<float> from[3];
+        std::vector<float> delta[3];
+    };
+
+    void reorderMeshes(const std::vector<int32_t>& compactIndex);
+    void buildPoses(const std::vector<int32_t>& compactIndex);
+
+    std::shared_ptr<MOModel> mo;
+    Model templ = { 0 };
+    std::vector<TMDModel::MeshGroup> groups;
+
+    size_t compactCount = 0;   // анимируемых вершин TMD
+    size_t paddedCount = 0;    // выровнено на 4 для SIMD
+    std::vector<int> animatedVertices;                // на меш: столько первых вершин анимируются
+    std::vector<std::vector<uint32_t>> meshCompact;   // на меш: вершина -> индекс в позе
+    std::vector<std::vector<KeyPose>> poses;          // [анимация][ключ]
+};
+
+
+/*
+   Пакетный проигрыватель морф-анимации для всех сущностей уровня.
+   Update() за один проход: двигает время, сортирует экземпляры по (модель, анимация, ключ, вес),
+   смешивает позу SIMD-ом (одинаковая поза считается один раз на пачку),
+   раскладывает её по мешам и грузит в GPU только изменившийся диапазон вершин.
+*/
+class MorphAnimator
+{
+public:
+    using Handle = int;
+    static constexpr Handle INVALID_HANDLE = -1;
+
+    MorphAnimator() = default;
+    ~MorphAnimator() { Clear(); }
+
+    MorphAnimator(const MorphAnimator&) = delete;
+    MorphAnimator& operator=(const MorphAnimator&) = delete;
+
+    Handle Create(const std::shared_ptr<MorphModel>& model);
+    void Destroy(Handle handle);
+    void Clear();
+
+    void Play(Handle handle, size_t anim, bool loop = true, float speed = 1.0f);
+    void Stop(Handle handle);
+    // Невидимые экземпляры время двигают, но вершины не пересчитывают
+    void SetVisible(Handle handle, bool visible);
+    bool IsFinished(Handle handle) const;
+
+    // Для DrawModel; nullptr если handle неверный
+    const Model* GetModel(Handle handle) const;
+
+    void Update(float deltaTime);
+
+    // Статистика последнего Update()
+    size_t GetBlendCount() const { return statBlends; }
+    size_t GetUploadBytes() const { return statUploadBytes; }
+
+private:
+    struct Instance {
+        std::shared_ptr<MorphModel> model;
+        Model gpu = { 0 };
+        bool alive = false;
+        bool visible = true;
+        bool playing = false;
+        bool loop = true;
+        size_t anim = 0;
+        float time = 0.0f;     // в тиках
+        float speed = 1.0f;
+        size_t key = 0;
+        int32_t weight = 0;
+        // Что сейчас лежит в GPU
+        size_t uploadedKey = SIZE_MAX;
+        int32_t uploadedWeight = -1;
+        size_t uploadedAnim = SIZE_MAX;
+    };
+
+    Instance* Get(Handle handle);
+    const Instance* Get(Handle handle) const;
+    void Advance(Instance& inst, float ticks);
+    void Upload(Instance& inst);
+    void SyncMaterials(Instance& inst);
+
+    std::vector<Instance> instances;
+    std::vector<Handle> freeSlots;
+    std::vector<Handle> order;
+
+    // Поза текущей пачки (SoA)
+    std::vector<float> pose[3];
+
+    size_t statBlends = 0;
+    size_t statUploadBytes = 0;
+};
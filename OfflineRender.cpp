@@ -0,0 +1,128 @@
+﻿#include "OfflineRender.h"
+#include "soundbank.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace OfflineRender
+{
+    // Кадров за вызов микшера. Меньше, чем у устройства: остановка по числу
+    // проходов срабатывает на границе блока, и лишние ноты нового прохода короче
+    constexpr unsigned int RENDER_BLOCK = 256;
+    // Потолок для трека, который не кончается и не зацикливается (битый SEQ)
+    constexpr float RENDER_MAX_SECONDS = 30.0f * 60.0f;
+
+    static void PrintUsage()
+    {
+        printf("Usage: --render <VAB.T> <seq> <vh> <vb> <out.wav> [--seconds N | --loops N] [--tail N]\n");
+    }
+
+    bool Run(const Options& options)
+    {
+        AudioSystem audio;
+        audio.InitOffline();
+
+        if (!audio.PlaySEQ(options.archive, options.seq, options.vh, options.vb)) {
+            std::cerr << "Render: cannot play SEQ " << options.seq << " with VH " << options.vh
+                      << " / VB " << options.vb << " from " << options.archive << std::endl;
+            return false;
+        }
+
+        const unsigned int rate = SPU_SAMPLE_RATE;
+        const uint64_t maxFrames = (uint64_t)((options.seconds > 0.0f ? options.seconds : RENDER_MAX_SECONDS) * rate);
+        const uint64_t tailFrames = (uint64_t)(options.tail * rate);
+
+        std::vector<short> pcm;
+        pcm.reserve((size_t)(options.seconds > 0.0f ? maxFrames : 180ull * rate) * 2);
+
+        auto RenderBlock = [&](unsigned int frames) {
+            const size_t at = pcm.size();
+            pcm.resize(at + (size_t)frames * 2);
+            audio.Render(pcm.data() + at, frames);
+        };
+
+        const auto start = std::chrono::steady_clock::now();
+
+        // 1. Трек: до нужного числа проходов, до конца SEQ или до лимита времени.
+        // Первый блок применяет SeqPlay, до него IsPlaying ещё false
+        uint64_t frames = 0;
+        do {
+            const unsigned int block = (unsigned int)std::min<uint64_t>(RENDER_BLOCK, maxFrames - frames);
+            RenderBlock(block);
+            frames += block;
+            if (options.seconds <= 0.0f && audio.seqPlayer.GetLoopCount() >= (uint32_t)options.loops)
+                break;
+        } while (frames < maxFrames && audio.seqPlayer.IsPlaying());
+
+        if (options.seconds <= 0.0f && frames >= maxFrames)
+            TraceLog(LOG_WARNING, "Render: SEQ did not finish in %.0f seconds, cut", RENDER_MAX_SECONDS);
+
+        // 2. Хвост: секвенсор стоп, голоса в release, пишем пока не затихнут
+        audio.seqPlayer.StopAll();
+        audio.ReleaseAllVoices();
+        uint64_t tail = 0;
+        while (tail < tailFrames) {
+            const unsigned int block = (unsigned int)std::min<uint64_t>(RENDER_BLOCK, tailFrames - tail);
+            RenderBlock(block);
+            tail += block;
+            if (audio.GetActiveVoiceCount() == 0)
+                break;
+        }
+
+        const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const unsigned int total = (unsigned int)(pcm.size() / 2);
+        const double length = (double)total / rate;
+
+        Wave wave = {};
+        wave.frameCount = total;
+        wave.sampleRate = rate;
+        wave.sampleSize = 16;
+        wave.channels = 2;
+        wave.data = pcm.data();
+        if (!ExportWave(wave, options.output.c_str())) {
+            std::cerr << "Render: cannot write " << options.output << std::endl;
+            return false;
+        }
+
+        printf("Render: %s - %.2f s audio (%u loops) in %.3f s, %.1fx realtime\n", options.output.c_str(),
+            length, audio.seqPlayer.GetLoopCount(), wall, wall > 0.0 ? length / wall : 0.0);
+        return true;
+    }
+
+    int Main(int argc, char** argv)
+    {
+        if (argc < 5) {
+            PrintUsage();
+            return 1;
+        }
+
+        Options options;
+        options.archive = argv[0];
+        options.seq = atoi(argv[1]);
+        options.vh = atoi(argv[2]);
+        options.vb = atoi(argv[3]);
+        options.output = argv[4];
+
+        for (int i = 5; i < argc; ++i) {
+            if (i + 1 < argc && strcmp(argv[i], "--seconds") == 0)
+                options.seconds = (float)atof(argv[++i]);
+            else if (i + 1 < argc && strcmp(argv[i], "--loops") == 0)
+                options.loops = atoi(argv[++i]);
+            else if (i + 1 < argc && strcmp(argv[i], "--tail") == 0)
+                options.tail = (float)atof(argv[++i]);
+            else {
+                PrintUsage();
+                return 1;
+            }
+        }
+        if (options.loops < 1) options.loops = 1;
+        if (options.tail < 0.0f) options.tail = 0.0f;
+
+        SetTraceLogLevel(LOG_WARNING);
+        return Run(options) ? 0 : 1;
+    }
+}
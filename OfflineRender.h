@@ -0,0 +1,29 @@
+﻿#pragma once
+#include <string>
+
+/*
+   Рендер музыки без окна и звукового устройства: SEQ + VAB из архива -> WAV.
+   SeqPlayer и PsxSpu работают как в игре, только колбэк звука зовётся в цикле
+   с главного потока, поэтому трек считается быстрее реального времени.
+   Запуск: KF2_Port --render <VAB.T> <seq> <vh> <vb> <out.wav> [--seconds N | --loops N] [--tail N]
+*/
+namespace OfflineRender
+{
+    struct Options
+    {
+        std::string archive;
+        int seq = -1;
+        int vh = -1;
+        int vb = -1;
+        std::string output;
+        float seconds = 0.0f;   // 0 - до конца трека (или loops проходов)
+        int loops = 1;          // сколько раз трек должен дойти до конца
+        float tail = 4.0f;      // сколько секунд ждать, пока доиграют release и реверб
+    };
+
+    // Рендер с частотой SPU в 16-бит стерео; false - не удалось загрузить банк/SEQ или записать файл
+    bool Run(const Options& options);
+
+    // argv после "--render"; код возврата для main
+    int Main(int argc, char** argv);
+}
@@ -0,0 +1,186 @@
+﻿#include "PositionalAudio.h"
+#include "raymath.h"
+#include <algorithm>
+#include <cmath>
+
+// Крайняя панорама не в одно ухо: источник сбоку всё равно слышен обоими
+constexpr float AUDIO_PAN_WIDTH = 0.8f;
+// Доплер не дальше октавы в обе стороны
+constexpr float AUDIO_DOPPLER_MIN = 0.5f;
+constexpr float AUDIO_DOPPLER_MAX = 2.0f;
+// Мельче этого изменения не отправляются в SPU
+constexpr float AUDIO_GAIN_EPSILON = 1.0f / 256.0f;
+constexpr float AUDIO_PAN_EPSILON = 1.0f / 256.0f;
+constexpr float AUDIO_PITCH_EPSILON = 1.0f / 1024.0f;
+
+void PositionalAudio::SetListener(const Vector3& position, const Vector3& forward, const Vector3& up)
+{
+    if (!listenerPlaced) {
+        listenerPrevious = position;
+        listenerPlaced = true;
+    }
+    listenerPos = position;
+
+    const Vector3 right = Vector3CrossProduct(forward, up);
+    const float len = Vector3Length(right);
+    // Взгляд строго вверх/вниз - прежняя правая сторона
+    if (len > 1e-6f) listenerRight = Vector3Scale(right, 1.0f / len);
+}
+
+PositionalAudio::EmitterId PositionalAudio::CreateEmitter(const Vector3& position, float minDistance,
+    float maxDistance, float volume, bool doppler)
+{
+    for (int i = 0; i < AUDIO_EMITTER_COUNT; ++i) {
+        Emitter& e = emitters[i];
+        if (e.used) continue;
+        e = Emitter();
+        e.used = true;
+        e.doppler = doppler;
+        e.position = position;
+        e.previous = position;
+        e.minDistance = std::max(minDistance, 0.0f);
+        e.maxDistance = std::max(maxDistance, e.minDistance + 0.001f);
+        e.volume = volume;
+        ++emitterCount;
+        return i;
+    }
+    TraceLog(LOG_WARNING, "PositionalAudio: all %d emitters are in use", AUDIO_EMITTER_COUNT);
+    return -1;
+}
+
+void PositionalAudio::DestroyEmitter(EmitterId id, bool stopVoices)
+{
+    if (id < 0 || id >= AUDIO_EMITTER_COUNT || !emitters[id].used) return;
+    Emitter& e = emitters[id];
+    if (stopVoices && audio)
+        for (int v = 0; v < e.voiceCount; ++v) audio->StopVoice(e.voices[v].handle);
+    e.used = false;
+    e.voiceCount = 0;
+    --emitterCount;
+}
+
+void PositionalAudio::SetEmitterPosition(EmitterId id, const Vector3& position)
+{
+    if (id < 0 || id >= AUDIO_EMITTER_COUNT || !emitters[id].used) return;
+    emitters[id].position = position;
+}
+
+void PositionalAudio::SetEmitterVolume(EmitterId id, float volume)
+{
+    if (id < 0 || id >= AUDIO_EMITTER_COUNT || !emitters[id].used) return;
+    emitters[id].volume = volume;
+}
+
+uint32_t PositionalAudio::Play(EmitterId id, int program, int note, int bankId)
+{
+    if (!audio || id < 0 || id >= AUDIO_EMITTER_COUNT || !emitters[id].used) return 0;
+    Emitter& e = emitters[id];
+
+    Mix mix = Compute(e, Vector3{ 0.0f, 0.0f, 0.0f });
+    if (e.voiceCount > 0) mix.pitch = e.sent.pitch;
+    // Смесь едет в самом NoteOn: голос не звучит ни одного блока по центру и без затухания
+    const uint32_t handle = audio->PlaySoundEffect3D(program, note, mix.gain, mix.pan, mix.pitch, bankId);
+    if (handle == 0) return 0;
+    e.sent = mix;
+
+    // Полный список - старший звук доигрывает без слежения
+    if (e.voiceCount == AUDIO_EMITTER_VOICES) {
+        std::move(e.voices + 1, e.voices + AUDIO_EMITTER_VOICES, e.voices);
+        --e.voiceCount;
+    }
+    e.voices[e.voiceCount++] = Voice{ handle, audio->GetPostedCount() };
+    return handle;
+}
+
+uint32_t PositionalAudio::PlayAt(const Vector3& position, int program, int note, float volume, int bankId)
+{
+    if (!audio) return 0;
+    Emitter e;
+    e.position = position;
+    e.volume = volume;
+    const Mix mix = Compute(e, Vector3{ 0.0f, 0.0f, 0.0f });
+    if (mix.gain <= 0.0f) return 0;   // за пределом слышимости голос не занимаем
+    return audio->PlaySoundEffect(program, note, mix.gain, mix.pan, bankId);
+}
+
+PositionalAudio::Mix PositionalAudio::Compute(const Emitter& e, const Vector3& velocity) const
+{
+    Mix mix;
+    const Vector3 d = Vector3Subtract(e.position, listenerPos);
+    const float dist = Vector3Length(d);
+
+    // Линейное затухание между min и max (как CalculateDistance + таблица громкости оригинала)
+    float gain = 1.0f;
+    if (dist >= e.maxDistance) gain = 0.0f;
+    else if (dist > e.minDistance) gain = (e.maxDistance - dist) / (e.maxDistance - e.minDistance);
+    mix.gain = gain * e.volume;
+
+    if (dist > 1e-4f) {
+        const float inv = 1.0f / dist;
+        const float side = Vector3DotProduct(d, listenerRight) * inv;
+        mix.pan = 0.5f + 0.5f * AUDIO_PAN_WIDTH * side;
+
+        if (e.doppler) {
+            // Скорости вдоль линии слушатель -> источник: сближение повышает тон
+            const float towardListener = Vector3DotProduct(listenerVelocity, d) * inv;
+            const float awayEmitter = Vector3DotProduct(velocity, d) * inv;
+            const float c = AUDIO_SPEED_OF_SOUND;
+            const float denom = std::max(c + awayEmitter, c * 0.1f);
+            mix.pitch = std::clamp((c + towardListener) / denom, AUDIO_DOPPLER_MIN, AUDIO_DOPPLER_MAX);
+        }
+    }
+    return mix;
+}
+
+bool PositionalAudio::Differs(const Mix& a, const Mix& b)
+{
+    return std::fabs(a.gain - b.gain) > AUDIO_GAIN_EPSILON ||
+        std::fabs(a.pan - b.pan) > AUDIO_PAN_EPSILON ||
+        std::fabs(a.pitch - b.pitch) > AUDIO_PITCH_EPSILON;
+}
+
+void PositionalAudio::DropFinishedVoices(Emitter& e, const SpuSnapshot& snap)
+{
+    int kept = 0;
+    for (int v = 0; v < e.voiceCount; ++v) {
+        const Voice& voice = e.voices[v];
+        // NoteOn ещё не применён - голоса в снимке нет, но он будет
+        const bool pending = snap.appliedCommands < voice.postedAt;
+        if (pending || std::binary_search(playing.begin(), playing.end(), voice.handle))
+            e.voices[kept++] = voice;
+    }
+    e.voiceCount = kept;
+}
+
+void PositionalAudio::Update(float dt)
+{
+    lastCommands = 0;
+    if (!audio) return;
+
+    const float invDt = (dt > 0.0f) ? 1.0f / dt : 0.0f;
+    listenerVelocity = Vector3Scale(Vector3Subtract(listenerPos, listenerPrevious), invDt);
+    listenerPrevious = listenerPos;
+
+    // Звучащие handle - один раз на кадр, дальше двоичный поиск
+    const SpuSnapshot& snap = audio->GetSpuSnapshot();
+    playing.clear();
+    for (const auto& v : snap.voices)
+        if (v.phase != ADSR_IDLE && v.handle != 0) playing.push_back(v.handle);
+    std::sort(playing.begin(), playing.end());
+
+    for (Emitter& e : emitters) {
+        if (!e.used) continue;
+        const Vector3 velocity = Vector3Scale(Vector3Subtract(e.position, e.previous), invDt);
+        e.previous = e.position;
+
+        DropFinishedVoices(e, snap);
+        if (e.voiceCount == 0) continue;
+
+        const Mix mix = Compute(e, velocity);
+        if (!Differs(mix, e.sent)) continue;
+        for (int v = 0; v < e.voiceCount; ++v)
+            audio->SetVoice3D(e.voices[v].handle, mix.gain, mix.pan, mix.pitch);
+        lastCommands += e.voiceCount;
+        e.sent = mix;
+    }
+}
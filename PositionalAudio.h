@@ -0,0 +1,101 @@
+﻿#pragma once
+#include "raylib.h"
+#include "soundbank.h"
+#include <cstdint>
+#include <vector>
+
+// Сколько звучащих источников одновременно (монстры, двери, снаряды...)
+constexpr int AUDIO_EMITTER_COUNT = 64;
+// Звуков (handle) на один источник: рычание поверх шагов
+constexpr int AUDIO_EMITTER_VOICES = 4;
+// Расстояния по умолчанию (мировые единицы, клетка = 2.0): до min - полная громкость, за max - тишина
+constexpr float AUDIO_MIN_DISTANCE = 2.0f;
+constexpr float AUDIO_MAX_DISTANCE = 24.0f;
+// Скорость звука для доплера, мировых единиц в секунду
+constexpr float AUDIO_SPEED_OF_SOUND = 343.0f;
+
+/*
+   Позиционный звук (как PlayPositionalSound3D / CalculateDistance в оригинале):
+   источники привязаны к сущностям, слушатель - к камере игрока. Update() раз в кадр
+   одним проходом считает затухание, панораму и доплер всех источников и отправляет
+   в SPU только изменившиеся (SetVoice3D идёт через очередь команд).
+   Игровой поток: скалярные произведения и один sqrt на источник, синус/косинус панорамы
+   считает аудиопоток при применении команды.
+*/
+class PositionalAudio
+{
+public:
+    using EmitterId = int;   // -1 - нет
+
+    void Attach(AudioSystem* system) { audio = system; }
+
+    // forward - куда смотрит игрок; up - вверх мира
+    void SetListener(const Vector3& position, const Vector3& forward, const Vector3& up = { 0.0f, 1.0f, 0.0f });
+
+    // doppler - высота тона зависит от скорости (скорость считается по смене позиции)
+    EmitterId CreateEmitter(const Vector3& position, float minDistance = AUDIO_MIN_DISTANCE,
+        float maxDistance = AUDIO_MAX_DISTANCE, float volume = 1.0f, bool doppler = false);
+    // stopVoices - звуки в release; иначе доигрывают с последней панорамой
+    void DestroyEmitter(EmitterId id, bool stopVoices = true);
+    void SetEmitterPosition(EmitterId id, const Vector3& position);
+    void SetEmitterVolume(EmitterId id, float volume);
+
+    // Звук из банка SPU в точке источника; handle (0 - источника нет или банк пуст)
+    uint32_t Play(EmitterId id, int program, int note = 60, int bankId = SFX_BANK);
+    // Одноразовый звук в точке без источника: громкость и панорама на момент запуска
+    uint32_t PlayAt(const Vector3& position, int program, int note = 60, float volume = 1.0f, int bankId = SFX_BANK);
+
+    // Раз в кадр после движения сущностей; dt - секунды кадра (для доплера)
+    void Update(float dt);
+
+    int GetEmitterCount() const { return emitterCount; }
+    // Команд SetVoice3D за последний Update
+    int GetLastUpdateCommands() const { return lastCommands; }
+
+private:
+    struct Voice
+    {
+        uint32_t handle = 0;
+        uint64_t postedAt = 0;   // PsxSpu::GetPostedCount() после NoteOn: раньше снимок о нём не знает
+    };
+
+    // Результат прохода: громкость 0..1, панорама 0..1, множитель высоты
+    struct Mix
+    {
+        float gain = 0.0f;
+        float pan = 0.5f;
+        float pitch = 1.0f;
+    };
+
+    struct Emitter
+    {
+        bool used = false;
+        bool doppler = false;
+        Vector3 position = {};
+        Vector3 previous = {};   // позиция на прошлом Update (скорость для доплера)
+        float minDistance = AUDIO_MIN_DISTANCE;
+        float maxDistance = AUDIO_MAX_DISTANCE;
+        float volume = 1.0f;
+        Mix sent;                // что уже ушло в SPU
+        Voice voices[AUDIO_EMITTER_VOICES];
+        int voiceCount = 0;
+    };
+
+    Mix Compute(const Emitter& e, const Vector3& velocity) const;
+    void DropFinishedVoices(Emitter& e, const SpuSnapshot& snap);
+    static bool Differs(const Mix& a, const Mix& b);
+
+    AudioSystem* audio = nullptr;
+
+    Vector3 listenerPos = {};
+    Vector3 listenerRight = { 1.0f, 0.0f, 0.0f };
+    Vector3 listenerPrevious = {};
+    Vector3 listenerVelocity = {};
+    bool listenerPlaced = false;
+
+    Emitter emitters[AUDIO_EMITTER_COUNT];
+    int emitterCount = 0;
+    int lastCommands = 0;
+    // Отсортированные handle звучащих голосов из снимка SPU (заполняется в Update)
+    std::vector<uint32_t> playing;
+};
@@ -0,0 +1,249 @@
+﻿#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+   Декодер Sony ADPCM (VAG) в целых числах - так же, как его считает SPU:
+   коэффициенты фильтра 6-битные (K/64), округление +32, насыщение до int16.
+   Блок 16 байт: [shift|filter] [flags] + 14 байт = 28 сэмплов.
+*/
+constexpr size_t ADPCM_BLOCK_BYTES = 16;
+constexpr size_t ADPCM_BLOCK_SAMPLES = 28;
+
+// Флаги блока (байт 1)
+constexpr uint8_t ADPCM_FLAG_END = 0x01;
+constexpr uint8_t ADPCM_FLAG_REPEAT = 0x02;
+constexpr uint8_t ADPCM_FLAG_LOOP_START = 0x04;
+
+// Петля VAG по флагам блоков
+struct AdpcmLoop
+{
+    size_t blocks = 0;      // до блока с флагом конца включительно
+    size_t loopBlock = 0;   // последний LOOP_START до конца
+    bool looped = false;    // конец с REPEAT: SPU переходит на loopBlock
+
+    size_t LoopStartSample() const { return loopBlock * ADPCM_BLOCK_SAMPLES; }
+};
+
+// Состояние фильтра между блоками (два предыдущих сэмпла)
+struct AdpcmState
+{
+    int32_t s1 = 0;
+    int32_t s2 = 0;
+};
+
+namespace PsxAdpcm
+{
+    // K0/K1 * 64, фильтры 5..15 у SPU не определены - считаем нулевым
+    constexpr int32_t K0[16] = { 0, 60, 115, 98, 122 };
+    constexpr int32_t K1[16] = { 0, 0, -52, -55, -60 };
+
+    // int16 -> float в диапазоне -1..1 (как раньше в LoadVab)
+    constexpr float TO_FLOAT = 1.0f / 32768.0f;
+
+    inline int32_t Clamp16(int32_t v)
+    {
+        return v < -32768 ? -32768 : (v > 32767 ? 32767 : v);
+    }
+
+    inline void Store(int16_t* out, int32_t v) { *out = (int16_t)v; }
+    inline void Store(float* out, int32_t v) { *out = (float)v * TO_FLOAT; }
+
+    // Один блок: ровно ADPCM_BLOCK_SAMPLES сэмплов в out
+    template<class T>
+    inline void DecodeBlock(const uint8_t* block, AdpcmState& state, T* out)
+    {
+        int shift = block[0] & 0x0F;
+        if (shift > 12) shift = 9;   // так ведёт себя железо на 13..15
+        const int filter = (block[0] >> 4) & 0x0F;
+        const int32_t k0 = K0[filter];
+        const int32_t k1 = K1[filter];
+
+        int32_t s1 = state.s1;
+        int32_t s2 = state.s2;
+        const uint8_t* data = block + 2;
+
+        for (size_t i = 0; i < ADPCM_BLOCK_SAMPLES; i += 2)
+        {
+            const uint8_t byte = data[i >> 1];
+            // Нибл в старшие биты int16, арифметический сдвиг вниз - знак расширяется сам
+            int32_t lo = (int16_t)(uint16_t)((byte & 0x0F) << 12) >> shift;
+            int32_t hi = (int16_t)(uint16_t)((byte & 0xF0) << 8) >> shift;
+
+            lo = Clamp16(lo + ((s1 * k0 + s2 * k1 + 32) >> 6));
+            s2 = s1; s1 = lo;
+            hi = Clamp16(hi + ((s1 * k0 + s2 * k1 + 32) >> 6));
+            s2 = s1; s1 = hi;
+
+            Store(out + i, lo);
+            Store(out + i + 1, hi);
+        }
+
+        state.s1 = s1;
+        state.s2 = s2;
+    }
+
+    // Сколько сэмплов даст поток: до блока с флагом конца включительно
+    inline size_t CountSamples(const uint8_t* src, size_t size)
+    {
+        size_t blocks = 0;
+        for (size_t i = 0; i + ADPCM_BLOCK_BYTES <= size; i += ADPCM_BLOCK_BYTES) {
+            ++blocks;
+            if (src[i + 1] & ADPCM_FLAG_END) break;
+        }
+        return blocks * ADPCM_BLOCK_SAMPLES;
+    }
+
+    /*
+       Петля по флагам, как её видит SPU: LOOP_START запоминает адрес повтора, блок END|REPEAT
+       после себя переходит на него, END без REPEAT - конец звука. Одиночный тихий блок
+       END|REPEAT|LOOP_START в хвосте (так кодировщики закрывают звуки без петли) петлёй не считается.
+    */
+    inline AdpcmLoop ScanLoop(const uint8_t* src, size_t size)
+    {
+        AdpcmLoop loop;
+        for (size_t i = 0; i + ADPCM_BLOCK_BYTES <= size; i += ADPCM_BLOCK_BYTES) {
+            const uint8_t flags = src[i + 1];
+            const size_t b = loop.blocks++;
+            if (flags & ADPCM_FLAG_LOOP_START) loop.loopBlock = b;
+            if (!(flags & ADPCM_FLAG_END)) continue;
+
+            loop.looped = (flags & ADPCM_FLAG_REPEAT) != 0;
+            if (loop.looped && loop.loopBlock == b) {
+                bool silent = true;
+                for (size_t k = 2; k < ADPCM_BLOCK_BYTES; ++k) silent &= src[i + k] == 0;
+                if (silent) loop.looped = false;
+            }
+            break;
+        }
+        if (!loop.looped) loop.loopBlock = 0;
+        return loop;
+    }
+
+    // Весь поток в заранее выделенный out (CountSamples() элементов). Возвращает число сэмплов.
+    template<class T>
+    inline size_t Decode(const uint8_t* src, size_t size, T* out)
+    {
+        AdpcmState state;
+        size_t written = 0;
+        for (size_t i = 0; i + ADPCM_BLOCK_BYTES <= size; i += ADPCM_BLOCK_BYTES)
+        {
+            DecodeBlock(src + i, state, out + written);
+            written += ADPCM_BLOCK_SAMPLES;
+            if (src[i + 1] & ADPCM_FLAG_END) break;
+        }
+        return written;
+    }
+
+    // Один сэмпл по номеру: поток декодируется с начала, только для редких одиночных чтений
+    inline int16_t SampleAt(const uint8_t* src, size_t index)
+    {
+        AdpcmState state;
+        int16_t block[ADPCM_BLOCK_SAMPLES];
+        const size_t target = index / ADPCM_BLOCK_SAMPLES;
+        for (size_t b = 0; b <= target; ++b)
+            DecodeBlock(src + b * ADPCM_BLOCK_BYTES, state, block);
+        return block[index % ADPCM_BLOCK_SAMPLES];
+    }
+}
+
+/*
+   Потоковый декодер одного VAG для голоса: окно int16 вокруг курсора чтения.
+   Блоки по 28 сэмплов декодируются по мере того, как курсор к ним подходит, пройденное
+   отбрасывается сдвигом окна. Перед первым сэмплом - 3 нуля (как запас в пуле сэмплов).
+   Зацикленный VAG после последнего блока продолжается блоком петли (номера сэмплов
+   растут дальше, как в запасе пула), без петли - нулями.
+   Память окна выдаёт владелец (PsxSpu), сам декодер ничего не выделяет.
+*/
+class AdpcmStream
+{
+public:
+    static constexpr int64_t GUARD = 3;
+
+    void Attach(int16_t* window, size_t capacity)
+    {
+        buf = window;
+        cap = (int64_t)capacity;
+    }
+
+    // Новый VAG (loop.blocks блоков по 16 байт) с начала
+    void Start(const uint8_t* vag, const AdpcmLoop& loop)
+    {
+        src = vag;
+        blockCount = loop.blocks;
+        loopBlock = loop.loopBlock;
+        looped = loop.looped;
+        Rewind();
+    }
+
+    /*
+       Сэмплы [first, last] подряд; указатель на first. first не меньше -GUARD,
+       last - first заметно меньше ёмкости окна. Назад - декодирование с начала.
+    */
+    const int16_t* Ensure(int64_t first, int64_t last)
+    {
+        if (first >= start && last < end) return buf + (first - start);
+        if (first < start) Rewind();
+
+        while (end <= last) {
+            if (nextBlock >= blockCount) {
+                // Конец без петли - тишина, окно начинается не раньше first
+                Slide(std::min(first, end));
+                if (first > end) start = end = first;
+                std::fill(buf + (end - start), buf + (last + 1 - start), int16_t(0));
+                end = last + 1;
+                break;
+            }
+            // Места на блок нет - всё до first больше не нужно
+            if (end - start + (int64_t)ADPCM_BLOCK_SAMPLES > cap)
+                Slide(std::min(first, end));
+
+            // Фильтр на входе в петлю: повтор декодируется с ним же, как и весь VAG в пуле
+            if (looped && nextBlock == loopBlock) loopState = state;
+            PsxAdpcm::DecodeBlock(src + nextBlock * ADPCM_BLOCK_BYTES, state, buf + (end - start));
+            end += (int64_t)ADPCM_BLOCK_SAMPLES;
+            if (++nextBlock == blockCount && looped) {
+                nextBlock = loopBlock;
+                state = loopState;
+            }
+        }
+        return buf + (first - start);
+    }
+
+    // Голос отмотал курсор на samples назад (длина петли, кратно): окно то же, номера меньше
+    void Shift(int64_t samples)
+    {
+        start -= samples;
+        end -= samples;
+    }
+
+private:
+    void Slide(int64_t keep)
+    {
+        std::memmove(buf, buf + (keep - start), (size_t)(end - keep) * sizeof(int16_t));
+        start = keep;
+    }
+
+    void Rewind()
+    {
+        state = AdpcmState();
+        nextBlock = 0;
+        start = -GUARD;
+        end = 0;
+        std::fill(buf, buf + GUARD, int16_t(0));
+    }
+
+    const uint8_t* src = nullptr;
+    size_t blockCount = 0;
+    size_t nextBlock = 0;
+    size_t loopBlock = 0;
+    bool looped = false;
+    AdpcmState state;
+    AdpcmState loopState;
+    int16_t* buf = nullptr;
+    int64_t cap = 0;
+    int64_t start = 0;   // номер сэмпла в buf[0]
+    int64_t end = 0;     // первый ещё не декодированный
+};
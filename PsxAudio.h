@@ -1,18 +1,59 @@
 ﻿#pragma once
 #include "raylib.h"
 #include "raymath.h"
+#include "PsxAdpcm.h"
+#include "SpuReverb.h"
+#include "SpscQueue.h"
 #include <cmath>
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <cstdio>
 #include <map>
+#include <memory>
+#include <atomic>
+#include <bit>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SPU_USE_SSE 1
+#endif
 
 const int SPU_VOICES_COUNT = 127;
-const int SFX_VOICE_LIMIT = 128;
+
+// Кто запускает голос. Порядок - приоритет: голос отнимают только у источника не важнее
+enum class SpuVoiceSource : uint8_t
+{
+    Sfx,        // звуки мира
+    Music,      // SEQ
+    Ui,         // меню и интерфейс
+    Count
+};
+const int SPU_SOURCE_COUNT = (int)SpuVoiceSource::Count;
+// Пределы голосов по умолчанию: бой не может занять все голоса музыки
+const int SPU_DEFAULT_VOICE_LIMIT[SPU_SOURCE_COUNT] = { 64, SPU_VOICES_COUNT, 16 };
 
 const int SPU_SAMPLE_RATE = 44100;
 const int MAX_AUDIO_BUFFER = 8192;
+// Микшер считает буфер кусками: блок голоса + сведение помещаются в L1
+const int SPU_BLOCK_FRAMES = 256;
+// Реверб, пока игра не выбрала другой
+const SpuReverbMode SPU_DEFAULT_REVERB = SpuReverbMode::Hall;
+// Команд от игры за один колбэк звука (с большим запасом: SEQ даёт десятки)
+const size_t SPU_COMMAND_QUEUE = 1024;
+// Банк голоса (номер в AudioSystem) для команд, которые касаются всех банков
+const int SPU_ALL_BANKS = -1;
+// Питч голоса - 4.12 с фиксированной точкой, как регистр SPU: 1000h - исходная скорость, выше 3FFFh нельзя
+const uint32_t SPU_PITCH_ONE = 0x1000;
+const uint32_t SPU_PITCH_MAX = 0x3FFF;
+// Тишина перед каждым VAG в пуле: гауссу нужны 3 предыдущих сэмпла, и на старте их не надо проверять
+const int SPU_GUARD_SAMPLES = 3;
+// Запас после конца сэмпла: блок микшера на максимальном питче + гаусс. У петли в нём её
+// начало, у звука без петли - нули; курсор уходит в запас без проверок и отматывается после блока
+const int SPU_TAIL_GUARD = SPU_BLOCK_FRAMES * 4 + 8;
+const uint32_t SPU_NO_LOOP = 0xFFFFFFFF;
+// Окно потокового ADPCM на голос: блок микшера на максимальном питче + запас и один блок VAG
+const int SPU_STREAM_WINDOW = SPU_BLOCK_FRAMES * 4 + 64;
 
 enum AdsrState { ADSR_IDLE, ADSR_ATTACK, ADSR_DECAY, ADSR_SUSTAIN, ADSR_RELEASE };
 enum WaveType { WAVE_SINE, WAVE_SAW, WAVE_SQUARE, WAVE_NOISE };
@@ -29,6 +70,242 @@ struct AdsrSettings
 };
 
 
+// Параметры тонов без VAB (синтезатор): мгновенная атака, полное удержание, спад ~45 мс
+constexpr uint16_t SPU_DEFAULT_ADSR1 = 0x00FF;
+constexpr uint16_t SPU_DEFAULT_ADSR2 = 0x1FCA;
+// Принудительный спад, когда не зацикленный сэмпл кончился (линейно, ~6 мс)
+constexpr uint8_t SPU_FAST_RELEASE_RATE = 28;
+
+/*
+   Огибающая ADSR голоса в целых числах, по правилам SPU:
+   уровень 0..7FFFh, скорость фазы rate = shift:5 | step:2;
+   шаг step << max(0, 11 - shift) раз в 1 << max(0, shift - 11) тиков (тик = сэмпл 44.1 кГц).
+   Экспонента: при спаде шаг масштабируется текущим уровнем, при росте выше 6000h - вчетверо реже.
+   ADSR1/ADSR2 берутся из атрибутов тона VH как есть, включая скорость и направление sustain.
+*/
+struct SpuEnvelope
+{
+    AdsrState phase = ADSR_IDLE;
+    int32_t level = 0;
+    int32_t counter = 1;      // тиков до следующего шага
+    int32_t target = 0;       // attack: 7FFFh, decay: уровень sustain
+    uint16_t adsr1 = SPU_DEFAULT_ADSR1;
+    uint16_t adsr2 = SPU_DEFAULT_ADSR2;
+    uint8_t rate = 0;
+    bool exponential = false;
+    bool decreasing = false;
+
+    static constexpr int32_t MAX_LEVEL = 0x7FFF;
+    static constexpr float TO_FLOAT = 1.0f / 32768.0f;
+
+    void KeyOn(uint16_t a1, uint16_t a2)
+    {
+        adsr1 = a1;
+        adsr2 = a2;
+        level = 0;
+        SetPhase(ADSR_ATTACK);
+    }
+
+    void KeyOff()
+    {
+        if (phase != ADSR_IDLE && phase != ADSR_RELEASE)
+            SetPhase(ADSR_RELEASE);
+    }
+
+    // Release с заданной скоростью вместо скорости из ADSR2
+    void ForceRelease(uint8_t releaseRate)
+    {
+        if (phase == ADSR_IDLE) return;
+        SetPhase(ADSR_RELEASE);
+        rate = releaseRate;
+        exponential = false;
+    }
+
+    void SetPhase(AdsrState p)
+    {
+        phase = p;
+        counter = 1;
+        switch (p) {
+        case ADSR_ATTACK:
+            rate = (adsr1 >> 8) & 0x7F;
+            exponential = (adsr1 & 0x8000) != 0;
+            decreasing = false;
+            target = MAX_LEVEL;
+            break;
+        case ADSR_DECAY:
+            rate = ((adsr1 >> 4) & 0x0F) << 2;
+            exponential = true;
+            decreasing = true;
+            target = std::min<int32_t>(((adsr1 & 0x0F) + 1) * 0x800, MAX_LEVEL);
+            break;
+        case ADSR_SUSTAIN:
+            rate = (adsr2 >> 6) & 0x7F;
+            exponential = (adsr2 & 0x8000) != 0;
+            decreasing = (adsr2 & 0x4000) != 0;
+            break;
+        case ADSR_RELEASE:
+            rate = (adsr2 & 0x1F) << 2;
+            exponential = (adsr2 & 0x20) != 0;
+            decreasing = true;
+            break;
+        default:
+            level = 0;
+            break;
+        }
+    }
+
+    // Один шаг уровня (когда counter дошёл до нуля) и переход фазы
+    void Step()
+    {
+        const int shift = rate >> 2;
+        int32_t step = decreasing ? (-8 + (rate & 3)) : (7 - (rate & 3));
+        int32_t cycles = 1;
+        if (shift < 11) step *= (1 << (11 - shift));
+        else cycles = 1 << (shift - 11);
+
+        if (exponential) {
+            if (decreasing) step = (step * level) >> 15;
+            else if (level > 0x6000) cycles *= 4;
+        }
+
+        level += step;
+        if (level < 0) level = 0;
+        else if (level > MAX_LEVEL) level = MAX_LEVEL;
+        counter = cycles;
+
+        switch (phase) {
+        case ADSR_ATTACK:  if (level >= target) SetPhase(ADSR_DECAY); break;
+        case ADSR_DECAY:   if (level <= target) SetPhase(ADSR_SUSTAIN); break;
+        case ADSR_RELEASE: if (level <= 0) SetPhase(ADSR_IDLE); break;
+        default: break;
+        }
+    }
+
+    // Один тик; уровень во float 0..1
+    float Tick()
+    {
+        if (phase == ADSR_IDLE) return 0.0f;
+        if (--counter <= 0) Step();
+        return level * TO_FLOAT;
+    }
+
+    // Блок тиков сразу: пока счётчик не дошёл, уровень постоянный - заполняем отрезками
+    void Render(float* out, int frames)
+    {
+        int k = 0;
+        while (k < frames)
+        {
+            if (phase == ADSR_IDLE) {
+                std::fill(out + k, out + frames, 0.0f);
+                return;
+            }
+            const int hold = std::min(counter - 1, frames - k);
+            std::fill(out + k, out + k + hold, level * TO_FLOAT);
+            k += hold;
+            counter -= hold;
+            if (k == frames) break;
+
+            Step();
+            out[k++] = level * TO_FLOAT;
+        }
+    }
+};
+
+/*
+   Гауссова интерполяция SPU: 4 последних сэмпла, веса из таблицы на 512 значений.
+   i - старшие 8 бит дробной части счётчика питча:
+   out = (g[0FFh-i]*s[n-3] + g[1FFh-i]*s[n-2] + g[100h+i]*s[n-1] + g[i]*s[n]) >> 15
+   Таблица - ПЗУ SPU (psx-spx, "SPU Interpolation"); сумма четырёх весов 7F7Fh..7F81h.
+*/
+namespace SpuGauss
+{
+    constexpr int TABLE_SIZE = 512;
+
+    constexpr int16_t ROM[TABLE_SIZE] = {
+        -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001,
+        -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001,
+        0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0001,
+        0x0001, 0x0001, 0x0001, 0x0002, 0x0002, 0x0002, 0x0003, 0x0003,
+        0x0003, 0x0004, 0x0004, 0x0005, 0x0005, 0x0006, 0x0007, 0x0007,
+        0x0008, 0x0009, 0x0009, 0x000A, 0x000B, 0x000C, 0x000D, 0x000E,
+        0x000F, 0x0010, 0x0011, 0x0012, 0x0013, 0x0015, 0x0016, 0x0018,
+        0x0019, 0x001B, 0x001C, 0x001E, 0x0020, 0x0021, 0x0023, 0x0025,
+        0x0027, 0x0029, 0x002C, 0x002E, 0x0030, 0x0033, 0x0035, 0x0038,
+        0x003A, 0x003D, 0x0040, 0x0043, 0x0046, 0x0049, 0x004D, 0x0050,
+        0x0054, 0x0057, 0x005B, 0x005F, 0x0063, 0x0067, 0x006B, 0x006F,
+        0x0074, 0x0078, 0x007D, 0x0082, 0x0087, 0x008C, 0x0091, 0x0096,
+        0x009C, 0x00A1, 0x00A7, 0x00AD, 0x00B3, 0x00BA, 0x00C0, 0x00C7,
+        0x00CD, 0x00D4, 0x00DB, 0x00E3, 0x00EA, 0x00F2, 0x00FA, 0x0101,
+        0x010A, 0x0112, 0x011B, 0x0123, 0x012C, 0x0135, 0x013F, 0x0148,
+        0x0152, 0x015C, 0x0166, 0x0171, 0x017B, 0x0186, 0x0191, 0x019C,
+        0x01A8, 0x01B4, 0x01C0, 0x01CC, 0x01D9, 0x01E5, 0x01F2, 0x0200,
+        0x020D, 0x021B, 0x0229, 0x0237, 0x0246, 0x0255, 0x0264, 0x0273,
+        0x0283, 0x0293, 0x02A3, 0x02B4, 0x02C4, 0x02D6, 0x02E7, 0x02F9,
+        0x030B, 0x031D, 0x0330, 0x0343, 0x0356, 0x036A, 0x037E, 0x0392,
+        0x03A7, 0x03BC, 0x03D1, 0x03E7, 0x03FC, 0x0413, 0x042A, 0x0441,
+        0x0458, 0x0470, 0x0488, 0x04A0, 0x04B9, 0x04D2, 0x04EC, 0x0506,
+        0x0520, 0x053B, 0x0556, 0x0572, 0x058E, 0x05AA, 0x05C7, 0x05E4,
+        0x0601, 0x061F, 0x063E, 0x065C, 0x067C, 0x069B, 0x06BB, 0x06DC,
+        0x06FD, 0x071E, 0x0740, 0x0762, 0x0784, 0x07A7, 0x07CB, 0x07EF,
+        0x0813, 0x0838, 0x085D, 0x0883, 0x08A9, 0x08D0, 0x08F7, 0x091E,
+        0x0946, 0x096F, 0x0998, 0x09C1, 0x09EB, 0x0A16, 0x0A40, 0x0A6C,
+        0x0A98, 0x0AC4, 0x0AF1, 0x0B1E, 0x0B4C, 0x0B7A, 0x0BA9, 0x0BD8,
+        0x0C07, 0x0C38, 0x0C68, 0x0C99, 0x0CCB, 0x0CFD, 0x0D30, 0x0D63,
+        0x0D97, 0x0DCB, 0x0E00, 0x0E35, 0x0E6B, 0x0EA1, 0x0ED7, 0x0F0F,
+        0x0F46, 0x0F7F, 0x0FB7, 0x0FF1, 0x102A, 0x1065, 0x109F, 0x10DB,
+        0x1116, 0x1153, 0x118F, 0x11CD, 0x120B, 0x1249, 0x1288, 0x12C7,
+        0x1307, 0x1347, 0x1388, 0x13C9, 0x140B, 0x144D, 0x1490, 0x14D4,
+        0x1517, 0x155C, 0x15A0, 0x15E6, 0x162C, 0x1672, 0x16B9, 0x1700,
+        0x1747, 0x1790, 0x17D8, 0x1821, 0x186B, 0x18B5, 0x1900, 0x194B,
+        0x1996, 0x19E2, 0x1A2E, 0x1A7B, 0x1AC8, 0x1B16, 0x1B64, 0x1BB3,
+        0x1C02, 0x1C51, 0x1CA1, 0x1CF1, 0x1D42, 0x1D93, 0x1DE5, 0x1E37,
+        0x1E89, 0x1EDC, 0x1F2F, 0x1F82, 0x1FD6, 0x202A, 0x207F, 0x20D4,
+        0x2129, 0x217F, 0x21D5, 0x222C, 0x2282, 0x22DA, 0x2331, 0x2389,
+        0x23E1, 0x2439, 0x2492, 0x24EB, 0x2545, 0x259E, 0x25F8, 0x2653,
+        0x26AD, 0x2708, 0x2763, 0x27BE, 0x281A, 0x2876, 0x28D2, 0x292E,
+        0x298B, 0x29E7, 0x2A44, 0x2AA1, 0x2AFF, 0x2B5C, 0x2BBA, 0x2C18,
+        0x2C76, 0x2CD4, 0x2D33, 0x2D91, 0x2DF0, 0x2E4F, 0x2EAE, 0x2F0D,
+        0x2F6C, 0x2FCC, 0x302B, 0x308B, 0x30EA, 0x314A, 0x31AA, 0x3209,
+        0x3269, 0x32C9, 0x3329, 0x3389, 0x33E9, 0x3449, 0x34A9, 0x3509,
+        0x3569, 0x35C9, 0x3629, 0x3689, 0x36E8, 0x3748, 0x37A8, 0x3807,
+        0x3867, 0x38C6, 0x3926, 0x3985, 0x39E4, 0x3A43, 0x3AA2, 0x3B00,
+        0x3B5F, 0x3BBD, 0x3C1B, 0x3C79, 0x3CD7, 0x3D35, 0x3D92, 0x3DEF,
+        0x3E4C, 0x3EA9, 0x3F05, 0x3F62, 0x3FBD, 0x4019, 0x4074, 0x40D0,
+        0x412A, 0x4185, 0x41DF, 0x4239, 0x4292, 0x42EB, 0x4344, 0x439C,
+        0x43F4, 0x444C, 0x44A3, 0x44FA, 0x4550, 0x45A6, 0x45FC, 0x4651,
+        0x46A6, 0x46FA, 0x474E, 0x47A1, 0x47F4, 0x4846, 0x4898, 0x48E9,
+        0x493A, 0x498A, 0x49D9, 0x4A29, 0x4A77, 0x4AC5, 0x4B13, 0x4B5F,
+        0x4BAC, 0x4BF7, 0x4C42, 0x4C8D, 0x4CD7, 0x4D20, 0x4D68, 0x4DB0,
+        0x4DF7, 0x4E3E, 0x4E84, 0x4EC9, 0x4F0E, 0x4F52, 0x4F95, 0x4FD7,
+        0x5019, 0x505A, 0x509A, 0x50DA, 0x5118, 0x5156, 0x5194, 0x51D0,
+        0x520C, 0x5247, 0x5281, 0x52BA, 0x52F3, 0x532A, 0x5361, 0x5397,
+        0x53CC, 0x5401, 0x5434, 0x5467, 0x5499, 0x54CA, 0x54FA, 0x5529,
+        0x5558, 0x5585, 0x55B2, 0x55DE, 0x5609, 0x5632, 0x565B, 0x5684,
+        0x56AB, 0x56D1, 0x56F6, 0x571B, 0x573E, 0x5761, 0x5782, 0x57A3,
+        0x57C3, 0x57E2, 0x57FF, 0x581C, 0x5838, 0x5853, 0x586D, 0x5886,
+        0x589E, 0x58B5, 0x58CB, 0x58E0, 0x58F4, 0x5907, 0x5919, 0x592A,
+        0x593A, 0x5949, 0x5958, 0x5965, 0x5971, 0x597C, 0x5986, 0x598F,
+        0x5997, 0x599E, 0x59A4, 0x59A9, 0x59AD, 0x59B0, 0x59B2, 0x59B3,
+    };
+
+    struct Table
+    {
+        float f[TABLE_SIZE];   // ROM / 8000h - для микшера во float
+
+        Table()
+        {
+            for (int x = 0; x < TABLE_SIZE; ++x)
+                f[x] = ROM[x] * (1.0f / 32768.0f);
+        }
+    };
+
+    inline const Table& Get()
+    {
+        static const Table table;
+        return table;
+    }
+}
+
 struct Instrument {
     //float* data = nullptr;
     std::vector<float> data;
@@ -41,8 +318,168 @@ struct Instrument {
     AdsrSettings adsr;
 };
 
+// В каком виде банк хранит декодированные сэмплы
+enum class SampleFormat : uint8_t
+{
+    Int16,   // как их выдаёт SPU, вдвое меньше памяти; во float - прямо в интерполяции
+    Float,
+    Adpcm,   // VAG как есть (в 7 раз меньше float), голос декодирует блоки по мере игры
+};
+
+/*
+   Ссылка на декодированный VAG из пула банка (SamplePool).
+   Копирование - только счётчик ссылок, сами сэмплы хранятся один раз,
+   сколько бы тонов (keyzone) их ни использовали.
+*/
+class SampleRef
+{
+public:
+    SampleRef() = default;
+    // guard - сколько сэмплов в начале буфера служат запасом (data()[-guard..-1] читать можно),
+    // tail - сколько в конце (data()[size()..size() + tail - 1]); loopStart - начало петли или SPU_NO_LOOP
+    explicit SampleRef(std::shared_ptr<const std::vector<float>> samples, size_t guard = 0, size_t tail = 0,
+        uint32_t loopStart = SPU_NO_LOOP)
+        : buffer(samples)
+        , f32(samples ? samples->data() + guard : nullptr)
+        , count(samples ? samples->size() - guard - tail : 0)
+        , guard(guard)
+        , tail(tail)
+        , loop(loopStart)
+        , fmt(SampleFormat::Float)
+    {
+    }
+    explicit SampleRef(std::shared_ptr<const std::vector<int16_t>> samples, size_t guard = 0, size_t tail = 0,
+        uint32_t loopStart = SPU_NO_LOOP)
+        : buffer(samples)
+        , s16(samples ? samples->data() + guard : nullptr)
+        , count(samples ? samples->size() - guard - tail : 0)
+        , guard(guard)
+        , tail(tail)
+        , loop(loopStart)
+        , fmt(SampleFormat::Int16)
+    {
+    }
+    // Сырой VAG из целых блоков: сэмплов 28 на блок, запаса нет (его держит окно голоса); петля - по флагам
+    explicit SampleRef(std::shared_ptr<const std::vector<uint8_t>> vag)
+        : buffer(vag)
+        , adpcm(vag ? vag->data() : nullptr)
+        , count(vag ? vag->size() / ADPCM_BLOCK_BYTES * ADPCM_BLOCK_SAMPLES : 0)
+        , fmt(SampleFormat::Adpcm)
+    {
+        if (!vag) return;
+        const AdpcmLoop scan = PsxAdpcm::ScanLoop(vag->data(), vag->size());
+        if (scan.looped) loop = (uint32_t)scan.LoopStartSample();
+    }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    SampleFormat format() const { return fmt; }
+    const float* floatData() const { return f32; }
+    const int16_t* int16Data() const { return s16; }
+    const uint8_t* adpcmData() const { return adpcm; }
+    size_t GetAdpcmBlocks() const { return count / ADPCM_BLOCK_SAMPLES; }
+    AdpcmLoop GetAdpcmLoop() const
+    {
+        AdpcmLoop scan;
+        scan.blocks = GetAdpcmBlocks();
+        scan.looped = looped();
+        scan.loopBlock = scan.looped ? loop / ADPCM_BLOCK_SAMPLES : 0;
+        return scan;
+    }
+    size_t GetGuard() const { return guard; }
+    size_t GetTailGuard() const { return tail; }
+    bool looped() const { return loop != SPU_NO_LOOP; }
+    uint32_t GetLoopStart() const { return loop; }
+    size_t GetMemoryBytes() const
+    {
+        if (fmt == SampleFormat::Adpcm) return GetAdpcmBlocks() * ADPCM_BLOCK_BYTES;
+        return (count + guard + tail) * (fmt == SampleFormat::Int16 ? sizeof(int16_t) : sizeof(float));
+    }
+
+    // Одиночное чтение (синтезатор, отладка); микшер читает сырые указатели или окно голоса
+    float operator[](size_t i) const
+    {
+        if (s16) return s16[i] * PsxAdpcm::TO_FLOAT;
+        if (f32) return f32[i];
+        return PsxAdpcm::SampleAt(adpcm, i) * PsxAdpcm::TO_FLOAT;
+    }
+    void clear() { *this = SampleRef(); }
+
+private:
+    std::shared_ptr<const void> buffer;
+    // буфер не меняется после загрузки - кешируем для микшера
+    const float* f32 = nullptr;
+    const int16_t* s16 = nullptr;
+    const uint8_t* adpcm = nullptr;
+    size_t count = 0;
+    size_t guard = 0;
+    size_t tail = 0;
+    uint32_t loop = SPU_NO_LOOP;
+    SampleFormat fmt = SampleFormat::Float;
+};
+
+// Все VAG банка, индекс = номер VAG - 1 (как в атрибутах тонов VH)
+class SamplePool
+{
+public:
+    void Resize(size_t count) { samples.assign(count, SampleRef()); }
+    // Слот заполняется один раз (можно с разных потоков - каждый пишет свой индекс).
+    // Перед сэмплами - SPU_GUARD_SAMPLES нулей для интерполяции, после - SPU_TAIL_GUARD:
+    // с loopStart (сэмпл начала петли) в нём петля по кругу, иначе нули
+    template<class T>
+    void Set(size_t index, const std::vector<T>& data, uint32_t loopStart = SPU_NO_LOOP)
+    {
+        std::vector<T> padded = MakePadded<T>(data.size());
+        std::copy(data.begin(), data.end(), padded.begin() + SPU_GUARD_SAMPLES);
+        SetPadded(index, std::move(padded), loopStart);
+    }
+
+    // Буфер под count сэмплов вместе с запасами: декодер пишет сразу с data() + SPU_GUARD_SAMPLES
+    template<class T>
+    static std::vector<T> MakePadded(size_t count) { return std::vector<T>(SPU_GUARD_SAMPLES + count + SPU_TAIL_GUARD, T(0)); }
+
+    // Буфер из MakePadded с уже записанными сэмплами; запас после них заполняется здесь
+    template<class T>
+    void SetPadded(size_t index, std::vector<T>&& padded, uint32_t loopStart = SPU_NO_LOOP)
+    {
+        const size_t count = padded.size() - SPU_GUARD_SAMPLES - SPU_TAIL_GUARD;
+        if (loopStart >= count) loopStart = SPU_NO_LOOP;
+        if (loopStart != SPU_NO_LOOP) {
+            const T* body = padded.data() + SPU_GUARD_SAMPLES + loopStart;
+            const size_t length = count - loopStart;
+            T* tailGuard = padded.data() + SPU_GUARD_SAMPLES + count;
+            for (size_t k = 0; k < (size_t)SPU_TAIL_GUARD; ++k)
+                tailGuard[k] = body[k % length];
+        }
+        samples[index] = SampleRef(std::make_shared<const std::vector<T>>(std::move(padded)),
+            SPU_GUARD_SAMPLES, SPU_TAIL_GUARD, loopStart);
+    }
+    // VAG без декодирования: хвост после блока с флагом конца отрезается
+    void SetAdpcm(size_t index, std::vector<uint8_t>&& vag)
+    {
+        vag.resize(PsxAdpcm::CountSamples(vag.data(), vag.size()) / ADPCM_BLOCK_SAMPLES * ADPCM_BLOCK_BYTES);
+        samples[index] = SampleRef(std::make_shared<const std::vector<uint8_t>>(std::move(vag)));
+    }
+    SampleRef Get(size_t index) const
+    {
+        return (index < samples.size()) ? samples[index] : SampleRef();
+    }
+    size_t GetCount() const { return samples.size(); }
+    size_t GetMemoryBytes() const
+    {
+        size_t bytes = 0;
+        for (const auto& s : samples)
+            bytes += s.GetMemoryBytes();
+        return bytes;
+    }
+    void Clear() { samples.clear(); }
+
+private:
+    std::vector<SampleRef> samples;
+};
+
 struct Tone {
-    std::vector<float> data;
+    SampleRef data;
     uint32_t sampleCount = 0;
     uint8_t minNote = 0;
     uint8_t maxNote = 127;
@@ -54,6 +491,9 @@ struct Tone {
     float decay = 0.5f;
     float sustain = 1.0f;
     float release = 0.2f;
+    // Регистры SPU, по ним голос считает огибающую (секунды выше - для справки)
+    uint16_t adsr1 = SPU_DEFAULT_ADSR1;
+    uint16_t adsr2 = SPU_DEFAULT_ADSR2;
 
     InstrumentType type = InstrumentType::Sample;
     bool loop = false;
@@ -66,35 +506,38 @@ struct Program
 };
 
 class SpuVoice {
-private:
-    // КУБИЧЕСКАЯ ИНТЕРПОЛЯЦИЯ (Эмуляция "мягкого" звука PS1)
-    float CubicInterp(float y0, float y1, float y2, float y3, float mu) {
-        float a0, a1, a2, a3;
-        float mu2 = mu * mu;
-        a0 = y3 - y2 - y0 + y1;
-        a1 = y0 - y1 - a0;
-        a2 = y2 - y0;
-        a3 = y1;
-        return (a0 * mu * mu2 + a1 * mu2 + a2 * mu + a3);
-    }
-
 public:
     bool active = false;
     float pitch = 1.0f;
-    float sampleCursor = 0.0f;
+    // Позиция в сэмпле: целая часть (номер текущего сэмпла) и дробная 0..FFFh, как счётчик SPU
+    uint32_t position = 0;
+    uint32_t counter = 0;
     float leftVolume = 1.0f, rightVolume = 1.0f;
     uint8_t currentNote = 0;
     int parentProgramID = -1;
+    int channel = -1;                // канал, бенд которого на голосе (ChannelBend)
+    int bankId = SPU_ALL_BANKS;      // из какого банка тон (музыка, звуки...)
+    SpuVoiceSource source = SpuVoiceSource::Sfx;
+    uint64_t startFrame = 0;         // аудиочасы на NoteOn: из равных отнимают самый старый
     float basePitch = 1.0f;
-    AdsrSettings adsr;
-    AdsrState state = ADSR_IDLE;
+    float pitchScale = 1.0f;         // доплер от PositionalAudio, поверх бенда
+    float noteVolume = 1.0f;         // громкость NoteOn: 3D-затухание множится на неё
+    SpuEnvelope envelope;
     float currentEnvelopeVal = 0.0f;
 
     const Tone* instrument = nullptr;
+    uint32_t handle = 0;   // кто запустил ноту (PsxSpu::PlayNote), для команд игры
 
     // Храним последний сэмпл для FM-модуляции следующего канала
     float lastSampleOutput = 0.0f;
 
+    // Декодер тона в формате Adpcm; окно выдаёт PsxSpu
+    AdpcmStream stream;
+    bool streaming = false;
+    // Курсор дошёл до wrapAt: петля отматывает на loopLength, без петли (0) - конец звука
+    uint32_t wrapAt = 0;
+    uint32_t loopLength = 0;
+
     void NoteOn(const Tone* inst, float p, float vol,float pan, int note, int progID)
     {
         instrument = inst;
@@ -102,33 +545,36 @@ public:
         pitch = p;
         currentNote = (uint8_t)note;
         parentProgramID = progID; // Запоминаем программу
+        pitchScale = 1.0f;
+        noteVolume = vol;
+        const SampleRef& smp = inst->data;
+        streaming = smp.format() == SampleFormat::Adpcm;
+        if (streaming) stream.Start(smp.adpcmData(), smp.GetAdpcmLoop());
+        // Петля отматывается, когда гауссу хватает запаса: курсор всегда в [loopStart + 3, конец + 3)
+        const bool looped = inst->type == InstrumentType::Sample && smp.looped();
+        loopLength = looped ? inst->sampleCount - smp.GetLoopStart() : 0;
+        wrapAt = looped ? inst->sampleCount + SPU_GUARD_SAMPLES : inst->sampleCount;
         active = true;
-        state = ADSR_ATTACK;
-        sampleCursor = 0.0f;
+        envelope.KeyOn(inst->adsr1, inst->adsr2);
+        position = 0;
+        counter = 0;
         currentEnvelopeVal = 0.0f;
 
         // Расчет стерео (pan: 0.0 - лево, 0.5 - центр, 1.0 - право)
         leftVolume = cosf(pan * (float)PI / 2.0f) * vol;
         rightVolume = sinf(pan * (float)PI / 2.0f) * vol;
-
-        adsr.attack = inst->attack;
-        adsr.sustain = inst->sustain;
-        adsr.decay = inst->decay;
-        adsr.release = inst->release;
-        
     }
 
     void NoteOff()
     {
-        if (state != ADSR_IDLE)
-            state = ADSR_RELEASE;
+        envelope.KeyOff();
     }
 
     
 
     bool IsNotePlaying()
     {
-        return active;// && (state != ADSR_IDLE);
+        return active;// && (envelope.phase != ADSR_IDLE);
     }
     void SetVolumeAndPan(float vol, float pan) {
         // Та же логика панорамы, что и в NoteOn
@@ -138,212 +584,381 @@ public:
         // но для динамического 3D лучше обновлять left/right напрямую.
     }
 
+    // Один тик огибающей; кончился release - голос свободен
+    float StepEnvelope()
+    {
+        currentEnvelopeVal = envelope.Tick();
+        if (envelope.phase == ADSR_IDLE) active = false;
+        return currentEnvelopeVal;
+    }
+
+    // Шаг счётчика за сэмпл выхода (4.12); modInput - сигнал предыдущего канала для FM
+    uint32_t PitchStep(float dt, float modInput) const
+    {
+        float ratio;
+        if (instrument->type == InstrumentType::Sample) {
+            // pitch = 1.0 - сэмпл за сэмпл выхода (dt = 1 / 44100)
+            ratio = pitch * pitchScale * (SPU_SAMPLE_RATE * dt) * (1.0f + modInput * 0.1f);
+        }
+        else {
+            // Синтезатор: период волны - весь буфер, 1.0 = до первой октавы
+            ratio = (float)instrument->sampleCount * 261.63f * pitch * pitchScale * (1.0f + modInput * 0.5f) * dt;
+        }
+        const float fixed = ratio * (float)SPU_PITCH_ONE + 0.5f;
+        if (fixed <= 0.0f) return 0;
+        return (fixed >= (float)SPU_PITCH_MAX) ? SPU_PITCH_MAX : (uint32_t)fixed;
+    }
+
+    // Следующий сэмпл инструмента (до огибающей)
+    float StepSample(float dt, float modInput)
+    {
+        if (!instrument || instrument->data.empty()) return 0.0f;
+
+        const float raw = Interpolate();
+        Advance(PitchStep(dt, modInput));
+        return raw;
+    }
+
     // modInput - это сигнал с предыдущего канала для FM-синтеза
     void GetSamples(float* outL, float* outR, float dt, float modInput = 0.0f)
     {
-        if (!active || state == ADSR_IDLE) {
+        if (!active || envelope.phase == ADSR_IDLE) {
             *outL = 0; *outR = 0;
             lastSampleOutput = 0.0f;
             return;
         }
 
-        // === ADSR ===
-        float rate = 0.0f;
-        float target = 0.0f;
-
-        switch (state) {
-        case ADSR_ATTACK:
-            currentEnvelopeVal += dt / (adsr.attack + 0.001f);
-            if (currentEnvelopeVal >= 1.0f) {
-                currentEnvelopeVal = 1.0f;
-                state = ADSR_DECAY;
-            }
-            break;
-        case ADSR_DECAY:
-            target = adsr.sustain;
-            rate = 15.0f / (adsr.decay + 0.001f);
-            currentEnvelopeVal += (target - currentEnvelopeVal) * rate * dt;
-            if (fabs(currentEnvelopeVal - target) < 0.01f) {
-                currentEnvelopeVal = target;
-                state = ADSR_SUSTAIN;
-            }
-            break;
-        case ADSR_SUSTAIN:
-            // Во время удержания просто плавно стремимся к sustain
-            currentEnvelopeVal += (adsr.sustain - currentEnvelopeVal) * 10.0f * dt;
-            break;
-        case ADSR_RELEASE:
-            // Умножаем текущее значение на коэффициент. Оно будет плавно стремиться к нулю.
-            rate = 8.0f / (adsr.release + 0.005f);
-            currentEnvelopeVal -= currentEnvelopeVal * rate * dt;
-
-            if (currentEnvelopeVal < 0.001f) {
-                currentEnvelopeVal = 0.0f;
-                state = ADSR_IDLE;
-                active = false;
-            }
-            break;
-        default: break;
-        }
-
-        float raw = 0.0f;
-
-        if (instrument && !instrument->data.empty()) {
-            unsigned int len = instrument->sampleCount;
+        StepEnvelope();
+        float raw = StepSample(dt, modInput);
 
-            // === РАЗДЕЛЕНИЕ ЛОГИКИ ДЛЯ СЭМПЛОВ И СИНТЕЗАТОРА ===
-
-            float step = 0.0f;
-            bool isSample = (instrument->type == InstrumentType::Sample);
-
-            if (isSample) {
-                // 1Скорость просто равна питчу (1.0 = нормальная скорость)
-                // 44100.0f нужно, так как dt у нас в секундах, а курсор в сэмплах
-                // Если pitch = 1.0, мы двигаемся на 44100 сэмплов в секунду
-                step = pitch *(SPU_SAMPLE_RATE * dt);
-                
-                // FM модуляция для сэмплов
-                float fmFactor = 1.0f + (modInput * 0.1f);
-                step *= fmFactor;
+        lastSampleOutput = raw * currentEnvelopeVal;
 
-                // 2. Движение курсора
-                sampleCursor += step;
+        *outL = lastSampleOutput * leftVolume;
+        *outR = lastSampleOutput * rightVolume;
+    }
 
-                // 3. Обработка конца файла
-                if (sampleCursor >= len) 
-                {
-                    if (instrument->loop) 
-                    {
-                        sampleCursor = fmod(sampleCursor, (float)len);
-                    }
-                    else 
-                    {
-                        if (state != ADSR_IDLE && state != ADSR_RELEASE) {
-                            state = ADSR_RELEASE;
-                            adsr.release = 0.005f; // Форсируем очень быстрое затухание (5 мс)
-                        }
+    /*
+       Весь блок голоса сразу: out[frames] - моно после огибающей (панорама - при сведении).
+       mod - выход предыдущего канала за этот же блок для FM (или nullptr, тогда modConst).
+       Сэмпл без FM считается без ветвлений: сначала огибающая в out, затем гаусс по 4 позициям
+       за раз поверх неё. Конец и шов петли внутри блока читаются из запаса после сэмпла.
+    */
+    void RenderBlock(float* out, int frames, float dt, const float* mod = nullptr, float modConst = 0.0f)
+    {
+        if (!active || envelope.phase == ADSR_IDLE) {
+            std::fill(out, out + frames, 0.0f);
+            lastSampleOutput = 0.0f;
+            return;
+        }
 
-                        // Удерживаем курсор на последнем сэмпле, чтобы интерполяции 
-                        // было откуда безопасно читать данные, пока идет Release
-                        sampleCursor = (float)(len - 1);
-                    }
-                }
+        const bool plain = !mod && modConst == 0.0f && instrument &&
+            instrument->type == InstrumentType::Sample && !instrument->data.empty();
+        if (plain)
+        {
+            const uint32_t step = PitchStep(dt, 0.0f);
+            // Огибающая целым блоком, интерполяция умножается поверх
+            envelope.Render(out, frames);
+            currentEnvelopeVal = out[frames - 1];
+            if (envelope.phase == ADSR_IDLE) active = false;
+            InterpolateRun(out, frames, step);
+            Advance(step * (uint32_t)frames);
+        }
+        else
+        {
+            for (int k = 0; k < frames; ++k) {
+                if (!active || envelope.phase == ADSR_IDLE) { out[k] = 0.0f; continue; }
+                const float env = StepEnvelope();
+                out[k] = StepSample(dt, mod ? mod[k] : modConst) * env;
             }
-            else {
-                // --- ЛОГИКА ДЛЯ СИНТЕЗАТОРА (WAVETABLE) ---
+        }
+        lastSampleOutput = out[frames - 1];
+    }
 
-                float fmFactor = 1.0f + (modInput * 0.5f);
-                float targetFreq = 261.63f * pitch * fmFactor;
-                step = ((float)len * targetFreq) * dt; // dt уже есть (1/SampleRate)
+private:
+    // Счётчик вперёд на step (4.12) и обработка конца сэмпла
+    void Advance(uint32_t step)
+    {
+        counter += step;
+        position += counter >> 12;
+        counter &= 0xFFF;
 
-                sampleCursor += step;
+        if (position < wrapAt) return;
 
-                // Синтезатор всегда зациклен (волна)
-                if (sampleCursor >= len) sampleCursor -= len;
-                if (sampleCursor < 0) sampleCursor += len;
-            }
+        // Петля: сюда раз за проход, запас после конца уже повторял её начало
+        if (loopLength) {
+            const uint32_t back = ((position - wrapAt) / loopLength + 1) * loopLength;
+            position -= back;
+            if (streaming) stream.Shift(back);
+            return;
+        }
+        // Синтезатор всегда зациклен (волна)
+        if (instrument->type != InstrumentType::Sample) {
+            position %= wrapAt;
+            return;
+        }
+        // END без REPEAT: SPU глушит голос и уводит его в release
+        if (envelope.phase != ADSR_IDLE && envelope.phase != ADSR_RELEASE)
+            envelope.ForceRelease(SPU_FAST_RELEASE_RATE);
+
+        // Курсор стоит в нулях запаса, пока идёт release
+        position = wrapAt + SPU_GUARD_SAMPLES;
+        counter = 0;
+    }
 
+    // Гаусс по 4 сэмплам, заканчивающимся текущим
+    float Interpolate()
+    {
+        const SampleRef& smp = instrument->data;
+        const float* g = SpuGauss::Get().f;
+        const uint32_t i = (counter >> 4) & 0xFF;
+
+        // Окно потока продолжает VAG так же, как запас пула: петлёй или нулями
+        if (streaming) {
+            const int16_t* p = stream.Ensure((int64_t)position - 3, position);
+            return (g[0xFF - i] * p[0] + g[0x1FF - i] * p[1] + g[0x100 + i] * p[2] + g[i] * p[3]) * PsxAdpcm::TO_FLOAT;
+        }
 
-            int i1 = (int)sampleCursor;
-            int i2 = i1 + 1;
-            int i0 = i1 - 1;
-            int i3 = i1 + 2;
+        if (instrument->type != InstrumentType::Sample) {
+            // Волна синтезатора по кругу (в ней short -32k..32k)
+            const uint32_t len = instrument->sampleCount;
+            const float scale = 1.0f / 32767.0f;
+            const float y0 = smp[(position + len - 3) % len];
+            const float y1 = smp[(position + len - 2) % len];
+            const float y2 = smp[(position + len - 1) % len];
+            const float y3 = smp[position % len];
+            return (g[0xFF - i] * y0 + g[0x1FF - i] * y1 + g[0x100 + i] * y2 + g[i] * y3) * scale;
+        }
 
+        // Перед сэмплом в пуле лежат нули, после - запас: position - 3 .. position читать можно всегда
+        if (const int16_t* pcm = smp.int16Data()) {
+            const int16_t* p = pcm + position - 3;
+            return (g[0xFF - i] * p[0] + g[0x1FF - i] * p[1] + g[0x100 + i] * p[2] + g[i] * p[3]) * PsxAdpcm::TO_FLOAT;
+        }
+        const float* p = smp.floatData() + position - 3;
+        return g[0xFF - i] * p[0] + g[0x1FF - i] * p[1] + g[0x100 + i] * p[2] + g[i] * p[3];
+    }
 
-            if (isSample) {
-                // Для сэмплов не крутим индексы по кругу (кроме случая loop, но он выше обработан)
-                // Просто клампим края, чтобы не вылететь за массив
-                // i0 (предыдущий) всегда клампим или враппим если надо (но для кубики кламп безопаснее)
-                if (i0 < 0) {
-                    // Если зациклено - берем с конца, иначе 0
-                    i0 = instrument->loop ? (len - 1) : 0;
-                }
+    // out[k] *= гаусс(позиция + step * k); за блок курсор не выходит за запас после сэмпла
+    void InterpolateRun(float* out, int frames, uint32_t step)
+    {
+        const SampleRef& smp = instrument->data;
+        if (streaming) {
+            // Весь блок вперёд одним окном: дальше цикл тот же, что и для int16 из пула
+            const uint32_t last = position + ((counter + step * (uint32_t)(frames - 1)) >> 12);
+            InterpolateRun(stream.Ensure((int64_t)position - 3, last), PsxAdpcm::TO_FLOAT, out, frames, step);
+        }
+        else if (const int16_t* pcm16 = smp.int16Data())
+            InterpolateRun(pcm16 + position - 3, PsxAdpcm::TO_FLOAT, out, frames, step);
+        else
+            InterpolateRun(smp.floatData() + position - 3, 1.0f, out, frames, step);
+    }
 
-                if (i1 >= len) 
-                    i1 = len - 1;
+    // base - сэмпл position - 3 в формате хранения T; scale переводит его в -1..1
+    template<class T>
+    void InterpolateRun(const T* base, float scale, float* out, int frames, uint32_t step) const
+    {
+        const float* g = SpuGauss::Get().f;
+        uint32_t acc = counter;   // дробная часть + пройденное от position, 4.12
+        int k = 0;
+#ifdef SPU_USE_SSE
+        const __m128 vscale = _mm_set1_ps(scale);
+        const __m128i vmask = _mm_set1_epi32(0xFF);
+        const __m128i vstep4 = _mm_set1_epi32((int)(step * 4));
+        __m128i vacc = _mm_setr_epi32((int)acc, (int)(acc + step), (int)(acc + step * 2), (int)(acc + step * 3));
+        alignas(16) int32_t n[4], ph[4];
+        for (; k + 4 <= frames; k += 4)
+        {
+            _mm_store_si128((__m128i*)n, _mm_srli_epi32(vacc, 12));
+            _mm_store_si128((__m128i*)ph, _mm_and_si128(_mm_srli_epi32(vacc, 4), vmask));
+
+            const T* p0 = base + n[0];
+            const T* p1 = base + n[1];
+            const T* p2 = base + n[2];
+            const T* p3 = base + n[3];
+            const __m128 v0 = _mm_setr_ps((float)p0[0], (float)p1[0], (float)p2[0], (float)p3[0]);
+            const __m128 v1 = _mm_setr_ps((float)p0[1], (float)p1[1], (float)p2[1], (float)p3[1]);
+            const __m128 v2 = _mm_setr_ps((float)p0[2], (float)p1[2], (float)p2[2], (float)p3[2]);
+            const __m128 v3 = _mm_setr_ps((float)p0[3], (float)p1[3], (float)p2[3], (float)p3[3]);
+
+            const __m128 w0 = _mm_setr_ps(g[0xFF - ph[0]], g[0xFF - ph[1]], g[0xFF - ph[2]], g[0xFF - ph[3]]);
+            const __m128 w1 = _mm_setr_ps(g[0x1FF - ph[0]], g[0x1FF - ph[1]], g[0x1FF - ph[2]], g[0x1FF - ph[3]]);
+            const __m128 w2 = _mm_setr_ps(g[0x100 + ph[0]], g[0x100 + ph[1]], g[0x100 + ph[2]], g[0x100 + ph[3]]);
+            const __m128 w3 = _mm_setr_ps(g[ph[0]], g[ph[1]], g[ph[2]], g[ph[3]]);
+
+            __m128 r = _mm_add_ps(_mm_mul_ps(w0, v0), _mm_mul_ps(w1, v1));
+            r = _mm_add_ps(r, _mm_add_ps(_mm_mul_ps(w2, v2), _mm_mul_ps(w3, v3)));
+            _mm_storeu_ps(out + k, _mm_mul_ps(_mm_mul_ps(r, vscale), _mm_loadu_ps(out + k)));
+
+            vacc = _mm_add_epi32(vacc, vstep4);
+        }
+        acc += step * (uint32_t)k;
+#endif
+        for (; k < frames; ++k, acc += step)
+        {
+            const T* p = base + (acc >> 12);
+            const uint32_t i = (acc >> 4) & 0xFF;
+            out[k] *= (g[0xFF - i] * p[0] + g[0x1FF - i] * p[1] + g[0x100 + i] * p[2] + g[i] * p[3]) * scale;
+        }
+    }
+};
 
-                if (instrument->loop) 
-                {
-                    if (i0 < 0) i0 = len - 1;
-                    i1 %= len;
-                    i2 %= len;
-                    i3 %= len;
-                }
-                else 
-                {
-                    if (i0 < 0) i0 = 0;
-                    if (i1 >= len) i1 = len - 1;
-                    if (i2 >= len) i2 = len - 1;
-                    if (i3 >= len) i3 = len - 1;
-                }
-            }
-            else 
-            {
-                // Для синтезатора крутим по кругу
-                if (i1 >= len) i1 %= len;
-                if (i2 >= len) i2 %= len;
-                if (i0 < 0) i0 += len;
-                if (i3 >= len) i3 %= len;
-            }
 
-            // ЧТЕНИЕ ДАННЫХ
-            // ВАЖНО: Убираем деление на 32767 для сэмплов (они уже float)
-            // Для синтезатора оставляем деление, ЕСЛИ он все еще генерирует большие числа (short)
 
-            float y0, y1, y2, y3;
 
-            if (isSample) {
-                // WAV (Float -1..1) 
-                y0 = instrument->data[i0];
-                y1 = instrument->data[i1];
-                y2 = instrument->data[i2];
-                y3 = instrument->data[i3];
-            }
-            else {
-                // Synth (Short -32k..32k) 
-                y0 = instrument->data[i0] / 32767.0f;
-                y1 = instrument->data[i1] / 32767.0f;
-                y2 = instrument->data[i2] / 32767.0f;
-                y3 = instrument->data[i3] / 32767.0f;
-            }
+// Что игра просит у SPU. Применяет аудиопоток в начале блока, в котором наступает frame
+enum class SpuCommandType : uint8_t
+{
+    NoteOn,        // tone, pitch, volume, pan, note, program, channel, bend, gain, pitchScale, fm, bankId -> голос с handle
+    KeyOff,        // голоса handle в release
+    // Дальше bankId - фильтр по банку (SPU_ALL_BANKS - все)
+    ReleaseNote,   // все голоса program + note в release
+    ChannelBend,   // bend (-1..1) для голосов канала channel
+    SetVolumePan,  // голос handle: volume, pan
+    Voice3D,       // все тоны handle: volume - доля громкости NoteOn, pan, pitch - множитель (доплер)
+    StopAll,
+    ReleaseAll,    // все голоса в release (хвосты доигрывают)
+    ReverbMode,    // program = SpuReverbMode
+    ReverbDepth,   // volume
+    SeqPlay,       // track - SEQ, bank - банк, из которого он играет, tick - откуда (передаётся секвенсору)
+    SeqStop,       // SEQ, играющие из bank (nullptr - все)
+    SeqSeek,       // tick - куда
+    VoiceLimit,    // program - источник (SpuVoiceSource), handle - предел голосов
+};
 
-            float frac = sampleCursor - (int)sampleCursor;
-            raw = CubicInterp(y0, y1, y2, y3, frac);
-        }
+struct SpuCommand
+{
+    SpuCommandType type = SpuCommandType::StopAll;
+    uint8_t note = 0;
+    bool fm = false;
+    int8_t bankId = SPU_ALL_BANKS;
+    SpuVoiceSource source = SpuVoiceSource::Sfx;   // NoteOn
+    int32_t program = -1;
+    int8_t channel = -1;     // канал SEQ/тестера; -1 - звук вне каналов
+    float bend = 0.0f;       // NoteOn, ChannelBend: питч-бенд канала -1..1
+    float gain = 1.0f;       // NoteOn: 3D-затухание поверх volume (как Voice3D)
+    float pitchScale = 1.0f; // NoteOn: доплер
+    uint32_t handle = 0;
+    uint64_t frame = 0;      // аудиочасы (сэмплы с запуска потока); 0 - ближайший блок
+    const Tone* tone = nullptr;
+    float pitch = 1.0f;
+    float volume = 1.0f;
+    float pan = 0.5f;
+    // SeqPlay: владелец (AudioSystem) держит трек и банк, пока снимок не покажет применённый StopAll
+    const void* track = nullptr;
+    const void* bank = nullptr;
+    uint32_t tick = 0;
+};
 
-        lastSampleOutput = raw * currentEnvelopeVal;
+class PsxSpu;
 
-        *outL = lastSampleOutput * leftVolume;
-        *outR = lastSampleOutput * rightVolume;
-    }
+/*
+   Секвенсор, который играет внутри колбэка звука: PsxSpu режет блок на куски
+   до ближайшего события, так что нота стартует с точностью до сэмпла,
+   независимо от частоты кадров игры. Все методы вызываются из аудиопотока.
+*/
+class SpuSequencer
+{
+public:
+    virtual ~SpuSequencer() = default;
+    // Кадров до ближайшего события, не больше maxFrames (0 - событие уже наступило)
+    virtual int FramesUntilEvent(int maxFrames) const = 0;
+    virtual void Advance(int frames) = 0;
+    // Наступившие события; голоса меняются сразу через PsxSpu::Apply
+    virtual void FireDue(PsxSpu& spu) = 0;
+    // SeqPlay / SeqStop / SeqSeek из очереди команд
+    virtual void Apply(const SpuCommand& c) = 0;
 };
 
+// Голос глазами игры
+struct SpuVoiceState
+{
+    uint32_t handle = 0;
+    int16_t program = -1;
+    int8_t bankId = SPU_ALL_BANKS;
+    uint8_t note = 0;
+    uint8_t phase = ADSR_IDLE;
+    float envelope = 0.0f;
+};
 
+// Счётчики распределителя голосов по источнику - для настройки пределов
+struct SpuVoiceStats
+{
+    uint16_t active = 0;
+    uint16_t peak = 0;
+    uint32_t started = 0;
+    uint32_t stolen = 0;     // у источника отняли звучащий голос
+    uint32_t dropped = 0;    // нота источника не получила голос
+};
 
+// Снимок, который аудиопоток публикует после каждого колбэка
+struct SpuSnapshot
+{
+    SpuVoiceState voices[SPU_VOICES_COUNT];
+    SpuVoiceStats stats[SPU_SOURCE_COUNT];
+    uint64_t frame = 0;              // аудиочасы на конец колбэка
+    uint64_t appliedCommands = 0;    // сколько команд применено с начала
+    uint32_t lastHandle = 0;         // последний запущенный NoteOn
+    int activeCount = 0;
+};
 
+/*
+   Голоса принадлежат аудиопотоку (колбэк raylib). Главный поток их не трогает:
+   PlayNote/StopVoice/SetVoice3D/... кладут команду в очередь без блокировок,
+   а состояние голосов читают из снимка (GetSnapshot). Ноту адресует handle,
+   который PlayNote выдаёт сразу, - номер голоса выбирается уже при запуске.
+*/
 class PsxSpu 
 {
 public:
     unsigned long RateTable[160];
     
     inline static PsxSpu* instance = nullptr;
-    
-    int sfxCursor = 0;
 
     SpuVoice voices[SPU_VOICES_COUNT];
-    AudioStream stream;
-    float* reverbBuffer;
-    int reverbCursor = 0, reverbSize = 0;
+    AudioStream stream = {};   // без InitAudioSystem (офлайн-рендер) потока нет
+    SpuReverb reverb;
    // float masterVolume = 0.75f;
-    float reverbMix = 0.25f;
-    float reverbDecay = 0.4f; // PS1 reverb was quite long
+    float reverbMix = 0.25f;   // громкость выхода реверба (vLOUT/vROUT)
     int currentBufferSize = 1024;//1024;
     int currentVoiceIndex = 0;
 
     bool voiceFmFlags[SPU_VOICES_COUNT] = { false };
-
-
-    PsxSpu() {
+    std::unique_ptr<int16_t[]> streamWindows;
+
+    // Распределитель голосов (аудиопоток): бит на свободный голос, пределы и счётчики по источникам
+    uint64_t freeVoices[(SPU_VOICES_COUNT + 63) / 64] = {};
+    int voiceLimit[SPU_SOURCE_COUNT];
+    SpuVoiceStats voiceStats[SPU_SOURCE_COUNT];
+
+    // Рабочие буферы блочного микшера
+    int activeVoices[SPU_VOICES_COUNT];
+    int activeCount = 0;
+    alignas(16) float voiceBlock[2][SPU_BLOCK_FRAMES];
+    alignas(16) float mixL[SPU_BLOCK_FRAMES];
+    alignas(16) float mixR[SPU_BLOCK_FRAMES];
+    alignas(16) float wetL[SPU_BLOCK_FRAMES];
+    alignas(16) float wetR[SPU_BLOCK_FRAMES];
+
+    // Главный поток -> аудиопоток и обратно
+    SpscQueue<SpuCommand, SPU_COMMAND_QUEUE> commands;
+    SnapshotBuffer<SpuSnapshot> snapshots;
+    uint64_t postedCommands = 0;     // главный поток
+    uint32_t nextHandle = 0;         // главный поток
+    uint64_t appliedCommands = 0;    // аудиопоток
+    uint32_t lastHandle = 0;         // аудиопоток
+    uint64_t audioFrame = 0;         // аудиопоток
+    SpuSequencer* sequencer = nullptr;
+
+
+    PsxSpu() : streamWindows(new int16_t[(size_t)SPU_VOICES_COUNT * SPU_STREAM_WINDOW]) {
+        reverb.SetMode(SPU_DEFAULT_REVERB);
+        // Окна потокового ADPCM: выделяются здесь, а не в аудиопотоке на NoteOn
+        for (int v = 0; v < SPU_VOICES_COUNT; v++)
+            voices[v].stream.Attach(streamWindows.get() + (size_t)v * SPU_STREAM_WINDOW, SPU_STREAM_WINDOW);
+        for (int v = 0; v < SPU_VOICES_COUNT; v++)
+            freeVoices[v >> 6] |= 1ull << (v & 63);
+        for (int s = 0; s < SPU_SOURCE_COUNT; s++)
+            voiceLimit[s] = SPU_DEFAULT_VOICE_LIMIT[s];
     }
 
     ~PsxSpu()
@@ -352,11 +967,6 @@ public:
             SetAudioStreamCallback(stream, nullptr);
             UnloadAudioStream(stream);
         }
-        if (reverbBuffer) {
-            free(reverbBuffer);
-            reverbBuffer = nullptr;
-        }
-
         instance = nullptr;
     }
 
@@ -402,71 +1012,393 @@ public:
         SetAudioStreamBufferSizeDefault(currentBufferSize);
         stream = LoadAudioStream(SPU_SAMPLE_RATE, 16, 2);
 
-        reverbSize = (int)(SPU_SAMPLE_RATE * 0.35f);
-        if (reverbBuffer != nullptr) free(reverbBuffer);
-        reverbBuffer = (float*)calloc(reverbSize * 2, sizeof(float));
-        reverbCursor = 0;
+        PrepareMixer();
 
         instance = this;
         SetAudioStreamCallback(stream, AudioCallbackWrapper);
 
         PlayAudioStream(stream);
+    }
+
+    // Без звукового устройства: GenerateAudio зовёт сам владелец (офлайн-рендер)
+    void InitOffline()
+    {
+        PrepareMixer();
+    }
 
+    void PrepareMixer()
+    {
+        reverb.Clear();
+        SpuGauss::Get(); // таблица строится здесь, а не в первом колбэке звука
         initADSR();
     }
 
-    void StopAllVoices()
+    // ===== Главный поток =====
+
+    // Нота на свободный голос; возвращает handle (0 - очередь переполнена, нота потеряна)
+    uint32_t PlayNote(const Tone* inst, float pitch, float volume, bool fmEnabled, float pan, int note, int progID, uint64_t atFrame = 0)
     {
-        for (int i = 0; i < SPU_VOICES_COUNT; i++) {
-            voices[i].active = false;
-            voices[i].state = ADSR_IDLE;
-            voices[i].instrument = nullptr; 
+        SpuCommand c;
+        c.type = SpuCommandType::NoteOn;
+        c.tone = inst;
+        c.pitch = pitch;
+        c.volume = volume;
+        c.fm = fmEnabled;
+        c.pan = pan;
+        c.note = (uint8_t)note;
+        c.program = progID;
+        c.frame = atFrame;
+        if (++nextHandle == 0) nextHandle = 1;
+        c.handle = nextHandle;
+        return Post(c) ? c.handle : 0;
+    }
+
+    // Готовая NoteOn (VabBank::MakeNoteOn + bankId); возвращает handle.
+    // c.handle != 0 - тон того же звука, что и прошлая нота с этим handle
+    uint32_t PlayNote(SpuCommand c)
+    {
+        c.type = SpuCommandType::NoteOn;
+        if (c.handle == 0) {
+            if (++nextHandle == 0) nextHandle = 1;
+            c.handle = nextHandle;
         }
+        return Post(c) ? c.handle : 0;
     }
 
+    void StopVoice(uint32_t handle)
+    {
+        SpuCommand c;
+        c.type = SpuCommandType::KeyOff;
+        c.handle = handle;
+        Post(c);
+    }
 
-    int PlayNote(const Tone* inst, float pitch, float volume, bool fmEnabled, float pan, int note, int progID)
+    void SetVoice3D(uint32_t handle, float volume, float pan)
     {
-        int id = -1;
-        for (int i = 0; i < SPU_VOICES_COUNT; i++) {
-            if (!voices[i].active || voices[i].state == ADSR_IDLE) {
-                id = i;
-                break;
-            }
+        SpuCommand c;
+        c.type = SpuCommandType::SetVolumePan;
+        c.handle = handle;
+        c.volume = volume;
+        c.pan = pan;
+        Post(c);
+    }
+
+    // Позиционный звук: gain к громкости NoteOn, pan 0..1, pitchScale - доплер; для всех тонов handle
+    void SetVoice3D(uint32_t handle, float gain, float pan, float pitchScale)
+    {
+        SpuCommand c;
+        c.type = SpuCommandType::Voice3D;
+        c.handle = handle;
+        c.volume = gain;
+        c.pan = pan;
+        c.pitch = pitchScale;
+        Post(c);
+    }
+
+    // Key off по ноте программы (SEQ)
+    void ReleaseNote(int program, int note, int bankId = SPU_ALL_BANKS)
+    {
+        SpuCommand c;
+        c.type = SpuCommandType::ReleaseNote;
+        c.program = program;
+        c.note = (uint8_t)note;
+        c.bankId = (int8_t)bankId;
+        Post(c);
+    }
+
+    // Питч-бенд -1..1 (диапазон 2 полутона) для всех голосов канала
+    void SetChannelBend(int channel, float bend, int bankId = SPU_ALL_BANKS)
+    {
+        SpuCommand c;
+        c.type = SpuCommandType::ChannelBend;
+        c.channel = (int8_t)channel;
+        c.bend = bend;
+        c.bankId = (int8_t)bankId;
+        Post(c);
+    }
+
+    void ReleaseAllVoices(int bankId = SPU_ALL_BANKS)
+    {
+        SpuCommand c;
+        c.type = SpuCommandType::ReleaseAll;
+        c.bankId = (int8_t)bankId;
+        Post(c);
+    }
+
+    // Мгновенно, без release. Пока команда не применена, голоса ещё читают старые тоны:
+    // банк можно освобождать, когда снимок покажет appliedCommands >= GetPostedCount()
+    void StopAllVoices(int bankId = SPU_ALL_BANKS)
+    {
+        SpuCommand c;
+        c.type = SpuCommandType::StopAll;
+        c.bankId = (int8_t)bankId;
+        Post(c);
+    }
+
+    // Сколько голосов может занять источник; сверх предела он отнимает свой же самый тихий
+    void SetVoiceLimit(SpuVoiceSource source, int limit)
+    {
+        SpuCommand c;
+        c.type = SpuCommandType::VoiceLimit;
+        c.program = (int32_t)source;
+        c.handle = (uint32_t)std::clamp(limit, 0, SPU_VOICES_COUNT);
+        Post(c);
+    }
+
+    const SpuVoiceStats& GetVoiceStats(SpuVoiceSource source) { return GetSnapshot().stats[(int)source]; }
+
+    void SetReverbMode(SpuReverbMode mode)
+    {
+        SpuCommand c;
+        c.type = SpuCommandType::ReverbMode;
+        c.program = (int32_t)mode;
+        Post(c);
+    }
+
+    void SetReverbDepth(float depth)
+    {
+        SpuCommand c;
+        c.type = SpuCommandType::ReverbDepth;
+        c.volume = depth;
+        Post(c);
+    }
+
+    // Звучит ли нота: по последнему снимку; ещё не запущенная считается звучащей
+    bool IsSoundPlaying(uint32_t handle)
+    {
+        if (handle == 0) return false;
+        const SpuSnapshot& snap = GetSnapshot();
+        if ((int32_t)(handle - snap.lastHandle) > 0) return true;
+        for (const auto& v : snap.voices)
+            if (v.handle == handle) return v.phase != ADSR_IDLE;
+        return false;
+    }
+
+    const SpuSnapshot& GetSnapshot() { return snapshots.Read(); }
+    // До InitAudioSystem: потом секвенсор принадлежит колбэку
+    void SetSequencer(SpuSequencer* seq) { sequencer = seq; }
+    uint64_t GetPostedCount() const { return postedCommands; }
+
+    bool Post(const SpuCommand& c)
+    {
+        if (!commands.Push(c)) {
+            TraceLog(LOG_WARNING, "SPU: command queue is full, command %d dropped", (int)c.type);
+            return false;
         }
-        if (id == -1) 
+        ++postedCommands;
+        return true;
+    }
+
+    // ===== Аудиопоток =====
+
+    void GenerateAudio(short* buffer, unsigned int frames) 
+    {
+        if (frames > MAX_AUDIO_BUFFER) frames = MAX_AUDIO_BUFFER;
+        float dt = 1.0f / SPU_SAMPLE_RATE;
+        for (unsigned int done = 0; done < frames; done += SPU_BLOCK_FRAMES)
         {
-            for (int i = 0; i < SPU_VOICES_COUNT; i++) 
+            const int count = (int)std::min<unsigned int>(SPU_BLOCK_FRAMES, frames - done);
+            ApplyCommands(audioFrame + count);
+            if (!sequencer) {
+                MixBlock(buffer + done * 2, count, dt);
+                audioFrame += count;
+                continue;
+            }
+            // Блок режется на события секвенсора: до события - голоса как были, в точке события - новые ноты
+            int k = 0;
+            while (k < count)
             {
-                if (voices[i].state == ADSR_RELEASE)
-                {
-                    id = i;
-                    break;
-                }
+                sequencer->FireDue(*this);
+                const int span = std::max(1, sequencer->FramesUntilEvent(count - k));
+                MixBlock(buffer + (done + k) * 2, span, dt);
+                sequencer->Advance(span);
+                k += span;
+            }
+            audioFrame += count;
+        }
+        PublishSnapshot();
+    }
+
+    // Всё, что должно случиться до конца блока (команды идут по порядку - позднюю ждут и следующие)
+    void ApplyCommands(uint64_t blockEnd)
+    {
+        while (const SpuCommand* c = commands.Peek())
+        {
+            if (c->frame >= blockEnd) break;
+            Apply(*c);
+            commands.Pop();
+            ++appliedCommands;
+        }
+    }
+
+    void Apply(const SpuCommand& c)
+    {
+        switch (c.type)
+        {
+        case SpuCommandType::NoteOn:
+            StartVoice(c);
+            if (c.handle) lastHandle = c.handle;   // ноты секвенсора идут без handle
+            break;
+        case SpuCommandType::KeyOff:
+            if (c.handle == 0) break;
+            for (auto& v : voices)
+                if (v.active && v.handle == c.handle) v.NoteOff();
+            break;
+        case SpuCommandType::SetVolumePan:
+            if (SpuVoice* v = FindVoice(c.handle)) v->SetVolumeAndPan(c.volume, c.pan);
+            break;
+        case SpuCommandType::Voice3D:
+            if (c.handle == 0) break;
+            for (auto& v : voices) {
+                if (!v.active || v.handle != c.handle) continue;
+                v.SetVolumeAndPan(v.noteVolume * c.volume, c.pan);
+                v.pitchScale = c.pitch;
             }
-            if (id == -1) {
-                id = sfxCursor;
-                sfxCursor = (sfxCursor + 1) % SPU_VOICES_COUNT;
-                 printf("all voices are busy!\n"); 
+            break;
+        case SpuCommandType::ReleaseNote:
+            for (auto& v : voices)
+                if (v.active && InBank(v, c) && v.parentProgramID == c.program && v.currentNote == c.note)
+                    v.NoteOff(); // Теперь голос уйдет в Release
+            break;
+        case SpuCommandType::ChannelBend:
+            if (c.channel < 0) break;
+            for (int i = 0; i < SPU_VOICES_COUNT; i++)
+                if (voices[i].active && InBank(voices[i], c) && voices[i].channel == c.channel)
+                    UpdateVoicePitch(i, c.bend);
+            break;
+        case SpuCommandType::StopAll:
+            for (int i = 0; i < SPU_VOICES_COUNT; i++) {
+                SpuVoice& v = voices[i];
+                if (!InBank(v, c)) continue;
+                FreeVoice(i);
+                v.envelope.phase = ADSR_IDLE;
+                v.instrument = nullptr;
+                v.handle = 0;
             }
+            break;
+        case SpuCommandType::VoiceLimit:
+            if (c.program >= 0 && c.program < SPU_SOURCE_COUNT)
+                voiceLimit[c.program] = (int)c.handle;
+            break;
+        case SpuCommandType::ReleaseAll:
+            for (auto& v : voices)
+                if (v.active && InBank(v, c)) v.NoteOff();
+            break;
+        case SpuCommandType::ReverbMode:
+            reverb.SetMode((SpuReverbMode)c.program);
+            break;
+        case SpuCommandType::ReverbDepth:
+            reverbMix = c.volume;
+            break;
+        case SpuCommandType::SeqPlay:
+        case SpuCommandType::SeqStop:
+        case SpuCommandType::SeqSeek:
+            if (sequencer) sequencer->Apply(c);
+            break;
+        }
+    }
+
+    static bool InBank(const SpuVoice& v, const SpuCommand& c)
+    {
+        return c.bankId == SPU_ALL_BANKS || v.bankId == c.bankId;
+    }
+
+    int StartVoice(const SpuCommand& c)
+    {
+        const int src = (int)c.source;
+        const int id = AcquireVoice(c.source);
+        if (id < 0) {
+            // Все голоса заняты источниками важнее - нота теряется, без printf в колбэке
+            ++voiceStats[src].dropped;
+            return -1;
+        }
+        if (!IsFree(id)) {
+            ++voiceStats[(int)voices[id].source].stolen;
+            FreeVoice(id);
         }
+
+        freeVoices[id >> 6] &= ~(1ull << (id & 63));
+        SpuVoiceStats& st = voiceStats[src];
+        ++st.started;
+        if (++st.active > st.peak) st.peak = st.active;
+
         voices[id].active = false; 
-        voices[id].NoteOn(inst, pitch, volume, pan, note, progID);
-        voiceFmFlags[id] = fmEnabled;
+        voices[id].NoteOn(c.tone, c.pitch, c.volume, c.pan, c.note, c.program);
+        voices[id].channel = c.channel;
+        if (c.bend != 0.0f) UpdateVoicePitch(id, c.bend);   // нота под уже отжатым бендом канала
+        // Позиционный звук стартует сразу со своей громкостью, панорамой и доплером
+        if (c.gain != 1.0f) voices[id].SetVolumeAndPan(c.volume * c.gain, c.pan);
+        voices[id].pitchScale = c.pitchScale;
+        voices[id].handle = c.handle;
+        voices[id].bankId = c.bankId;
+        voices[id].source = c.source;
+        voices[id].startFrame = audioFrame;
+        voiceFmFlags[id] = c.fm;
 
         return id;
     }
 
-    void StopVoice(int id) { if (id >= 0 && id < SPU_VOICES_COUNT) voices[id].NoteOff(); }
+    bool IsFree(int id) const { return (freeVoices[id >> 6] >> (id & 63)) & 1; }
 
-    bool IsSoundPlaying(int id) { if (id >= 0 && id < SPU_VOICES_COUNT) return voices[id].IsNotePlaying(); return -1; }
+    // Голос снова свободен (доиграл, снят или отнят)
+    void FreeVoice(int id)
+    {
+        voices[id].active = false;
+        if (IsFree(id)) return;
+        freeVoices[id >> 6] |= 1ull << (id & 63);
+        --voiceStats[(int)voices[id].source].active;
+    }
 
-    void SetVoice3D(int voiceId, float volume, float pan) {
-        if (voiceId >= 0 && voiceId < SPU_VOICES_COUNT) {
-            if (voices[voiceId].active) {
-                voices[voiceId].SetVolumeAndPan(volume, pan);
+    // Свободный голос с младшим номером (как раньше - FM берёт соседа снизу) или отнятый; -1 - нет
+    int AcquireVoice(SpuVoiceSource source)
+    {
+        if (voiceStats[(int)source].active >= voiceLimit[(int)source])
+            return StealVoice(source, true);
+        if (freeVoices[0]) return std::countr_zero(freeVoices[0]);
+        if (freeVoices[1]) return 64 + std::countr_zero(freeVoices[1]);
+        return StealVoice(source, false);
+    }
+
+    // Кого отнять: голос в release -> источник ниже -> тише огибающая -> старше.
+    // ownOnly - источник упёрся в свой предел и отдаёт свой же голос
+    int StealVoice(SpuVoiceSource source, bool ownOnly)
+    {
+        int best = -1;
+        bool bestReleasing = false;
+        int bestSource = 0;
+        float bestLevel = 0.0f;
+        uint64_t bestFrame = 0;
+        for (int i = 0; i < SPU_VOICES_COUNT; i++) {
+            if (IsFree(i)) continue;
+            const SpuVoice& v = voices[i];
+            if (ownOnly ? v.source != source : v.source > source) continue;
+
+            const bool releasing = v.envelope.phase == ADSR_RELEASE;
+            const int src = (int)v.source;
+            const float level = v.currentEnvelopeVal * std::max(v.leftVolume, v.rightVolume);
+            bool better;
+            if (best < 0) better = true;
+            else if (releasing != bestReleasing) better = releasing;
+            else if (src != bestSource) better = src < bestSource;
+            else if (level != bestLevel) better = level < bestLevel;
+            else better = v.startFrame < bestFrame;
+            if (better) {
+                best = i;
+                bestReleasing = releasing;
+                bestSource = src;
+                bestLevel = level;
+                bestFrame = v.startFrame;
             }
         }
+        return best;
+    }
+
+    SpuVoice* FindVoice(uint32_t handle)
+    {
+        if (handle == 0) return nullptr;
+        for (auto& v : voices)
+            if (v.active && v.handle == handle) return &v;
+        return nullptr;
     }
 
     void UpdateVoicePitch(int vIdx, float bend) {
@@ -477,53 +1409,137 @@ public:
         }
     }
 
-    void GenerateAudio(short* buffer, unsigned int frames) 
+    void PublishSnapshot()
     {
-        if (frames > MAX_AUDIO_BUFFER) frames = MAX_AUDIO_BUFFER;
-        float dt = 1.0f / SPU_SAMPLE_RATE;
-        for (int i = 0; i < frames; i++)
+        SpuSnapshot& snap = snapshots.Back();
+        snap.activeCount = 0;
+        for (int i = 0; i < SPU_VOICES_COUNT; i++) {
+            const SpuVoice& v = voices[i];
+            SpuVoiceState& st = snap.voices[i];
+            const bool playing = v.active && v.envelope.phase != ADSR_IDLE;
+            st.handle = v.handle;
+            st.program = (int16_t)v.parentProgramID;
+            st.bankId = (int8_t)v.bankId;
+            st.note = v.currentNote;
+            st.phase = playing ? (uint8_t)v.envelope.phase : (uint8_t)ADSR_IDLE;
+            st.envelope = playing ? v.currentEnvelopeVal : 0.0f;
+            snap.activeCount += playing;
+        }
+        for (int s = 0; s < SPU_SOURCE_COUNT; s++)
+            snap.stats[s] = voiceStats[s];
+        snap.frame = audioFrame;
+        snap.appliedCommands = appliedCommands;
+        snap.lastHandle = lastHandle;
+        snapshots.Publish();
+    }
+
+    // Голоса по одному на весь блок (voice-major), затем общая шина: реверб + мягкий клип
+    void MixBlock(short* out, int frames, float dt)
+    {
+        // Компактный список звучащих голосов - дальше по всем 127 не ходим
+        activeCount = 0;
+        for (int v = 0; v < SPU_VOICES_COUNT; v++)
+            if (voices[v].active) activeVoices[activeCount++] = v;
+
+        std::fill(mixL, mixL + frames, 0.0f);
+        std::fill(mixR, mixR + frames, 0.0f);
+
+        // Два блока по очереди: предыдущий голос остаётся целым для FM следующего
+        int current = 0;
+        int prevRendered = -1;
+        for (int n = 0; n < activeCount; n++)
         {
-            float mL = 0, mR = 0;
+            const int v = activeVoices[n];
+            float* block = voiceBlock[current];
+
+            const float* mod = nullptr;
+            float modConst = 0.0f;
+            if (voiceFmFlags[v]) {
+                int prevV = (v - 1);
+                if (prevV < 0) prevV = SPU_VOICES_COUNT - 1;
+                if (prevV == prevRendered) mod = voiceBlock[current ^ 1];
+                else if (voices[prevV].active) modConst = voices[prevV].lastSampleOutput;
+            }
 
-            for (int v = 0; v < SPU_VOICES_COUNT; v++)
-            {
-                if (voices[v].active)
-                {
-                    float l, r;
-
-                    float modIn = 0.0f;
-                    int prevV = (v - 1);
-                    if (prevV < 0) prevV = SPU_VOICES_COUNT - 1;
-
-                    // Если FM включен для этого голоса, берем сэмпл соседа
-                    if (voiceFmFlags[v] && voices[prevV].active)
-                    {
-                        modIn = voices[prevV].lastSampleOutput;
-                    }
+            voices[v].RenderBlock(block, frames, dt, mod, modConst);
+            AccumulateVoice(block, frames, voices[v].leftVolume, voices[v].rightVolume);
+            if (!voices[v].active || voices[v].envelope.phase == ADSR_IDLE)
+                FreeVoice(v);
 
-                    voices[v].GetSamples(&l, &r, dt, modIn);
-                    mL += l; mR += r;
-                }
-            }
+            prevRendered = v;
+            current ^= 1;
+        }
 
+        MasterBus(out, frames);
+    }
 
-            float rL = reverbBuffer[reverbCursor * 2], rR = reverbBuffer[reverbCursor * 2 + 1];
-            float fL = mL + rL * reverbMix, fR = mR + rR * reverbMix;
-            reverbBuffer[reverbCursor * 2] = fL * reverbDecay;
-            reverbBuffer[reverbCursor * 2 + 1] = fR * reverbDecay;
-            reverbCursor = (reverbCursor + 1) % reverbSize;
+    void AccumulateVoice(const float* block, int frames, float left, float right)
+    {
+        int k = 0;
+#ifdef SPU_USE_SSE
+        const __m128 gl = _mm_set1_ps(left), gr = _mm_set1_ps(right);
+        for (; k + 4 <= frames; k += 4) {
+            const __m128 s = _mm_loadu_ps(block + k);
+            _mm_store_ps(mixL + k, _mm_add_ps(_mm_load_ps(mixL + k), _mm_mul_ps(s, gl)));
+            _mm_store_ps(mixR + k, _mm_add_ps(_mm_load_ps(mixR + k), _mm_mul_ps(s, gr)));
+        }
+#endif
+        for (; k < frames; k++) {
+            mixL[k] += block[k] * left;
+            mixR[k] += block[k] * right;
+        }
+    }
 
-            fL = tanhf(fL * 0.6f) / 0.6f;
-            fR = tanhf(fR * 0.6f) / 0.6f;
+    // Мягкое насыщение tanh(x * 0.6) / 0.6 через рациональное приближение (точно в 0 и при |x*0.6| >= 3)
+    static float SoftClip(float x)
+    {
+        float t = x * 0.6f;
+        if (t > 3.0f) t = 3.0f; else if (t < -3.0f) t = -3.0f;
+        const float t2 = t * t;
+        return t * (27.0f + t2) / (27.0f + 9.0f * t2) / 0.6f;
+    }
+
+    void MasterBus(short* out, int frames)
+    {
+        // Реверб блоком на 22.05 кГц, затем сухой + мокрый, клип и упаковка в int16
+        reverb.Process(mixL, mixR, wetL, wetR, frames);
+
+        int k = 0;
+#ifdef SPU_USE_SSE
+        const __m128 mix = _mm_set1_ps(reverbMix);
+        const __m128 drive = _mm_set1_ps(0.6f), invDrive = _mm_set1_ps(1.0f / 0.6f);
+        const __m128 lim = _mm_set1_ps(3.0f), one = _mm_set1_ps(1.0f);
+        const __m128 c27 = _mm_set1_ps(27.0f), c9 = _mm_set1_ps(9.0f), scale = _mm_set1_ps(32000.0f);
+        for (; k + 4 <= frames; k += 4)
+        {
+            const __m128 l = _mm_add_ps(_mm_load_ps(mixL + k), _mm_mul_ps(_mm_load_ps(wetL + k), mix));
+            const __m128 r = _mm_add_ps(_mm_load_ps(mixR + k), _mm_mul_ps(_mm_load_ps(wetR + k), mix));
+            __m128 m[2] = { _mm_unpacklo_ps(l, r), _mm_unpackhi_ps(l, r) };   // L0 R0 L1 R1 | L2 R2 L3 R3
+            __m128i pcm[2];
+            for (int h = 0; h < 2; ++h)
+            {
+                __m128 t = _mm_mul_ps(m[h], drive);
+                t = _mm_max_ps(_mm_min_ps(t, lim), _mm_sub_ps(_mm_setzero_ps(), lim));
+                const __m128 t2 = _mm_mul_ps(t, t);
+                __m128 f = _mm_div_ps(_mm_mul_ps(t, _mm_add_ps(c27, t2)), _mm_add_ps(c27, _mm_mul_ps(c9, t2)));
+                f = _mm_mul_ps(f, invDrive);
+                f = _mm_max_ps(_mm_min_ps(f, one), _mm_sub_ps(_mm_setzero_ps(), one));
+                pcm[h] = _mm_cvttps_epi32(_mm_mul_ps(f, scale));
+            }
+            _mm_storeu_si128((__m128i*)(out + k * 2), _mm_packs_epi32(pcm[0], pcm[1]));
+        }
+#endif
+        for (; k < frames; k++)
+        {
+            float fL = SoftClip(mixL[k] + wetL[k] * reverbMix);
+            float fR = SoftClip(mixR[k] + wetR[k] * reverbMix);
 
             if (fL > 1.0f) fL = 1.0f; else if (fL < -1.0f) fL = -1.0f;
             if (fR > 1.0f) fR = 1.0f; else if (fR < -1.0f) fR = -1.0f;
 
-
-            buffer[i * 2] = (short)(fL * 32000);
-            buffer[i * 2 + 1] = (short)(fR * 32000);
+            out[k * 2] = (short)(fL * 32000);
+            out[k * 2 + 1] = (short)(fR * 32000);
         }
-
     }
 
     inline int roundToZero(int val) {
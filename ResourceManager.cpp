@@ -1,9 +1,25 @@
 ﻿#include "ResourceManager.h"
 #include <iostream>
+#include <tuple>
 #include "TextureDB.h"
+#include "TMDModel.h"
+#include "MorphAnimation.h"
+#include "utilities.h"
+#include "GameContext.h"
 
 std::unordered_map<std::string, std::shared_ptr<TextureDB>> ResourceManager::kftexture_;
 std::unordered_map<std::string, std::shared_ptr<TFile>> ResourceManager::tfiles_;
+std::unordered_map<std::string, std::shared_ptr<Model>> ResourceManager::kfmodels_;
+std::unordered_map<std::string, std::shared_ptr<MorphModel>> ResourceManager::kfmorphs_;
+std::vector<ResourceManager::VramTexture> ResourceManager::vramTextures_;
+std::unordered_map<std::string, GpuUploadQueue::CancelToken> ResourceManager::inFlight_;
+std::unordered_map<std::string, std::vector<ResourceManager::VramTexture>> ResourceManager::kfTextureSlots_;
+std::unordered_map<std::string, std::vector<TMDModel::MeshGroup>> ResourceManager::kfModelGroups_;
+std::unordered_set<std::string> ResourceManager::retained_;
+std::vector<ResourceManager::TextureBinding> ResourceManager::pendingBindings_;
+GpuUploadQueue::CancelToken ResourceManager::levelCancel_ = GpuUploadQueue::MakeCancelToken();
+std::mutex ResourceManager::mutex_;
+int16_t ResourceManager::languageID_ = 0;
 
 std::unordered_map<std::string, std::shared_ptr<Texture2D>> ResourceManager::textures_;
 std::unordered_map<std::string, std::shared_ptr<Model>> ResourceManager::models_;
@@ -14,18 +30,65 @@ std::unordered_map<std::string, std::shared_ptr<Music>> ResourceManager::musics_
 std::unordered_map<std::string, std::shared_ptr<Font>> ResourceManager::fonts_;
 
 
+namespace
+{
+    std::shared_ptr<Model> MakeKFModelPtr(const Model& model)
+    {
+        return std::shared_ptr<Model>(new Model(model), [](Model* m) {
+            if (m) {
+                // Текстуры принадлежат кешу VRAM, выгружаем только меши
+                if (m->materials) {
+                    for (int i = 0; i < m->materialCount; i++) {
+                        m->materials[i].maps[MATERIAL_MAP_DIFFUSE].texture.id = 1;
+                    }
+                }
+                if (m->meshCount > 0 && m->meshes != nullptr) {
+                    UnloadModel(*m);
+                }
+                delete m;
+            }
+            });
+    }
+
+    // Модель ещё не была в GPU (отмена на рабочем потоке) - только память CPU, без вызовов GL
+    void FreeModelCpu(Model& m)
+    {
+        for (int i = 0; i < m.meshCount; i++) {
+            RL_FREE(m.meshes[i].vertices);
+            RL_FREE(m.meshes[i].normals);
+            RL_FREE(m.meshes[i].texcoords);
+            RL_FREE(m.meshes[i].colors);
+            RL_FREE(m.meshes[i].indices);
+        }
+        for (int i = 0; i < m.materialCount; i++)
+            RL_FREE(m.materials[i].maps);
+        RL_FREE(m.meshes);
+        RL_FREE(m.materials);
+        RL_FREE(m.meshMaterial);
+        m = Model{ 0 };
+    }
+}
+
+
 std::shared_ptr<Model> ResourceManager::GetModelByIndex(int index)
 {
-	return std::shared_ptr<Model>();
+    // Draw3dPreview: ReadFromFile(6, item_id) - архив 6 это ITEM<язык>.T, индекс файла = id предмета
+    return LoadKFModel("./CD/COM/ITEM" + std::to_string(languageID_) + ".T", index);
 }
 
 std::shared_ptr<Texture2D> ResourceManager::GetTextureByVram(int x, int y)
 {
-	return std::shared_ptr<Texture2D>();
+    // Пока текстура не загружена в GPU, в слоте лежит заглушка
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& tex : vramTextures_) {
+        if (tex.x == x && tex.y == y) return tex.slot;
+    }
+    return nullptr;
 }
 
 void ResourceManager::LoadGameDatabases(const int16_t LanguageID)
 {
+    languageID_ = LanguageID;
     ResourceManager::LoadTFile("./CD/COM/MO.T");
     ResourceManager::LoadTFile("./CD/COM/TALK" + std::to_string(LanguageID) + ".T");
     ResourceManager::LoadTFile("./CD/COM/VAB.T");
@@ -38,18 +101,23 @@ void ResourceManager::LoadGameDatabases(const int16_t LanguageID)
 std::shared_ptr<TFile> ResourceManager::LoadTFile(const std::string& path)
 {
     // Если архив уже загружен, возвращаем его
-    auto it = tfiles_.find(path);
-    if (it != tfiles_.end()) {
-        return it->second;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = tfiles_.find(path);
+        if (it != tfiles_.end()) {
+            return it->second;
+        }
     }
     printf("LoadTFile: load new..\n");
-    // Иначе создаем новый, загружаем и кешируем
+    // Иначе создаем новый, загружаем и кешируем.
+    // Чтение идёт без блокировки, чтобы не держать остальные потоки; если архив успели
+    // загрузить параллельно - отдаём тот, что уже в кеше
     auto tfile = std::make_shared<TFile>(path);
-    tfiles_[path] = tfile;
-    return tfile;
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tfiles_.emplace(path, tfile).first->second;
 }
 
-std::shared_ptr<TextureDB> ResourceManager::LoadKFTextures(const std::string& path, int index)
+std::shared_ptr<TextureDB> ResourceManager::LoadKFTextures(const std::string& path, int index, UploadPriority priority, GpuUploadQueue::CancelToken cancel)
 {
     // 0. Защита от дурака
     if (index < 0)
@@ -63,9 +131,12 @@ std::shared_ptr<TextureDB> ResourceManager::LoadKFTextures(const std::string& pa
     std::string cacheKey = path + "_" + std::to_string(index);
 
     // 2. Проверяем кеш готовых текстур
-    auto it = kftexture_.find(cacheKey);
-    if (it != kftexture_.end()) {
-        return it->second;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = kftexture_.find(cacheKey);
+        if (it != kftexture_.end()) {
+            return it->second;
+        }
     }
 
     // 3. Получаем сам архив (он тоже кешируется внутри LoadTFile)
@@ -100,12 +171,429 @@ std::shared_ptr<TextureDB> ResourceManager::LoadKFTextures(const std::string& pa
         printf("WARNING: File %d identified as texture but parsing failed.\n", index);
         return nullptr;
     }
-   
-    // 8. Сохраняем в кеш и возвращаем
-    kftexture_[cacheKey] = textureDB;
+
+    // Уровень успели выгрузить, пока шла распаковка
+    if (GpuUploadQueue::IsCancelled(cancel)) return nullptr;
+
+    // 8. Сохраняем в кеш (если параллельно уже распаковали - берём готовое)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto inserted = kftexture_.emplace(cacheKey, textureDB);
+        if (!inserted.second) return inserted.first->second;
+    }
+
+    // 9. В GPU текстуры уходят через очередь, до загрузки в слотах VRAM лежит заглушка
+    QueueTextureUploads(*textureDB, cacheKey, priority, cancel);
+
+    // Отменили, пока кешировали: CancelKF мог пройти раньше - задания пропустятся, заглушки не оставляем
+    if (GpuUploadQueue::IsCancelled(cancel)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        DropPendingTextures(cacheKey);
+        return nullptr;
+    }
     return textureDB;
 }
 
+void ResourceManager::RequestKFTextures(const std::string& path, int index, UploadPriority priority, GpuUploadQueue::CancelToken cancel)
+{
+    std::string cacheKey = path + "_" + std::to_string(index);
+    if (!BeginRequest(cacheKey, kftexture_, cancel)) return;
+
+    Game::g_UploadQueue.Decode(priority, [path, index, priority, cancel, cacheKey]() {
+        LoadKFTextures(path, index, priority, cancel);
+        EndRequest(cacheKey);
+        }, cancel);
+}
+
+void ResourceManager::QueueTextureUploads(const TextureDB& db, const std::string& cacheKey, UploadPriority priority,
+    const GpuUploadQueue::CancelToken& cancel)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Текстуры соседней локации занимают те же страницы VRAM, что и текущей -
+    // до перехода им выдаются собственные слоты вне карты VRAM
+    const bool staged = retained_.count(cacheKey) != 0;
+    auto& slots = kfTextureSlots_[cacheKey];
+
+    for (const auto& tex : db.getAllTextures())
+    {
+        if (!tex.image.data) continue;
+
+        VramTexture vram;
+        vram.x = tex.pxVramX;
+        vram.y = tex.pxVramY;
+        vram.width = tex.pxWidth;
+        vram.height = tex.pxHeight;
+        vram.clutX = tex.clutVramX;
+        vram.clutY = tex.clutVramY;
+        vram.clutWidth = tex.clutWidth;
+        vram.clutHeight = tex.clutHeight;
+        vram.mode = tex.pMode;
+        if (staged) {
+            vram.slot = Game::g_UploadQueue.MakeTextureSlot();
+        }
+        else {
+            VramTexture& entry = PlaceVramTexture(vram);
+            if (!entry.slot) entry.slot = Game::g_UploadQueue.MakeTextureSlot();
+            vram.slot = entry.slot;
+        }
+        const std::shared_ptr<Texture2D> slot = vram.slot;
+        slots.push_back(std::move(vram));
+
+        // TextureDB оставляет Image себе, в очередь уходит копия
+        Game::g_UploadQueue.PushTexture(priority, ImageCopy(tex.image), slot, cancel,
+            [slot]() { BindPendingTextures(slot.get()); });
+    }
+}
+
+void ResourceManager::RequestTFile(const std::string& path, UploadPriority priority, GpuUploadQueue::CancelToken cancel)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (tfiles_.count(path)) return;
+        if (!cancel) cancel = levelCancel_;
+    }
+    Game::g_UploadQueue.Decode(priority, [path]() { LoadTFile(path); }, cancel);
+}
+
+void ResourceManager::RetainKF(const std::string& path, int index)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    retained_.insert(path + "_" + std::to_string(index));
+}
+
+void ResourceManager::ReleaseKF(const std::string& path, int index)
+{
+    std::string cacheKey = path + "_" + std::to_string(index);
+    std::shared_ptr<Model> rebind;
+    std::vector<TMDModel::MeshGroup> groups;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!retained_.erase(cacheKey)) return;
+
+        // Загрузку отменили на полпути: в слотах остались заглушки
+        DropPendingTextures(cacheKey);
+
+        // Модель уже доехала - остаётся в кеше текущей локации, текстуры назначаем сейчас
+        auto deferred = kfModelGroups_.find(cacheKey);
+        if (deferred != kfModelGroups_.end()) {
+            auto model = kfmodels_.find(cacheKey);
+            if (model != kfmodels_.end()) {
+                rebind = model->second;
+                groups = std::move(deferred->second);
+            }
+            kfModelGroups_.erase(deferred);
+        }
+    }
+    if (rebind) AssignVramTextures(*rebind, groups, rebind);
+}
+
+void ResourceManager::CancelKF(const std::string& path, int index)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    DropPendingTextures(path + "_" + std::to_string(index));
+}
+
+void ResourceManager::DropPendingTextures(const std::string& cacheKey)
+{
+    // Из кеша такой TextureDB отдавать нельзя: его задания загрузки отменены.
+    // Слоты в vramTextures_ остаются - следующий запрос зальёт в них ту же текстуру
+    auto slots = kfTextureSlots_.find(cacheKey);
+    if (slots == kfTextureSlots_.end()) return;
+    for (const auto& s : slots->second) {
+        if (Game::g_UploadQueue.IsPlaceholder(*s.slot)) {
+            kftexture_.erase(cacheKey);
+            kfTextureSlots_.erase(slots);
+            return;
+        }
+    }
+}
+
+Model ResourceManager::BuildKFModel(const std::string& path, int index, MemoryArena* scratch, std::vector<TMDModel::MeshGroup>& groups)
+{
+    auto tfile = LoadTFile(path);
+    if (!tfile) return Model{ 0 };
+
+    if (static_cast<size_t>(index) >= tfile->getNumFiles()) {
+        printf("ResourceManager: Index %d out of range for %s\n", index, path.c_str());
+        return Model{ 0 };
+    }
+
+    ByteArray& fileData = tfile->getFile(static_cast<size_t>(index));
+    FTYPE type = tfile->getEType(fileData);
+
+    // RTMD - тот же TMD, у MO модель лежит по смещению из заголовка (поза без анимации)
+    size_t tmdOffset = 0;
+    if (type == FTYPE::MO)
+        tmdOffset = Utilities::as<uint32_t>(fileData, 8);
+    else if (type != FTYPE::TMD && type != FTYPE::RTMD)
+        return Model{ 0 };
+
+    TMDModel tmd(fileData, tmdOffset);
+    if (!tmd.isValid()) {
+        printf("WARNING: File %d identified as TMD but parsing failed.\n", index);
+        return Model{ 0 };
+    }
+
+    Model model = tmd.buildModel(scratch, &groups);
+    if (model.meshCount == 0) {
+        TraceLog(LOG_WARNING, "RESOURCE: TMD %s_%i has no polygons", path.c_str(), index);
+    }
+    return model;
+}
+
+std::shared_ptr<Model> ResourceManager::LoadKFModel(const std::string& path, int index)
+{
+    if (index < 0)
+    {
+        TraceLog(LOG_ERROR, "ResourceManager::LoadKFModel index < 0 <%i>", index);
+        return nullptr;
+    }
+
+    std::string cacheKey = path + "_" + std::to_string(index);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = kfmodels_.find(cacheKey);
+        if (it != kfmodels_.end()) {
+            return it->second;
+        }
+    }
+
+    // Временные таблицы сборки берём из арены уровня и откатываем сразу после
+    std::vector<TMDModel::MeshGroup> groups;
+    Model rawModel = BuildKFModel(path, index, &Game::g_LevelArena, groups);
+    if (rawModel.meshCount == 0) return nullptr;
+
+    // Нужна прямо сейчас - грузим в обход очереди
+    for (int i = 0; i < rawModel.meshCount; i++)
+        UploadMesh(&rawModel.meshes[i], false);
+
+    auto ptr = MakeKFModelPtr(rawModel);
+    AssignVramTextures(*ptr, groups, ptr);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    kfmodels_[cacheKey] = ptr;
+    return ptr;
+}
+
+void ResourceManager::RequestKFModel(const std::string& path, int index, UploadPriority priority, GpuUploadQueue::CancelToken cancel)
+{
+    if (index < 0) return;
+
+    std::string cacheKey = path + "_" + std::to_string(index);
+    if (!BeginRequest(cacheKey, kfmodels_, cancel)) return;
+
+    Game::g_UploadQueue.Decode(priority, [path, index, priority, cancel, cacheKey]() {
+        // Рабочий поток: арена уровня не потокобезопасна, сборка идёт на своей
+        std::vector<TMDModel::MeshGroup> groups;
+        Model rawModel = BuildKFModel(path, index, nullptr, groups);
+
+        if (rawModel.meshCount == 0 || GpuUploadQueue::IsCancelled(cancel)) {
+            FreeModelCpu(rawModel);
+            EndRequest(cacheKey);
+            return;
+        }
+
+        auto ptr = MakeKFModelPtr(rawModel);
+        Game::g_UploadQueue.PushModel(priority, ptr, cancel, [ptr, groups, cacheKey]() {
+            bool deferred = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                kfmodels_.emplace(cacheKey, ptr);
+                // Модель соседней локации: в VRAM сейчас текстуры текущей, назначим при переходе
+                if (retained_.count(cacheKey)) {
+                    kfModelGroups_[cacheKey] = groups;
+                    deferred = true;
+                }
+            }
+            EndRequest(cacheKey);
+            if (!deferred) AssignVramTextures(*ptr, groups, ptr);
+            });
+        }, cancel);
+}
+
+std::shared_ptr<MorphModel> ResourceManager::LoadKFMorphModel(const std::string& path, int index)
+{
+    if (index < 0)
+    {
+        TraceLog(LOG_ERROR, "ResourceManager::LoadKFMorphModel index < 0 <%i>", index);
+        return nullptr;
+    }
+
+    std::string cacheKey = path + "_" + std::to_string(index);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = kfmorphs_.find(cacheKey);
+        if (it != kfmorphs_.end()) {
+            return it->second;
+        }
+    }
+
+    auto tfile = LoadTFile(path);
+    if (!tfile) return nullptr;
+
+    if (static_cast<size_t>(index) >= tfile->getNumFiles()) {
+        printf("ResourceManager: Index %d out of range for %s\n", index, path.c_str());
+        return nullptr;
+    }
+
+    ByteArray& fileData = tfile->getFile(static_cast<size_t>(index));
+    if (tfile->getEType(fileData) != FTYPE::MO) {
+        return nullptr;
+    }
+
+    auto mo = std::make_shared<MOModel>(fileData);
+    if (!mo->isValid()) {
+        printf("WARNING: File %d identified as MO but parsing failed.\n", index);
+        return nullptr;
+    }
+
+    auto morph = std::make_shared<MorphModel>(mo, &Game::g_LevelArena);
+    if (!morph->isValid()) {
+        TraceLog(LOG_WARNING, "RESOURCE: MO %s_%i has no polygons", path.c_str(), index);
+        return nullptr;
+    }
+    AssignVramTextures(morph->getTemplate(), morph->getGroups(), morph);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    kfmorphs_[cacheKey] = morph;
+    return morph;
+}
+
+void ResourceManager::AssignVramTextures(Model& model, const std::vector<TMDModel::MeshGroup>& groups, const std::shared_ptr<void>& owner)
+{
+    // Текстура группы из VRAM. Если там ещё заглушка - материал обновится, когда текстура доедет
+    for (int i = 0; i < model.meshCount && i < (int)groups.size(); i++)
+    {
+        const TMDModel::MeshGroup& group = groups[i];
+        if (!group.textured) continue;
+        VramTexture tex;
+        if (!FindVramTexture(group, tex)) continue;
+
+        // UV страницы -> UV прямоугольника TIM (в текселях страницы он начинается с offsetU/offsetV)
+        const int ratio = 4 >> TMDModel::getTexturePageMode(group.tsb);
+        const Point page = TMDModel::getTexturePageVram(group.tsb);
+        const float offsetU = (float)((tex.x - page.x) * ratio);
+        const float offsetV = (float)(tex.y - page.y);
+        Mesh& mesh = model.meshes[i];
+        for (int v = 0; v < mesh.vertexCount && (size_t)v * 2 + 1 < group.pageUV.size(); v++) {
+            mesh.texcoords[v * 2 + 0] = (group.pageUV[v * 2 + 0] - offsetU) / tex.width;
+            mesh.texcoords[v * 2 + 1] = (group.pageUV[v * 2 + 1] - offsetV) / tex.height;
+        }
+        if (mesh.vaoId != 0)
+            UpdateMeshBuffer(mesh, 1, mesh.texcoords, mesh.vertexCount * 2 * sizeof(float), 0);
+
+        int material = model.meshMaterial[i];
+        model.materials[material].maps[MATERIAL_MAP_DIFFUSE].texture = *tex.slot;
+        if (Game::g_UploadQueue.IsPlaceholder(*tex.slot))
+            pendingBindings_.push_back(TextureBinding{ owner, &model, material, tex.slot });
+    }
+}
+
+bool ResourceManager::FindVramTexture(const TMDModel::MeshGroup& group, VramTexture& out)
+{
+    // Страница в текселях своей глубины: 4 бита - 4 на слово VRAM, 8 бит - 2, 15 бит - 1
+    const int pageMode = TMDModel::getTexturePageMode(group.tsb);
+    const int ratio = 4 >> pageMode;
+    const Point page = TMDModel::getTexturePageVram(group.tsb);
+    const Point clut = TMDModel::getClutVram(group.cba);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t total = group.pageUV.size() / 2;
+    const VramTexture* best = nullptr;
+    std::tuple<bool, int, size_t> bestRank{ false, -1, 0 };
+    for (const auto& tex : vramTextures_) {
+        if ((int)tex.mode != pageMode || tex.width == 0 || tex.height == 0) continue;
+        const int left = (tex.x - page.x) * ratio;
+        const int top = tex.y - page.y;
+        if (left + tex.width <= 0 || top + tex.height <= 0 || left >= 256 || top >= 256) continue;
+
+        // Сколько вершин группы попадает в прямоугольник TIM
+        size_t covered = 0;
+        for (size_t v = 0; v + 1 < group.pageUV.size(); v += 2) {
+            const int u = group.pageUV[v] - left;
+            const int w = group.pageUV[v + 1] - top;
+            if (u >= 0 && u < tex.width && w >= 0 && w < tex.height) ++covered;
+        }
+        if (covered == 0) continue;
+
+        // Палитра: точное совпадение, затем строка многострочного CLUT, затем любая
+        int score = 0;
+        if (tex.clutX == clut.x && tex.clutY == clut.y) score = 2;
+        else if (tex.clutX == clut.x && clut.y >= tex.clutY && clut.y < tex.clutY + tex.clutHeight) score = 1;
+
+        // Сначала TIM, в который группа влезает целиком, среди них - по палитре
+        const std::tuple<bool, int, size_t> rank{ covered == total, score, covered };
+        if (rank > bestRank) {
+            best = &tex;
+            bestRank = rank;
+        }
+    }
+    if (!best) return false;
+
+    if (!std::get<0>(bestRank))
+        TraceLog(LOG_WARNING, "RESOURCE: TMD group tsb 0x%04X cba 0x%04X spans several TIMs", group.tsb, group.cba);
+    out = *best;
+    return true;
+}
+
+ResourceManager::VramTexture& ResourceManager::PlaceVramTexture(const VramTexture& tex)
+{
+    // Вызывается под mutex_
+    for (auto& entry : vramTextures_) {
+        if (entry.x == tex.x && entry.y == tex.y && entry.clutX == tex.clutX && entry.clutY == tex.clutY) {
+            std::shared_ptr<Texture2D> slot = std::move(entry.slot);
+            entry = tex;
+            entry.slot = std::move(slot);
+            return entry;
+        }
+    }
+    vramTextures_.push_back(tex);
+    vramTextures_.back().slot = nullptr;
+    return vramTextures_.back();
+}
+
+void ResourceManager::BindPendingTextures(const Texture2D* slot)
+{
+    // Главный поток (onReady очереди загрузки)
+    auto it = pendingBindings_.begin();
+    while (it != pendingBindings_.end())
+    {
+        if (it->owner.expired()) {
+            it = pendingBindings_.erase(it);
+            continue;
+        }
+        if (it->slot.get() == slot) {
+            it->model->materials[it->material].maps[MATERIAL_MAP_DIFFUSE].texture = *slot;
+            it = pendingBindings_.erase(it);
+            continue;
+        }
+        ++it;
+    }
+}
+
+template<class Cache>
+bool ResourceManager::BeginRequest(const std::string& cacheKey, const Cache& cache, GpuUploadQueue::CancelToken& cancel)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!cancel) cancel = levelCancel_;
+    if (cache.count(cacheKey)) return false;
+
+    // Уже едет и не отменён - второй раз не ставим
+    auto it = inFlight_.find(cacheKey);
+    if (it != inFlight_.end() && !GpuUploadQueue::IsCancelled(it->second)) return false;
+
+    inFlight_[cacheKey] = cancel;
+    return true;
+}
+
+void ResourceManager::EndRequest(const std::string& cacheKey)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    inFlight_.erase(cacheKey);
+}
+
 ByteArray& ResourceManager::GetFileFromT(const std::string& archivePath, size_t fileIndex)
 {
     auto archive = LoadTFile(archivePath);
@@ -323,6 +811,48 @@ std::shared_ptr<Font> ResourceManager::LoadFont(const std::string& path, int fon
 
 void ResourceManager::UnloadAll()
 {
+    std::vector<std::pair<std::shared_ptr<Model>, std::vector<TMDModel::MeshGroup>>> rebind;
+    {
+        // Всё, что ещё распаковывается или ждёт загрузки для старого уровня, выбрасывается
+        std::lock_guard<std::mutex> lock(mutex_);
+        levelCancel_->store(true);
+        levelCancel_ = GpuUploadQueue::MakeCancelToken();
+        pendingBindings_.clear();
+        vramTextures_.clear();
+        kfmorphs_.clear();
+
+        // Кроме предзагруженного для локации, в которую переходим
+        auto keepRetained = [](auto& cache) {
+            for (auto it = cache.begin(); it != cache.end();) {
+                if (retained_.count(it->first)) ++it;
+                else it = cache.erase(it);
+            }
+        };
+        keepRetained(inFlight_);
+        keepRetained(kftexture_);
+        // Модель, загруженная ещё для текущей локации, привязана к её слотам - её соберут заново
+        for (auto it = kfmodels_.begin(); it != kfmodels_.end();) {
+            if (kfModelGroups_.count(it->first)) ++it;
+            else it = kfmodels_.erase(it);
+        }
+        keepRetained(kfTextureSlots_);
+
+        // Отложенные текстуры становятся VRAM новой локации
+        for (const auto& db : kfTextureSlots_)
+            for (const auto& s : db.second)
+                PlaceVramTexture(s).slot = s.slot;
+
+        for (auto& deferred : kfModelGroups_) {
+            auto it = kfmodels_.find(deferred.first);
+            if (it != kfmodels_.end())
+                rebind.emplace_back(it->second, std::move(deferred.second));
+        }
+        kfModelGroups_.clear();
+        retained_.clear();
+    }
+    for (auto& r : rebind)
+        AssignVramTextures(*r.first, r.second, r.first);
+
     textures_.clear();
     models_.clear();
     animations_.clear();
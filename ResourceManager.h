@@ -3,8 +3,15 @@
 #include "soundbank.h"
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "tfile.h"
+#include "TMDModel.h"
+#include "GpuUploadQueue.h"
+#include <mutex>
+
+class MorphModel;
+class MemoryArena;
 
 struct AnimationData {
     ModelAnimation* anims = nullptr;
@@ -13,18 +20,43 @@ struct AnimationData {
 
 class ResourceManager {
 public:
-    //      (   LoadFileByIndex)
+    // Поиск оригинальных ресурсов по индексу (как в функции LoadFileByIndex)
     static std::shared_ptr<Model> GetModelByIndex(int index);
     static std::shared_ptr<Texture2D> GetTextureByVram(int x, int y);
 
-    //      (Items, Spells)
+    // Специальный загрузчик для таблиц данных (Items, Spells)
     static void LoadGameDatabases(const int16_t LanguageID);
 
     //KF
     static std::shared_ptr<TFile> LoadTFile(const std::string& path);
-    static std::shared_ptr<TextureDB> LoadKFTextures(const std::string& path, int index = 0);
-
-    //        
+    // Распаковка сразу, текстуры уходят в GPU через очередь (до загрузки в VRAM-слотах заглушка)
+    static std::shared_ptr<TextureDB> LoadKFTextures(const std::string& path, int index = 0,
+        UploadPriority priority = UploadPriority::High, GpuUploadQueue::CancelToken cancel = nullptr);
+    // TMD из архива -> Model (меши сгруппированы по texture page/CLUT и уже в GPU)
+    static std::shared_ptr<Model> LoadKFModel(const std::string& path, int index = 0);
+
+    // Фоновая загрузка: распаковка на рабочих потоках, результат появится в кеше,
+    // когда очередь загрузит его в GPU. cancel == nullptr - отменяется вместе с уровнем (UnloadAll)
+    static void RequestKFTextures(const std::string& path, int index, UploadPriority priority = UploadPriority::Normal,
+        GpuUploadQueue::CancelToken cancel = nullptr);
+    static void RequestKFModel(const std::string& path, int index, UploadPriority priority = UploadPriority::Normal,
+        GpuUploadQueue::CancelToken cancel = nullptr);
+    // MO с вершинной анимацией: общие данные, экземпляры создаёт MorphAnimator
+    static std::shared_ptr<MorphModel> LoadKFMorphModel(const std::string& path, int index = 0);
+    // Архив .T целиком в фоне (FDAT/RTMD/VAB следующей локации)
+    static void RequestTFile(const std::string& path, UploadPriority priority = UploadPriority::Prefetch,
+        GpuUploadQueue::CancelToken cancel = nullptr);
+
+    // Предзагрузка соседней локации. Удержанный ресурс переживает UnloadAll (переход),
+    // а его текстуры до перехода лежат отдельно и не подменяют VRAM текущей локации.
+    // Retain - до Request*, Release - когда игрок развернулся и загрузку отменили.
+    static void RetainKF(const std::string& path, int index);
+    static void ReleaseKF(const std::string& path, int index);
+    // Загрузку отменили (без Retain): TextureDB с недоехавшими текстурами уходит из кеша,
+    // иначе следующий запрос вернёт его вместе с заглушками
+    static void CancelKF(const std::string& path, int index);
+
+    // Удобный метод для получения конкретного файла из архива
     static ByteArray& GetFileFromT(const std::string& archivePath, size_t fileIndex);
 
 
@@ -43,10 +75,59 @@ public:
 
     static void UnloadAll();
 private:
-    ResourceManager() = delete; //   
+    ResourceManager() = delete; // Чисто статический класс
+
+    // TIM во VRAM: прямоугольник пикселей и палитра. Группа TMD находит по ним свою текстуру
+    struct VramTexture {
+        uint16_t x = 0, y = 0;            // начало во VRAM (16-битные слова)
+        uint16_t width = 0, height = 0;   // размер в текселях
+        uint16_t clutX = 0, clutY = 0;
+        uint16_t clutWidth = 0, clutHeight = 0;
+        PixelMode mode = PixelMode::Direct15Bit;
+        std::shared_ptr<Texture2D> slot;
+    };
+
+    // Материал, которому досталась заглушка: перепривязывается, когда текстура загрузится
+    struct TextureBinding {
+        std::weak_ptr<void> owner;
+        Model* model = nullptr;
+        int material = 0;
+        std::shared_ptr<Texture2D> slot;
+    };
+
+    static Model BuildKFModel(const std::string& path, int index, MemoryArena* scratch, std::vector<TMDModel::MeshGroup>& groups);
+    static void QueueTextureUploads(const TextureDB& db, const std::string& cacheKey, UploadPriority priority,
+        const GpuUploadQueue::CancelToken& cancel);
+    static void AssignVramTextures(Model& model, const std::vector<TMDModel::MeshGroup>& groups, const std::shared_ptr<void>& owner);
+    static void BindPendingTextures(const Texture2D* slot);
+    // TIM страницы группы, покрывающий её UV; из подходящих - с палитрой группы (CLUT)
+    static bool FindVramTexture(const TMDModel::MeshGroup& group, VramTexture& out);
+    // Тот же TIM (место и палитра) занимает прежний слот, новый - добавляется
+    static VramTexture& PlaceVramTexture(const VramTexture& tex);
+    // Под mutex_: TextureDB, у которого в слотах ещё заглушка, забываем - следующий запрос распакует заново
+    static void DropPendingTextures(const std::string& cacheKey);
+
+    template<class Cache>
+    static bool BeginRequest(const std::string& cacheKey, const Cache& cache, GpuUploadQueue::CancelToken& cancel);
+    static void EndRequest(const std::string& cacheKey);
+
+    // Кеши KF читаются и с рабочих потоков
+    static std::mutex mutex_;
 
     static std::unordered_map<std::string, std::shared_ptr<TFile>> tfiles_;
     static std::unordered_map<std::string, std::shared_ptr<TextureDB>> kftexture_;
+    static std::unordered_map<std::string, std::shared_ptr<Model>> kfmodels_;
+    static std::unordered_map<std::string, std::shared_ptr<MorphModel>> kfmorphs_;
+    static std::vector<VramTexture> vramTextures_;
+    static std::unordered_map<std::string, GpuUploadQueue::CancelToken> inFlight_;
+    // Слоты каждого TextureDB
+    static std::unordered_map<std::string, std::vector<VramTexture>> kfTextureSlots_;
+    // Удержанные модели, которым текстуры назначаются только после перехода
+    static std::unordered_map<std::string, std::vector<TMDModel::MeshGroup>> kfModelGroups_;
+    static std::unordered_set<std::string> retained_;
+    static std::vector<TextureBinding> pendingBindings_;   // только главный поток
+    static GpuUploadQueue::CancelToken levelCancel_;
+    static int16_t languageID_;
 
 
     static std::unordered_map<std::string, std::shared_ptr<Texture2D>> textures_;
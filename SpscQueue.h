@@ -0,0 +1,84 @@
+﻿#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Кольцо на один пишущий и один читающий поток без блокировок.
+// Ёмкость - степень двойки; переполненное кольцо отказывает в Push, а не ждёт.
+template<class T, size_t Capacity>
+class SpscQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+    SpscQueue() : items(new T[Capacity]) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Только пишущий поток
+    bool Push(const T& item)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) return false;
+        items[t & (Capacity - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Только читающий поток: следующий элемент без извлечения (nullptr - пусто)
+    const T* Peek() const
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return nullptr;
+        return &items[h & (Capacity - 1)];
+    }
+
+    void Pop()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool Empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+private:
+    std::unique_ptr<T[]> items;
+    // Разные строки кеша: потоки не толкаются на счётчиках друг друга
+    alignas(64) std::atomic<size_t> head{ 0 };   // читает
+    alignas(64) std::atomic<size_t> tail{ 0 };   // пишет
+};
+
+/*
+   Тройной буфер для снимков состояния: пишущий поток заполняет Back() и публикует,
+   читающий получает последний опубликованный целиком. Никто никого не ждёт,
+   промежуточные снимки читатель просто пропускает.
+*/
+template<class T>
+class SnapshotBuffer
+{
+public:
+    // Только пишущий поток
+    T& Back() { return slots[back]; }
+    void Publish()
+    {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Только читающий поток
+    const T& Read()
+    {
+        if (middle.load(std::memory_order_relaxed) & FRESH)
+            front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return slots[front];
+    }
+
+private:
+    static constexpr uint8_t INDEX = 0x3;
+    static constexpr uint8_t FRESH = 0x4;
+
+    T slots[3] = {};
+    std::atomic<uint8_t> middle{ 1 };
+    uint8_t back = 0;
+    uint8_t front = 2;
+};
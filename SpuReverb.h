@@ -0,0 +1,361 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SPU_USE_SSE 1
+#endif
+
+// Частота, на которой SPU считает реверб (половина выходной)
+constexpr int SPU_REVERB_RATE = 22050;
+
+// Номера пресетов - как SPU_REV_MODE_* в libspu
+enum class SpuReverbMode : uint8_t
+{
+    Off,
+    Room,
+    StudioSmall,
+    StudioMedium,
+    StudioLarge,
+    Hall,
+    SpaceEcho,
+    Echo,
+    Delay,
+    HalfEcho,
+    Count
+};
+
+/*
+   Регистры реверба SPU (1F801DC0h..1F801DFFh) в порядке адресов.
+   dXXX/mXXX - адреса в рабочей области в единицах по 8 байт, vXXX - коэффициенты 1.15 со знаком.
+*/
+struct SpuReverbPreset
+{
+    uint32_t sizeBytes;   // рабочая область (mBASE = 80000h - sizeBytes)
+    uint16_t dAPF1, dAPF2, vIIR, vCOMB1, vCOMB2, vCOMB3, vCOMB4, vWALL;
+    uint16_t vAPF1, vAPF2, mLSAME, mRSAME, mLCOMB1, mRCOMB1, mLCOMB2, mRCOMB2;
+    uint16_t dLSAME, dRSAME, mLDIFF, mRDIFF, mLCOMB3, mRCOMB3, mLCOMB4, mRCOMB4;
+    uint16_t dLDIFF, dRDIFF, mLAPF1, mRAPF1, mLAPF2, mRAPF2, vLIN, vRIN;
+};
+
+// Стандартные наборы регистров из libspu (SpuSetReverbModeType)
+inline constexpr SpuReverbPreset SPU_REVERB_PRESETS[(int)SpuReverbMode::Count] =
+{
+    // Off
+    { 0x10,
+      0x0000,0x0000,0x0000,0x0000,0x0000,0x0000,0x0000,0x0000,
+      0x0000,0x0000,0x0001,0x0001,0x0001,0x0001,0x0001,0x0001,
+      0x0000,0x0000,0x0001,0x0001,0x0001,0x0001,0x0001,0x0001,
+      0x0000,0x0000,0x0001,0x0001,0x0001,0x0001,0x0000,0x0000 },
+    // Room
+    { 0x26C0,
+      0x007D,0x005B,0x6D80,0x54B8,0xBED0,0x0000,0x0000,0xBA80,
+      0x5800,0x5300,0x04D6,0x0333,0x03F0,0x0227,0x0374,0x01EF,
+      0x0334,0x01B5,0x0000,0x0000,0x0000,0x0000,0x0000,0x0000,
+      0x0000,0x0000,0x01B4,0x0136,0x00B8,0x005C,0x8000,0x8000 },
+    // Studio Small
+    { 0x1F40,
+      0x0033,0x0025,0x70F0,0x4FA8,0xBCE0,0x4410,0xC0F0,0x9C00,
+      0x5280,0x4EC0,0x03E4,0x031B,0x03A4,0x02AF,0x0372,0x0266,
+      0x031C,0x025D,0x025C,0x018E,0x022F,0x0135,0x01D2,0x00B7,
+      0x018F,0x00B5,0x00B4,0x0080,0x004C,0x0026,0x8000,0x8000 },
+    // Studio Medium
+    { 0x4840,
+      0x00B1,0x007F,0x70F0,0x4FA8,0xBCE0,0x4510,0xBEF0,0xB4C0,
+      0x5280,0x4EC0,0x0904,0x076B,0x0824,0x065F,0x07A2,0x0616,
+      0x076C,0x05ED,0x05EC,0x042E,0x050F,0x0305,0x0462,0x02B7,
+      0x042F,0x0265,0x0264,0x01B2,0x0100,0x0080,0x8000,0x8000 },
+    // Studio Large
+    { 0x6FE0,
+      0x00E3,0x00A9,0x6F60,0x4FA8,0xBCE0,0x4510,0xBEF0,0xA680,
+      0x5680,0x52C0,0x0DFB,0x0B58,0x0D09,0x0A3C,0x0BD9,0x0973,
+      0x0B59,0x08DA,0x08D9,0x05E9,0x07EC,0x04B0,0x06EF,0x03D2,
+      0x05EA,0x031D,0x031C,0x0238,0x0154,0x00AA,0x8000,0x8000 },
+    // Hall
+    { 0xADE0,
+      0x01A5,0x0139,0x6000,0x5000,0x4C00,0xB800,0xBC00,0xC000,
+      0x6000,0x5C00,0x15BA,0x11BB,0x14C2,0x10BD,0x11BC,0x0DC1,
+      0x11C0,0x0DC3,0x0DC0,0x09C1,0x0BC4,0x07C1,0x0A00,0x06CD,
+      0x09C2,0x05C1,0x05C0,0x041A,0x0274,0x013A,0x8000,0x8000 },
+    // Space Echo
+    { 0xF6C0,
+      0x033D,0x0231,0x7E00,0x5000,0xB400,0xB000,0x4C00,0xB000,
+      0x6000,0x5400,0x1ED6,0x1A31,0x1D14,0x183B,0x1BC3,0x16B2,
+      0x1A32,0x15EF,0x15EE,0x1055,0x1334,0x0F2D,0x11F6,0x0C5D,
+      0x1056,0x0AE1,0x0AE0,0x07A2,0x0464,0x0232,0x8000,0x8000 },
+    // Echo
+    { 0x18040,
+      0x0001,0x0001,0x7FFF,0x7FFF,0x0000,0x0000,0x0000,0x8100,
+      0x0000,0x0000,0x1FFF,0x0FFF,0x1005,0x0005,0x0000,0x0000,
+      0x1005,0x0005,0x0000,0x0000,0x0000,0x0000,0x0000,0x0000,
+      0x0000,0x0000,0x1004,0x1002,0x0004,0x0002,0x8000,0x8000 },
+    // Delay
+    { 0x18040,
+      0x0001,0x0001,0x7FFF,0x7FFF,0x0000,0x0000,0x0000,0x0000,
+      0x0000,0x0000,0x1FFF,0x0FFF,0x1005,0x0005,0x0000,0x0000,
+      0x1005,0x0005,0x0000,0x0000,0x0000,0x0000,0x0000,0x0000,
+      0x0000,0x0000,0x1004,0x1002,0x0004,0x0002,0x8000,0x8000 },
+    // Half Echo
+    { 0x3C00,
+      0x0017,0x0013,0x70F0,0x4FA8,0xBCE0,0x4510,0xBEF0,0x8500,
+      0x5F80,0x54C0,0x0371,0x02AF,0x02E5,0x01DF,0x02B0,0x01D7,
+      0x0358,0x026A,0x01D6,0x011E,0x012D,0x00B1,0x011F,0x0059,
+      0x01A0,0x00E3,0x0058,0x0040,0x0028,0x0014,0x8000,0x8000 },
+};
+
+/*
+   Реверб SPU: кольцевая рабочая область, отражения (SAME/DIFF) с IIR,
+   4 гребёнки и 2 всепропускающих фильтра - по алгоритму железа, на 22.05 кГц.
+   Process() берёт блок 44.1 кГц, прореживает его парами, считает такты реверба
+   и растягивает результат обратно линейной интерполяцией (с задержкой на кадр).
+
+   Рабочая область хранится дважды подряд (зеркало): адрес такта = cursor + смещение,
+   смещения приведены в [0, size) при выборе пресета - в цикле нет ни одного модуля.
+*/
+class SpuReverb
+{
+public:
+    // Память - сразу под самый большой пресет: смена режима ничего не выделяет
+    SpuReverb()
+    {
+        size_t maxBytes = 0;
+        for (const auto& p : SPU_REVERB_PRESETS) maxBytes = std::max<size_t>(maxBytes, p.sizeBytes);
+        buffer.assign(maxBytes, 0.0f);   // maxBytes / 2 сэмплов + зеркало
+        SetMode(SpuReverbMode::Off);
+    }
+
+    void SetMode(SpuReverbMode newMode)
+    {
+        if ((int)newMode >= (int)SpuReverbMode::Count) newMode = SpuReverbMode::Off;
+        mode = newMode;
+        const SpuReverbPreset& p = SPU_REVERB_PRESETS[(int)mode];
+
+        size = (int)(p.sizeBytes / 2);
+        std::fill(buffer.begin(), buffer.begin() + size * 2, 0.0f);
+        cursor = 0;
+        phase = 0;
+        heldL = heldR = lastL = lastR = 0.0f;
+
+        vIIR = Vol(p.vIIR);  vWALL = Vol(p.vWALL);
+        vAPF1 = Vol(p.vAPF1); vAPF2 = Vol(p.vAPF2);
+        vLIN = Vol(p.vLIN);  vRIN = Vol(p.vRIN);
+        vCOMB[0] = Vol(p.vCOMB1); vCOMB[1] = Vol(p.vCOMB2);
+        vCOMB[2] = Vol(p.vCOMB3); vCOMB[3] = Vol(p.vCOMB4);
+
+        // Запись: LSAME, RSAME, LDIFF, RDIFF; IIR читает то, что там лежало тактом раньше
+        mSame[0] = Addr(p.mLSAME); mSame[1] = Addr(p.mRSAME);
+        mSame[2] = Addr(p.mLDIFF); mSame[3] = Addr(p.mRDIFF);
+        for (int i = 0; i < 4; ++i) mSamePrev[i] = Wrap(mSame[i] - 1);
+        // DIFF берёт отражение с противоположного канала
+        dSame[0] = Addr(p.dLSAME); dSame[1] = Addr(p.dRSAME);
+        dSame[2] = Addr(p.dRDIFF); dSame[3] = Addr(p.dLDIFF);
+
+        // Гребёнки парами (L, R) - так они ложатся в SIMD-регистр
+        mComb[0] = Addr(p.mLCOMB1); mComb[1] = Addr(p.mRCOMB1);
+        mComb[2] = Addr(p.mLCOMB2); mComb[3] = Addr(p.mRCOMB2);
+        mComb[4] = Addr(p.mLCOMB3); mComb[5] = Addr(p.mRCOMB3);
+        mComb[6] = Addr(p.mLCOMB4); mComb[7] = Addr(p.mRCOMB4);
+
+        mApf1[0] = Addr(p.mLAPF1); mApf1[1] = Addr(p.mRAPF1);
+        mApf2[0] = Addr(p.mLAPF2); mApf2[1] = Addr(p.mRAPF2);
+        for (int i = 0; i < 2; ++i) {
+            dApf1[i] = Wrap(mApf1[i] - (int)p.dAPF1 * 4);
+            dApf2[i] = Wrap(mApf2[i] - (int)p.dAPF2 * 4);
+        }
+    }
+
+    SpuReverbMode GetMode() const { return mode; }
+
+    // Хвост обнуляется, пресет остаётся
+    void Clear()
+    {
+        std::fill(buffer.begin(), buffer.begin() + size * 2, 0.0f);
+        heldL = heldR = lastL = lastR = 0.0f;
+        phase = 0;
+    }
+
+    // Блок 44.1 кГц: in - что уходит в реверб, out - мокрый сигнал (без громкости выхода)
+    void Process(const float* inL, const float* inR, float* outL, float* outR, int frames)
+    {
+        if (mode == SpuReverbMode::Off) {
+            std::fill(outL, outL + frames, 0.0f);
+            std::fill(outR, outR + frames, 0.0f);
+            return;
+        }
+
+        int k = 0;
+        // Прошлый блок кончился на первом кадре пары
+        if (phase && k < frames) {
+            FinishPair(inL[k], inR[k], outL[k], outR[k]);
+            ++k;
+        }
+
+        alignas(16) float decL[CHUNK], decR[CHUNK], wetL[CHUNK], wetR[CHUNK];
+        while (frames - k >= 2)
+        {
+            const int ticks = std::min(CHUNK, (frames - k) / 2);
+            Decimate(inL + k, decL, ticks);
+            Decimate(inR + k, decR, ticks);
+            for (int t = 0; t < ticks; ++t)
+                Tick(decL[t], decR[t], wetL[t], wetR[t]);
+            Upsample(wetL, outL + k, ticks, lastL);
+            Upsample(wetR, outR + k, ticks, lastR);
+            k += ticks * 2;
+        }
+
+        if (k < frames) {
+            heldL = inL[k];
+            heldR = inR[k];
+            outL[k] = lastL;
+            outR[k] = lastR;
+            phase = 1;
+        }
+    }
+
+private:
+    static constexpr int CHUNK = 128;   // тактов реверба за проход
+
+    static float Vol(uint16_t reg) { return (int16_t)reg * (1.0f / 32768.0f); }
+    int Wrap(int addr) const { addr %= size; return addr < 0 ? addr + size : addr; }
+    // Регистр адреса (по 8 байт) -> смещение в 16-битных сэмплах
+    int Addr(uint16_t reg) const { return Wrap((int)reg * 4); }
+
+    float Read(int offset) const { return buffer[cursor + offset]; }
+    void Write(int offset, float v)
+    {
+        // Насыщение, как у 16-битной рабочей области
+        v = std::min(1.0f, std::max(-1.0f, v));
+        const int at = cursor + offset;
+        buffer[at] = v;
+        buffer[at < size ? at + size : at - size] = v;
+    }
+
+    void FinishPair(float inL, float inR, float& outL, float& outR)
+    {
+        float wetL, wetR;
+        Tick((heldL + inL) * 0.5f, (heldR + inR) * 0.5f, wetL, wetR);
+        outL = (lastL + wetL) * 0.5f;
+        outR = (lastR + wetR) * 0.5f;
+        lastL = wetL;
+        lastR = wetR;
+        phase = 0;
+    }
+
+    // Пара кадров 44.1 кГц -> такт 22.05 кГц
+    static void Decimate(const float* in, float* out, int ticks)
+    {
+        int t = 0;
+#ifdef SPU_USE_SSE
+        const __m128 half = _mm_set1_ps(0.5f);
+        for (; t + 4 <= ticks; t += 4) {
+            const __m128 a = _mm_loadu_ps(in + t * 2), b = _mm_loadu_ps(in + t * 2 + 4);
+            const __m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            const __m128 odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            _mm_store_ps(out + t, _mm_mul_ps(_mm_add_ps(even, odd), half));
+        }
+#endif
+        for (; t < ticks; ++t)
+            out[t] = (in[t * 2] + in[t * 2 + 1]) * 0.5f;
+    }
+
+    // Такт -> пара кадров: первый - предыдущий такт, второй - середина между ними.
+    // Первый кадр пары не ждёт её такта - так же считается пара, разрезанная блоками
+    static void Upsample(const float* wet, float* out, int ticks, float& last)
+    {
+        int t = 0;
+#ifdef SPU_USE_SSE
+        const __m128 half = _mm_set1_ps(0.5f);
+        __m128 prev = _mm_set1_ps(last);
+        for (; t + 4 <= ticks; t += 4) {
+            const __m128 cur = _mm_load_ps(wet + t);
+            // cur, сдвинутый на такт назад: last, w0, w1, w2
+            const __m128 shifted = _mm_castsi128_ps(_mm_or_si128(
+                _mm_slli_si128(_mm_castps_si128(cur), 4),
+                _mm_srli_si128(_mm_castps_si128(prev), 12)));
+            const __m128 mid = _mm_mul_ps(_mm_add_ps(shifted, cur), half);
+            _mm_storeu_ps(out + t * 2, _mm_unpacklo_ps(shifted, mid));
+            _mm_storeu_ps(out + t * 2 + 4, _mm_unpackhi_ps(shifted, mid));
+            prev = cur;
+        }
+        if (t > 0) last = wet[t - 1];
+#endif
+        for (; t < ticks; ++t) {
+            out[t * 2] = last;
+            out[t * 2 + 1] = (last + wet[t]) * 0.5f;
+            last = wet[t];
+        }
+    }
+
+    // Один такт 22.05 кГц (формулы - как у железа, в -1..1 вместо int16)
+    void Tick(float inL, float inR, float& outL, float& outR)
+    {
+        const float Lin = inL * vLIN, Rin = inR * vRIN;
+        float L, R;
+#ifdef SPU_USE_SSE
+        // Отражения: [LSAME, RSAME, LDIFF, RDIFF] = (in + d * vWALL - prev) * vIIR + prev
+        const __m128 in4 = _mm_setr_ps(Lin, Rin, Lin, Rin);
+        const __m128 d4 = _mm_setr_ps(Read(dSame[0]), Read(dSame[1]), Read(dSame[2]), Read(dSame[3]));
+        const __m128 p4 = _mm_setr_ps(Read(mSamePrev[0]), Read(mSamePrev[1]), Read(mSamePrev[2]), Read(mSamePrev[3]));
+        __m128 n4 = _mm_add_ps(in4, _mm_mul_ps(d4, _mm_set1_ps(vWALL)));
+        n4 = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(n4, p4), _mm_set1_ps(vIIR)), p4);
+        alignas(16) float same[4];
+        _mm_store_ps(same, n4);
+        for (int i = 0; i < 4; ++i) Write(mSame[i], same[i]);
+
+        // Гребёнки: (L1 R1 L2 R2) * v12 + (L3 R3 L4 R4) * v34, затем половинки складываются
+        const __m128 c12 = _mm_setr_ps(Read(mComb[0]), Read(mComb[1]), Read(mComb[2]), Read(mComb[3]));
+        const __m128 c34 = _mm_setr_ps(Read(mComb[4]), Read(mComb[5]), Read(mComb[6]), Read(mComb[7]));
+        __m128 acc = _mm_add_ps(_mm_mul_ps(c12, _mm_setr_ps(vCOMB[0], vCOMB[0], vCOMB[1], vCOMB[1])),
+                                _mm_mul_ps(c34, _mm_setr_ps(vCOMB[2], vCOMB[2], vCOMB[3], vCOMB[3])));
+        acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+        alignas(16) float lr[4];
+        _mm_store_ps(lr, acc);
+        L = lr[0];
+        R = lr[1];
+#else
+        const float in4[4] = { Lin, Rin, Lin, Rin };
+        for (int i = 0; i < 4; ++i) {
+            const float prev = Read(mSamePrev[i]);
+            Write(mSame[i], (in4[i] + Read(dSame[i]) * vWALL - prev) * vIIR + prev);
+        }
+        L = R = 0.0f;
+        for (int i = 0; i < 4; ++i) {
+            L += Read(mComb[i * 2]) * vCOMB[i];
+            R += Read(mComb[i * 2 + 1]) * vCOMB[i];
+        }
+#endif
+        // Два всепропускающих фильтра подряд
+        const float a1L = Read(dApf1[0]), a1R = Read(dApf1[1]);
+        L -= vAPF1 * a1L; R -= vAPF1 * a1R;
+        Write(mApf1[0], L); Write(mApf1[1], R);
+        L = L * vAPF1 + a1L; R = R * vAPF1 + a1R;
+
+        const float a2L = Read(dApf2[0]), a2R = Read(dApf2[1]);
+        L -= vAPF2 * a2L; R -= vAPF2 * a2R;
+        Write(mApf2[0], L); Write(mApf2[1], R);
+        L = L * vAPF2 + a2L; R = R * vAPF2 + a2R;
+
+        outL = L;
+        outR = R;
+        if (++cursor == size) cursor = 0;
+    }
+
+    SpuReverbMode mode = SpuReverbMode::Off;
+    std::vector<float> buffer;   // от начала 2 * size: рабочая область и её зеркало
+    int size = 0;
+    int cursor = 0;
+
+    float vIIR = 0, vWALL = 0, vAPF1 = 0, vAPF2 = 0, vLIN = 0, vRIN = 0;
+    float vCOMB[4] = {};
+    int mSame[4] = {}, mSamePrev[4] = {}, dSame[4] = {};
+    int mComb[8] = {};
+    int mApf1[2] = {}, mApf2[2] = {}, dApf1[2] = {}, dApf2[2] = {};
+
+    // Стык блоков и интерполяция выхода
+    int phase = 0;
+    float heldL = 0, heldR = 0;
+    float lastL = 0, lastR = 0;
+};
@@ -0,0 +1,456 @@
+﻿#include "TMDModel.h"
+#include "MemoryArena.h"
+#include "utilities.h"
+#include "raymath.h"
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+    constexpr uint32_t NO_NORMAL = 0xFFFFFFFF;
+    constexpr size_t MAX_MESH_VERTICES = 0xFFFF; // индексы в Mesh - unsigned short
+
+    template<class T>
+    using ScratchVector = std::vector<T, ArenaAllocator<T>>;
+
+    // Угол полигона после распаковки, он же ключ для слияния вершин
+    struct Corner {
+        uint32_t vertex;  // сквозной индекс вершины
+        uint32_t normal;  // сквозной индекс нормали или NO_NORMAL
+        uint8_t u, v;
+        Color color;
+
+        bool operator==(const Corner& o) const {
+            return vertex == o.vertex && normal == o.normal && u == o.u && v == o.v &&
+                color.r == o.color.r && color.g == o.color.g && color.b == o.color.b && color.a == o.color.a;
+        }
+    };
+
+    inline uint32_t HashCorner(const Corner& c)
+    {
+        uint32_t h = c.vertex * 0x9E3779B1u;
+        h ^= (c.normal + 0x7F4A7C15u) * 0x85EBCA77u;
+        h ^= (uint32_t(c.u) | (uint32_t(c.v) << 8)) * 0xC2B2AE3Du;
+        h ^= (uint32_t(c.color.r) | (uint32_t(c.color.g) << 8) | (uint32_t(c.color.b) << 16)) * 0x27D4EB2Fu;
+        return h ^ (h >> 15);
+    }
+
+    struct GroupBuild {
+        TMDModel::MeshGroup info;
+        ScratchVector<Corner> corners; // по 3 на треугольник
+
+        explicit GroupBuild(MemoryArena& arena) : corners(ArenaAllocator<Corner>(arena)) {}
+    };
+
+    inline Color ReadColor(const uint8_t* p)
+    {
+        return Color{ p[0], p[1], p[2], 255 };
+    }
+
+    // У текстурированных примитивов цвет модулирует текстуру: 128 на PS1 = 1.0
+    inline unsigned char ModulateToRaylib(unsigned char c)
+    {
+        int v = c * 2;
+        return (unsigned char)(v > 255 ? 255 : v);
+    }
+}
+
+TMDModel::TMDModel(const ByteArray& data, size_t offset)
+{
+    try {
+        valid = load(data, offset);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "TMDModel: " << e.what() << std::endl;
+        objects.clear();
+        valid = false;
+    }
+}
+
+size_t TMDModel::getVertexCount() const
+{
+    size_t count = 0;
+    for (const auto& o : objects) count += o.vertices.size();
+    return count;
+}
+
+size_t TMDModel::getPrimitiveCount() const
+{
+    size_t count = 0;
+    for (const auto& o : objects) count += o.primitives.size();
+    return count;
+}
+
+Point TMDModel::getTexturePageVram(uint16_t tsb)
+{
+    // Биты 0-3: X / 64, бит 4: Y / 256
+    return Point{ (tsb & 0x0F) * 64, ((tsb >> 4) & 0x01) * 256 };
+}
+
+Point TMDModel::getClutVram(uint16_t cba)
+{
+    // Биты 0-5: X / 16, биты 6-14: Y
+    return Point{ (cba & 0x3F) * 16, (cba >> 6) & 0x1FF };
+}
+
+bool TMDModel::load(const ByteArray& data, size_t offset)
+{
+    // 1. Заголовок
+    if (offset + 12 > data.size()) return false;
+
+    uint32_t id = Utilities::as<uint32_t>(data, offset);
+    uint32_t flags = Utilities::as<uint32_t>(data, offset + 4);
+    uint32_t nobj = Utilities::as<uint32_t>(data, offset + 8);
+
+    // RTMD: тот же TMD, но ID = 0, а во flags 0x10/0x12 (см. fileIsRTMD)
+    bool rtmd = (id == 0) && (flags == 0x10 || flags == 0x12);
+    if ((id & 0xFF) != 0x41 && !rtmd) {
+        std::cerr << "TMDModel: bad ID 0x" << std::hex << id << std::dec << std::endl;
+        return false;
+    }
+
+    const size_t objTable = offset + 12;
+    const bool fixp = !rtmd && (flags & 1) != 0;
+    const size_t base = fixp ? offset : objTable;
+
+    // Счётчики сравниваются с остатком файла: битый nobj/nVert не переполнит произведение
+    if (nobj == 0 || nobj > (data.size() - objTable) / 28) return false;
+
+    objects.resize(nobj);
+
+    for (uint32_t o = 0; o < nobj; ++o)
+    {
+        size_t entry = objTable + o * 28;
+        uint32_t vertTop = Utilities::as<uint32_t>(data, entry + 0);
+        uint32_t nVert = Utilities::as<uint32_t>(data, entry + 4);
+        uint32_t normTop = Utilities::as<uint32_t>(data, entry + 8);
+        uint32_t nNorm = Utilities::as<uint32_t>(data, entry + 12);
+        uint32_t primTop = Utilities::as<uint32_t>(data, entry + 16);
+        uint32_t nPrim = Utilities::as<uint32_t>(data, entry + 20);
+
+        Object& obj = objects[o];
+        obj.scale = Utilities::as<int32_t>(data, entry + 24);
+
+        // 2. Вершины и нормали (SVECTOR, 8 байт)
+        if (base + vertTop > data.size() || nVert > (data.size() - base - vertTop) / 8 ||
+            base + normTop > data.size() || nNorm > (data.size() - base - normTop) / 8) {
+            std::cerr << "TMDModel: object " << o << " vertex/normal table out of bounds" << std::endl;
+            return false;
+        }
+
+        obj.vertices.resize(nVert);
+        if (nVert) std::memcpy(obj.vertices.data(), data.data() + base + vertTop, nVert * 8);
+        obj.normals.resize(nNorm);
+        if (nNorm) std::memcpy(obj.normals.data(), data.data() + base + normTop, nNorm * 8);
+
+        // 3. Примитивы: заголовок olen, ilen, flag, mode, затем ilen слов данных
+        size_t pos = base + primTop;
+        if (pos > data.size()) return false;
+        // Пакет не короче 4 байт - больше примитивов в остаток не поместится
+        obj.primitives.reserve(std::min<size_t>(nPrim, (data.size() - pos) / 4));
+
+        for (uint32_t p = 0; p < nPrim; ++p)
+        {
+            if (pos + 4 > data.size()) return false;
+
+            uint8_t ilen = data[pos + 1];
+            uint8_t flag = data[pos + 2];
+            uint8_t mode = data[pos + 3];
+            size_t packetSize = static_cast<size_t>(ilen) * 4;
+
+            if (pos + 4 + packetSize > data.size()) return false;
+
+            // Линии (010) и спрайты (011) в модели не нужны
+            if ((mode >> 5) == 0x01) {
+                Primitive prim;
+                if (parsePrimitive(data.data() + pos + 4, packetSize, flag, mode, prim))
+                {
+                    bool inRange = true;
+                    for (int i = 0; i < prim.vertexCount; ++i) {
+                        if (prim.vert[i] >= nVert || (prim.lit && prim.norm[i] >= nNorm)) inRange = false;
+                    }
+                    if (inRange)
+                        obj.primitives.push_back(prim);
+                }
+            }
+
+            pos += 4 + packetSize;
+        }
+    }
+
+    return true;
+}
+
+bool TMDModel::parsePrimitive(const uint8_t* packet, size_t packetSize, uint8_t flag, uint8_t mode, Primitive& out) const
+{
+    out.mode = mode;
+    out.flag = flag;
+    out.textured = (mode & 0x04) != 0;
+    out.gouraud = (mode & 0x10) != 0;
+    out.semiTransparent = (mode & 0x02) != 0;
+    out.vertexCount = (mode & 0x08) ? 4 : 3;
+    out.lit = (flag & 0x01) == 0;
+    out.doubleSided = (flag & 0x02) != 0;
+    bool gradation = (flag & 0x04) != 0;
+
+    const int n = out.vertexCount;
+    size_t p = 0;
+
+    // 1. UV + CBA/TSB (по слову на вершину)
+    if (out.textured) {
+        if (p + n * 4 > packetSize) return false;
+        for (int i = 0; i < n; ++i) {
+            out.u[i] = packet[p];
+            out.v[i] = packet[p + 1];
+            if (i == 0) out.cba = packet[p + 2] | (packet[p + 3] << 8);
+            if (i == 1) out.tsb = packet[p + 2] | (packet[p + 3] << 8);
+            p += 4;
+        }
+    }
+
+    // 2. Цвета
+    int colorCount = 0;
+    if (out.lit)
+        colorCount = out.textured ? 0 : (gradation ? n : 1);
+    else
+        colorCount = (out.gouraud || (gradation && !out.textured)) ? n : 1;
+
+    if (p + colorCount * 4 > packetSize) return false;
+    for (int i = 0; i < colorCount; ++i) {
+        out.color[i] = ReadColor(packet + p);
+        p += 4;
+    }
+    for (int i = colorCount; i < n; ++i)
+        out.color[i] = (colorCount > 0) ? out.color[0] : Color{ 128, 128, 128, 255 };
+
+    // 3. Нормали и индексы вершин (uint16)
+    auto readU16 = [&](uint16_t& dst) -> bool {
+        if (p + 2 > packetSize) return false;
+        dst = packet[p] | (packet[p + 1] << 8);
+        p += 2;
+        return true;
+    };
+
+    if (out.lit && out.gouraud) {
+        for (int i = 0; i < n; ++i) {
+            if (!readU16(out.norm[i]) || !readU16(out.vert[i])) return false;
+        }
+    }
+    else if (out.lit) {
+        if (!readU16(out.norm[0])) return false;
+        for (int i = 1; i < n; ++i) out.norm[i] = out.norm[0];
+        for (int i = 0; i < n; ++i) {
+            if (!readU16(out.vert[i])) return false;
+        }
+    }
+    else {
+        for (int i = 0; i < n; ++i) {
+            if (!readU16(out.vert[i])) return false;
+        }
+    }
+
+    return true;
+}
+
+Model TMDModel::buildModel(MemoryArena* scratch, std::vector<MeshGroup>* groupsOut) const
+{
+    Model model = { 0 };
+    model.transform = MatrixIdentity();
+    if (!valid) return model;
+
+    // Временные таблицы живут в арене и откатываются на выходе
+    MemoryArena localArena;
+    if (!scratch) localArena.Init(getPrimitiveCount() * 6 * sizeof(Corner) * 3 + 64 * 1024);
+    MemoryArena& arena = scratch ? *scratch : localArena;
+    ArenaScratchScope scope(arena);
+
+    // 1. Сквозная нумерация вершин/нормалей всех объектов
+    ScratchVector<uint32_t> vertexBase{ ArenaAllocator<uint32_t>(arena) };
+    ScratchVector<uint32_t> normalBase{ ArenaAllocator<uint32_t>(arena) };
+    ScratchVector<const Vertex*> globalVerts{ ArenaAllocator<const Vertex*>(arena) };
+    ScratchVector<const Vertex*> globalNorms{ ArenaAllocator<const Vertex*>(arena) };
+
+    for (const auto& obj : objects) {
+        vertexBase.push_back((uint32_t)globalVerts.size());
+        normalBase.push_back((uint32_t)globalNorms.size());
+        for (const auto& v : obj.vertices) globalVerts.push_back(&v);
+        for (const auto& n : obj.normals) globalNorms.push_back(&n);
+    }
+
+    // 2. Раскладываем треугольники по группам (texture page + CLUT + полупрозрачность)
+    ScratchVector<GroupBuild*> groups{ ArenaAllocator<GroupBuild*>(arena) };
+
+    auto findGroup = [&](const Primitive& prim) -> GroupBuild* {
+        uint16_t tsb = prim.textured ? prim.tsb : 0xFFFF;
+        uint16_t cba = prim.textured ? prim.cba : 0xFFFF;
+        for (GroupBuild* g : groups) {
+            if (g->info.tsb == tsb && g->info.cba == cba &&
+                g->info.textured == prim.textured && g->info.semiTransparent == prim.semiTransparent)
+                return g;
+        }
+        GroupBuild* g = arena.New<GroupBuild>(arena);
+        g->info.tsb = tsb;
+        g->info.cba = cba;
+        g->info.textured = prim.textured;
+        g->info.semiTransparent = prim.semiTransparent;
+        groups.push_back(g);
+        return g;
+    };
+
+    // PS1 рисует (0,1,2) и (1,3,2) по часовой стрелке на экране, OpenGL ждёт против
+    static const int TRI_ORDER[2][3] = { { 0, 2, 1 }, { 1, 2, 3 } };
+
+    for (size_t o = 0; o < objects.size(); ++o)
+    {
+        for (const Primitive& prim : objects[o].primitives)
+        {
+            GroupBuild* g = findGroup(prim);
+
+            Corner corners[4];
+            for (int i = 0; i < prim.vertexCount; ++i) {
+                Corner& c = corners[i];
+                c.vertex = vertexBase[o] + prim.vert[i];
+                c.normal = prim.lit ? normalBase[o] + prim.norm[i] : NO_NORMAL;
+                c.u = prim.textured ? prim.u[i] : 0;
+                c.v = prim.textured ? prim.v[i] : 0;
+                c.color = prim.color[i];
+                if (prim.textured) {
+                    c.color.r = ModulateToRaylib(c.color.r);
+                    c.color.g = ModulateToRaylib(c.color.g);
+                    c.color.b = ModulateToRaylib(c.color.b);
+                }
+                if (prim.semiTransparent) c.color.a = 128;
+            }
+
+            int triCount = (prim.vertexCount == 4) ? 2 : 1;
+            for (int t = 0; t < triCount; ++t) {
+                for (int k = 0; k < 3; ++k) g->corners.push_back(corners[TRI_ORDER[t][k]]);
+                // FCE: двусторонний примитив - дублируем с обратным обходом
+                if (prim.doubleSided) {
+                    for (int k = 2; k >= 0; --k) g->corners.push_back(corners[TRI_ORDER[t][k]]);
+                }
+            }
+        }
+    }
+
+    // 3. Слияние вершин внутри группы и заполнение Mesh
+    std::vector<Mesh> meshes;
+    std::vector<MeshGroup> meshGroups;
+
+    for (GroupBuild* g : groups)
+    {
+        const size_t cornerCount = g->corners.size();
+        if (cornerCount == 0) continue;
+
+        size_t tableSize = 1;
+        while (tableSize < cornerCount * 2) tableSize <<= 1;
+        const size_t mask = tableSize - 1;
+
+        // Открытая адресация: хранится индекс вершины меша + 1 (0 = пусто)
+        uint32_t* table = arena.NewArray<uint32_t>(tableSize);
+        ScratchVector<Corner> unique{ ArenaAllocator<Corner>(arena) };
+        ScratchVector<uint16_t> indices{ ArenaAllocator<uint16_t>(arena) };
+
+        auto flush = [&]() {
+            if (indices.empty()) return;
+
+            Mesh mesh = { 0 };
+            mesh.vertexCount = (int)unique.size();
+            mesh.triangleCount = (int)(indices.size() / 3);
+            mesh.vertices = (float*)RL_MALLOC(unique.size() * 3 * sizeof(float));
+            mesh.normals = (float*)RL_MALLOC(unique.size() * 3 * sizeof(float));
+            mesh.texcoords = (float*)RL_MALLOC(unique.size() * 2 * sizeof(float));
+            mesh.colors = (unsigned char*)RL_MALLOC(unique.size() * 4);
+            mesh.indices = (unsigned short*)RL_MALLOC(indices.size() * sizeof(unsigned short));
+
+            MeshGroup info = g->info;
+            info.sourceVertex.resize(unique.size());
+            info.pageUV.resize(unique.size() * 2);
+
+            for (size_t i = 0; i < unique.size(); ++i)
+            {
+                const Corner& c = unique[i];
+                const Vertex& v = *globalVerts[c.vertex];
+
+                // Y и Z PS1 смотрят в другую сторону
+                mesh.vertices[i * 3 + 0] = v.x * TMD_WORLD_SCALE;
+                mesh.vertices[i * 3 + 1] = -v.y * TMD_WORLD_SCALE;
+                mesh.vertices[i * 3 + 2] = -v.z * TMD_WORLD_SCALE;
+
+                if (c.normal != NO_NORMAL) {
+                    const Vertex& n = *globalNorms[c.normal];
+                    mesh.normals[i * 3 + 0] = n.x / 4096.0f;
+                    mesh.normals[i * 3 + 1] = -n.y / 4096.0f;
+                    mesh.normals[i * 3 + 2] = -n.z / 4096.0f;
+                }
+                else {
+                    mesh.normals[i * 3 + 0] = 0.0f;
+                    mesh.normals[i * 3 + 1] = 1.0f;
+                    mesh.normals[i * 3 + 2] = 0.0f;
+                }
+
+                // UV в пределах текстурной страницы 256x256
+                mesh.texcoords[i * 2 + 0] = c.u / 256.0f;
+                mesh.texcoords[i * 2 + 1] = c.v / 256.0f;
+
+                mesh.colors[i * 4 + 0] = c.color.r;
+                mesh.colors[i * 4 + 1] = c.color.g;
+                mesh.colors[i * 4 + 2] = c.color.b;
+                mesh.colors[i * 4 + 3] = c.color.a;
+
+                info.sourceVertex[i] = c.vertex;
+                info.pageUV[i * 2 + 0] = c.u;
+                info.pageUV[i * 2 + 1] = c.v;
+            }
+            std::memcpy(mesh.indices, indices.data(), indices.size() * sizeof(uint16_t));
+
+            meshes.push_back(mesh);
+            meshGroups.push_back(std::move(info));
+
+            unique.clear();
+            indices.clear();
+            std::memset(table, 0, tableSize * sizeof(uint32_t));
+        };
+
+        std::memset(table, 0, tableSize * sizeof(uint32_t));
+
+        for (size_t t = 0; t < cornerCount; t += 3)
+        {
+            // Меш переполнится по индексам - закрываем его и начинаем новый для той же группы
+            if (unique.size() + 3 > MAX_MESH_VERTICES) flush();
+
+            for (size_t k = 0; k < 3; ++k)
+            {
+                const Corner& c = g->corners[t + k];
+                size_t slot = HashCorner(c) & mask;
+                while (table[slot] != 0 && !(unique[table[slot] - 1] == c))
+                    slot = (slot + 1) & mask;
+
+                if (table[slot] == 0) {
+                    unique.push_back(c);
+                    table[slot] = (uint32_t)unique.size();
+                }
+                indices.push_back((uint16_t)(table[slot] - 1));
+            }
+        }
+        flush();
+    }
+
+    // 4. Сборка Model: по материалу на меш, текстуры назначает вызывающий (по tsb/cba)
+    if (meshes.empty()) return model;
+
+    model.meshCount = (int)meshes.size();
+    model.materialCount = (int)meshes.size();
+    model.meshes = (Mesh*)RL_CALLOC(model.meshCount, sizeof(Mesh));
+    model.materials = (Material*)RL_CALLOC(model.materialCount, sizeof(Material));
+    model.meshMaterial = (int*)RL_CALLOC(model.meshCount, sizeof(int));
+
+    for (int i = 0; i < model.meshCount; ++i) {
+        model.meshes[i] = meshes[i];
+        model.materials[i] = LoadMaterialDefault();
+        model.meshMaterial[i] = i;
+    }
+
+    if (groupsOut) *groupsOut = std::move(meshGroups);
+    return model;
+}
@@ -0,0 +1,96 @@
+﻿#pragma once
+#include "types.h"
+#include "raylib.h"
+#include <cstdint>
+#include <vector>
+
+class MemoryArena;
+
+// Координаты PS1 (int16, Y вниз) -> мировые единицы RayLib
+constexpr float TMD_WORLD_SCALE = 1.0f / 1024.0f;
+
+/*
+   Парсер TMD (Sony PlayStation model format).
+   Заголовок: ID (0x41), flags (бит 0 = FIXP, абсолютные адреса), nobj.
+   Таблица объектов (28 байт на объект): vert_top, n_vert, normal_top, n_normal,
+   primitive_top, n_primitive, scale. Адреса при FIXP = 0 считаются от начала таблицы объектов.
+   Раскладка пакетов примитивов сверена с ConvertVertexCoordinates из GAME.EXE.
+   RTMD (RTMD.T) читается этим же парсером: отличается только заголовком (ID = 0, flags 0x10/0x12).
+*/
+class TMDModel
+{
+public:
+    struct Vertex {
+        int16_t x, y, z, pad;
+    };
+
+    struct Primitive {
+        uint8_t mode = 0;        // код примитива (0x20..0x3F для полигонов)
+        uint8_t flag = 0;        // LGT / FCE / GRD
+        uint8_t vertexCount = 3; // 3 или 4
+
+        bool textured = false;
+        bool gouraud = false;
+        bool lit = true;         // расчёт освещения (нужны нормали)
+        bool doubleSided = false;
+        bool semiTransparent = false;
+
+        uint16_t tsb = 0xFFFF;   // texture page
+        uint16_t cba = 0xFFFF;   // CLUT
+
+        uint16_t vert[4] = {};
+        uint16_t norm[4] = {};
+        uint8_t u[4] = {};
+        uint8_t v[4] = {};
+        Color color[4] = {};
+    };
+
+    struct Object {
+        std::vector<Vertex> vertices;
+        std::vector<Vertex> normals;
+        std::vector<Primitive> primitives;
+        int32_t scale = 0;
+    };
+
+    // Одна группа (texture page + CLUT) = один Mesh
+    struct MeshGroup {
+        uint16_t tsb = 0xFFFF;
+        uint16_t cba = 0xFFFF;
+        bool textured = false;
+        bool semiTransparent = false;
+        // Для каждой вершины меша - индекс исходной вершины TMD (сквозной по объектам).
+        // Нужен морф-анимации, чтобы раскидывать кадры по вершинам меша.
+        std::vector<uint32_t> sourceVertex;
+        // UV вершин в текселях страницы (u, v по очереди): по ним ищется TIM внутри страницы,
+        // texcoords меша пересчитываются в его прямоугольник при назначении текстуры
+        std::vector<uint8_t> pageUV;
+    };
+
+    TMDModel() = default;
+    // offset - начало TMD внутри файла (MO хранит TMD не с нулевого байта)
+    explicit TMDModel(const ByteArray& data, size_t offset = 0);
+
+    bool isValid() const { return valid; }
+    size_t getObjectCount() const { return objects.size(); }
+    size_t getVertexCount() const;
+    size_t getPrimitiveCount() const;
+    const std::vector<Object>& getObjects() const { return objects; }
+
+    // Сборка Model: примитивы сгруппированы по texture page и CLUT,
+    // одинаковые вершины внутри группы слиты. Меши ещё не загружены в GPU.
+    // scratch - арена для временных таблиц (если nullptr, используется обычная куча)
+    Model buildModel(MemoryArena* scratch = nullptr, std::vector<MeshGroup>* groups = nullptr) const;
+
+    // Координаты текстурной страницы и палитры во VRAM
+    static Point getTexturePageVram(uint16_t tsb);
+    // Глубина цвета страницы (биты 7-8 TSB): 0 - 4 бита, 1 - 8 бит, 2 - 15 бит
+    static int getTexturePageMode(uint16_t tsb) { return (tsb >> 7) & 0x03; }
+    static Point getClutVram(uint16_t cba);
+
+private:
+    bool load(const ByteArray& data, size_t offset);
+    bool parsePrimitive(const uint8_t* packet, size_t packetSize, uint8_t flag, uint8_t mode, Primitive& out) const;
+
+    std::vector<Object> objects;
+    bool valid = false;
+};
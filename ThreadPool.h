@@ -0,0 +1,130 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Простой пул рабочих потоков для фоновой распаковки ресурсов (текстуры, меши, сэмплы).
+// Задачи не должны трогать GPU/окно - это делает только главный поток.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t threadCount = 0)
+    {
+        if (threadCount == 0) {
+            // Один поток оставляем главному циклу
+            unsigned hw = std::thread::hardware_concurrency();
+            threadCount = (hw > 1) ? hw - 1 : 1;
+        }
+        workers.reserve(threadCount);
+        for (size_t i = 0; i < threadCount; ++i)
+            workers.emplace_back([this]() { WorkerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers)
+            if (t.joinable()) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    // Блокирует до опустошения очереди и завершения всех начатых задач
+    void WaitIdle()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this]() { return tasks.empty() && busy == 0; });
+    }
+
+    size_t GetThreadCount() const { return workers.size(); }
+
+    // fn(0..count-1) на всех потоках пула и на вызывающем; возврат - когда выполнены все индексы.
+    // Вызывающий поток работает сам, поэтому занятый чужими задачами пул не блокирует.
+    template<class Fn>
+    void ParallelFor(size_t count, Fn&& fn)
+    {
+        if (count == 0) return;
+
+        struct Shared {
+            std::atomic<size_t> next{ 0 };
+            std::atomic<size_t> done{ 0 };
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        auto shared = std::make_shared<Shared>();
+
+        // fn трогается только при i < count, а до выполнения всех таких i мы не вернёмся
+        auto* body = &fn;
+        auto run = [shared, count, body]() {
+            for (;;) {
+                const size_t i = shared->next.fetch_add(1);
+                if (i >= count) return;
+                (*body)(i);
+                if (shared->done.fetch_add(1) + 1 == count) {
+                    std::lock_guard<std::mutex> lock(shared->mutex);
+                    shared->finished.notify_all();
+                }
+            }
+        };
+
+        const size_t helpers = (count - 1 < workers.size()) ? count - 1 : workers.size();
+        for (size_t i = 0; i < helpers; ++i)
+            Submit(run);
+        run();
+
+        std::unique_lock<std::mutex> lock(shared->mutex);
+        shared->finished.wait(lock, [&]() { return shared->done.load() == count; });
+    }
+
+private:
+    void WorkerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                ++busy;
+            }
+
+            task();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --busy;
+                if (tasks.empty() && busy == 0) idle.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    size_t busy = 0;
+    bool stopping = false;
+};
@@ -1,5 +1,8 @@
 ﻿#include "GameContext.h"
+#include "OfflineRender.h"
+#include "AudioBench.h"
 #include <iostream>
+#include <cstring>
 #include <iomanip> // для красивого вывода таблицы
 
 int MainGameLoop() 
@@ -55,6 +58,10 @@ RESET:
         Game::Entities_UpdateAll();   // Наша логика AI
         Game::UpdatePlayerSystem();   // Физика игрока
         Game::ProcessCurrentMode();   // Меню/Инвентарь/Игра
+        Game::g_PositionalAudio.Update(GetFrameTime()); // Сущности и игрок сдвинулись -> затухание, панорама, доплер
+
+        Game::g_UploadQueue.Process(); // Готовые текстуры/меши -> GPU, не дольше бюджета кадра
+        Game::g_Audio.Update();        // Снятые банки, предзагруженные VAB -> кеш
 
         // --- DRAW ---
         BeginDrawing();
@@ -99,8 +106,14 @@ VabPair FindVabForSeq(std::shared_ptr<TFile> tFile, int seqIdx) {
     return pair;
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    // Рендер музыки в WAV без окна и звука
+    if (argc > 1 && strcmp(argv[1], "--render") == 0)
+        return OfflineRender::Main(argc - 2, argv + 2);
+    // Замеры звукового тракта
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+        return AudioBench::Main(argc - 2, argv + 2);
 
     Game::LoadGameData();
     const int screenWidth = 800;
@@ -1,11 +1,11 @@
 #include "ResourceManager.h"
+#include "GameContext.h"
 #include <cstring>
 #include <cmath>
 #include <iostream>
 #include "math.h"
 #include "utilities.h"
-static const double K0[] = { 0.0, 0.9375, 1.796875, 1.53125, 1.90625 };
-static const double K1[] = { 0.0, 0.0, -0.8125, -0.859375, -0.9375 };
+#include "PsxAdpcm.h"
 
 
 AudioSystem::AudioSystem()
@@ -20,6 +20,8 @@ AudioSystem::AudioSystem()
     music[7] = { 119, {16,17} };
     music[8] = { 120, {18,19} };
     music[9] = { 121, {20,21} };
+
+    seqPlayer.Attach(&spu);
 }
 
 AudioSystem::~AudioSystem()
@@ -56,39 +58,61 @@ void AudioSystem::PlaySEQMusic(int id)
         id = 0;
     std::string archivePath = "F:/PSX/CHDTOISO-WINDOWS-main/King's Field/CD/COM/VAB.T";
 
-    auto tFile = ResourceManager::LoadTFile(archivePath);
+    PlaySEQ(archivePath, music[id].SeqId, music[id].pair.vh, music[id].pair.vb);
+}
+
+bool AudioSystem::PlaySEQ(const std::string& archivePath, int seqIndex, int vh, int vb, uint32_t startTick)
+{
+    // Банк трека, который уже играл, берётся из кеша без декодирования
+    if (!LoadVab(archivePath, vh, vb))
+        return false;
 
-    LoadVab(tFile->getFile(music[id].pair.vh), tFile->getFile(music[id].pair.vb));
+    // 3. Запускаем музыку
+    auto tFile = ResourceManager::LoadTFile(archivePath);
+    if (!tFile || seqIndex < 0 || static_cast<size_t>(seqIndex) >= tFile->getNumFiles()) {
+        TraceLog(LOG_WARNING, "SEQ: %i is out of range for %s", seqIndex, archivePath.c_str());
+        return false;
+    }
 
-    // 3.  
-    PlayMusic(tFile->getFile(music[id].SeqId));
+    // Разбираем SEQ один раз; трек живёт в кеше и после смены музыки
+    const std::string key = archivePath + "_" + std::to_string(seqIndex);
+    auto it = seqCache.find(key);
+    if (it == seqCache.end()) {
+        std::shared_ptr<const SeqTrack> track = SeqPlayer::Compile(tFile->getFile(seqIndex));
+        if (!track) {
+            std::cerr << "Not a valid King's Field SEQ file." << std::endl;
+            return false;
+        }
+        it = seqCache.emplace(key, std::move(track)).first;
+    }
+    return PlayMusic(it->second, startTick) >= 0;
 }
 
 
 bool AudioSystem::Load(const ByteArray& vhData, const ByteArray& vbData)
 {
-    // 1.    
+    // 1. Очистка без риска краша
     UnloadAll();
 
     if (vhData.size() < 32) return false;
 
-    // 1.   (Offsets   PS1)
+    // 1. Читаем заголовок (Offsets по спецификации PS1)
     uint16_t programCount = *reinterpret_cast<const uint16_t*>(vhData.data() + 18);
     uint16_t vagCount = *reinterpret_cast<const uint16_t*>(vhData.data() + 22);
 
-    // 2. :   , PS1     
+    // 2. ВАЖНО: Если программа одна, PS1 все равно может резервировать минимум
     if (programCount == 0) return false;
 
-    // 3.    (    IDA)
+    // 3. РАСЧЕТ АДРЕСА ТАБЛИЦЫ (Формула из вашего кода IDA)
     // 2080 (Start of Tones) + (programCount * 512)
     size_t tableAddr = 2080 + (static_cast<size_t>(programCount) * 512);
 
-    //  +2  (   /)
+    // Добавляем +2 байта (пропуск магического числа таблицы/выравнивание)
     tableAddr += 2;
 
     TraceLog(LOG_INFO, "VAB: progs=%d, vags=%d, table_addr=0x%zX", programCount, vagCount, tableAddr);
 
-    //       VH
+    // Проверка на выход за границы файла VH
     if (tableAddr + (vagCount * 2) > vhData.size()) {
         TraceLog(LOG_WARNING, "VAB: Table address 0x%zX is out of VH bounds (size %zu)", tableAddr, vhData.size());
         return false;
@@ -99,21 +123,21 @@ bool AudioSystem::Load(const ByteArray& vhData, const ByteArray& vbData)
     uint32_t currentOffset = 0;
     for (int i = 0; i < vagCount; ++i)
     {
-        //     8 
+        // Размер в блоках по 8 байт
         uint32_t vagSize = static_cast<uint32_t>(sizeTable[i]) * 8;
 
         if (vagSize == 0) continue;
         if (currentOffset + vagSize > vbData.size()) break;
 
-        // 
+        // Декодируем
         std::vector<int16_t> pcm = DecodeADPCM(vbData.data() + currentOffset, vagSize);
 
         if (!pcm.empty()) {
             Wave wave = { 0 };
             wave.frameCount = (unsigned int)pcm.size();
 
-            // :    ,  11025. 
-            //      - 22050.
+            // ЧАСТОТА: Если звуки слишком быстрые, попробуйте 11025. 
+            // Если слишком медленные или низкие - 22050.
             wave.sampleRate = 22050;
             wave.sampleSize = 16;
             wave.channels = 1;
@@ -137,26 +161,58 @@ bool AudioSystem::Load(const ByteArray& vhData, const ByteArray& vbData)
 
 void AudioSystem::UnloadAll()
 {
-    // 1.  
+    // 1. Останавливаем дирижера
     seqPlayer.StopAll();
 
-    // 2.    SPU
+    // 2. Выключаем голоса в SPU
     spu.StopAllVoices();
 
-    // 3.      
-    for (int i = 0; i < 128; i++) {
-        for (int t = 0; t < 16; t++) {
-            //   float,    
-            programs[i].tones[t].data.clear();
-            programs[i].tones[t].sampleCount = 0;
-        }
-        programs[i].toneCount = 0;
-    }
+    // 3. Отпускаем банки. Декодированные сэмплы остаются в кеше до вытеснения.
+    // Голоса читают их тоны, пока аудиопоток не применит StopAll - до тех пор держим
+    const uint64_t stop = spu.GetPostedCount();
+    for (auto& b : banks)
+        if (b) retiredBanks.push_back({ std::move(b), nullptr, stop });
+    if (musicSource)
+        retiredBanks.push_back({ nullptr, std::move(musicSource), stop });
 
-    // 4.   sounds,     -   SFX
+    // 4. Очищаем вектор sounds, если вы в него что-то пушили для SFX
     sounds.clear();
 }
 
+void AudioSystem::UnloadBank(int bankId)
+{
+    if (bankId < 0 || bankId >= AUDIO_BANK_COUNT || !banks[bankId]) return;
+    RetireBank(bankId);
+}
+
+void AudioSystem::RetireBank(int bankId)
+{
+    std::shared_ptr<VabBank>& b = banks[bankId];
+    if (!b) return;
+
+    // SEQ этого банка и его голоса; остальные банки звучат дальше
+    seqPlayer.StopBank(b.get());
+    spu.StopAllVoices(bankId);
+
+    std::shared_ptr<const void> source;
+    if (bankId == MUSIC_BANK) source = std::move(musicSource);
+    retiredBanks.push_back({ std::move(b), std::move(source), spu.GetPostedCount() });
+}
+
+void AudioSystem::SetBank(int bankId, std::shared_ptr<VabBank> newBank)
+{
+    RetireBank(bankId);
+    banks[bankId] = std::move(newBank);
+    if (bankId == MUSIC_BANK)
+        this->currentVabMasterVol = banks[bankId]->masterVol;
+}
+
+const VabBank* AudioSystem::GetBank(int bankId) const
+{
+    if (bankId < 0 || bankId >= AUDIO_BANK_COUNT) return nullptr;
+    return banks[bankId].get();
+}
+
 void AudioSystem::PlaySfx(int index, float volume, float pitch)
 {
     if (index >= 0 && index < sounds.size())
@@ -172,82 +228,283 @@ void AudioSystem::PlaySfx(int index, float volume, float pitch)
     }
 }
 
-int AudioSystem::PlayMusic(const ByteArray& seqData)
+int AudioSystem::PlayMusic(std::shared_ptr<const SeqTrack> track, uint32_t startTick)
 {
-    
-    return seqPlayer.Play(seqData, 0);
+    const VabBank* bank = banks[MUSIC_BANK].get();
+    // Прежний трек мог играть с этим же банком (тот же VAB из кеша) - снимаем его и его ноты.
+    // Звуки других банков играют дальше
+    if (musicSource) {
+        seqPlayer.StopBank(bank);
+        spu.StopAllVoices(MUSIC_BANK);
+        retiredBanks.push_back({ nullptr, std::move(musicSource), spu.GetPostedCount() });
+    }
+
+    const int result = seqPlayer.Play(track.get(), MUSIC_BANK, bank, startTick);
+    if (result >= 0) musicSource = std::move(track);
+    return result;
 }
 
 void AudioSystem::Update()
 {
-    seqPlayer.Update(GetFrameTime(), this);
+    // SEQ играет в колбэке звука - здесь только уборка
+    ReleaseRetiredBanks();
+    AcceptPrefetchedVabs();
+
+    const uint32_t failed = seqPlayer.GetFailedStarts();
+    if (failed != reportedSeqFailures) {
+        TraceLog(LOG_WARNING, "SEQ: %u track(s) dropped (all slots busy) or stopped (runaway zero-delay events)",
+            failed - reportedSeqFailures);
+        reportedSeqFailures = failed;
+    }
+}
+
+void AudioSystem::RequestVab(const std::string& archivePath, int vh, int vb, UploadPriority priority,
+    GpuUploadQueue::CancelToken cancel)
+{
+    const std::string key = VabCache::MakeKey(archivePath, vh, vb);
+    if (vabCache.Contains(key) || !vabRequests.insert(key).second) return;
+
+    // Пул распаковки VAG создаётся здесь, в главном потоке: рабочий его только использует
+    if (!decodePool) decodePool = std::make_unique<ThreadPool>();
+
+    // Без cancel в очереди: отменённое задание всё равно отчитывается, чтобы снять ключ из vabRequests
+    const SampleFormat format = sampleFormat;
+    Game::g_UploadQueue.Decode(priority, [this, key, archivePath, vh, vb, format, cancel]() {
+        std::shared_ptr<VabBank> bank;
+        if (!GpuUploadQueue::IsCancelled(cancel)) {
+            auto tFile = ResourceManager::LoadTFile(archivePath);
+            if (tFile && vh >= 0 && vb >= 0 &&
+                static_cast<size_t>(vh) < tFile->getNumFiles() && static_cast<size_t>(vb) < tFile->getNumFiles())
+                bank = DecodeVab(tFile->getFile(vh), tFile->getFile(vb), format);
+        }
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        prefetchedVabs.push_back(PrefetchedVab{ key, GpuUploadQueue::IsCancelled(cancel) ? nullptr : std::move(bank) });
+        });
+}
+
+void AudioSystem::AcceptPrefetchedVabs()
+{
+    std::vector<PrefetchedVab> ready;
+    {
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        if (prefetchedVabs.empty()) return;
+        ready.swap(prefetchedVabs);
+    }
+    for (auto& r : ready) {
+        vabRequests.erase(r.key);
+        // LoadVab мог успеть распаковать тот же банк сам - его и оставляем
+        if (r.bank && !vabCache.Contains(r.key))
+            vabCache.Insert(r.key, std::move(r.bank));
+    }
+}
+
+void AudioSystem::ReleaseRetiredBanks()
+{
+    if (retiredBanks.empty()) return;
+    const uint64_t applied = spu.GetSnapshot().appliedCommands;
+    retiredBanks.erase(std::remove_if(retiredBanks.begin(), retiredBanks.end(),
+        [applied](const RetiredBank& r) { return applied >= r.stopCommand; }), retiredBanks.end());
 }
 
 void AudioSystem::PlaySample(int program, float note, float volume, float pan, int channel)
 {
-    if (program < 0 || program >= 128) return;
-    Program& prog = programs[program];
+    const VabBank* bank = banks[MUSIC_BANK].get();
+    if (!bank) return;
+    SpuCommand notes[16];
+    const int count = bank->MakeNoteOn(program, note, volume, pan, notes);
+    for (int i = 0; i < count; ++i) {
+        notes[i].bankId = MUSIC_BANK;
+        notes[i].source = SpuVoiceSource::Music;
+        if (channel >= 0 && channel < 16) {
+            notes[i].channel = (int8_t)channel;
+            notes[i].bend = channelBends[channel];
+        }
+        spu.PlayNote(notes[i]);
+    }
+}
 
-    //   ,     
-    for (int i = 0; i < prog.toneCount; ++i) {
+uint32_t AudioSystem::PlaySoundEffect(int program, int note, float volume, float pan, int bankId, SpuVoiceSource source)
+{
+    const VabBank* bank = GetBank(bankId);
+    if (!bank) return 0;
+    SpuCommand notes[16];
+    const int count = bank->MakeNoteOn(program, (float)note, volume * bank->masterVol, pan, notes);
+    return PostSoundEffect(notes, count, bankId, source);
+}
+
+uint32_t AudioSystem::PlaySoundEffect3D(int program, int note, float gain, float pan, float pitchScale, int bankId)
+{
+    const VabBank* bank = GetBank(bankId);
+    if (!bank) return 0;
+    SpuCommand notes[16];
+    // volume - громкость программы: на неё потом множит gain каждый SetVoice3D
+    const int count = bank->MakeNoteOn(program, (float)note, bank->masterVol, pan, notes);
+    for (int i = 0; i < count; ++i) {
+        notes[i].gain = gain;
+        notes[i].pitchScale = pitchScale;
+    }
+    return PostSoundEffect(notes, count, bankId, SpuVoiceSource::Sfx);
+}
+
+uint32_t AudioSystem::PostSoundEffect(SpuCommand* notes, int count, int bankId, SpuVoiceSource source)
+{
+    // Все тоны звука под одним handle: StopVoice и SetVoice3D достают каждый
+    uint32_t handle = 0;
+    for (int i = 0; i < count; ++i) {
+        notes[i].bankId = (int8_t)bankId;
+        notes[i].source = source;
+        notes[i].handle = handle;
+        const uint32_t posted = spu.PlayNote(notes[i]);
+        if (handle == 0) handle = posted;
+    }
+    return handle;
+}
+
+int VabBank::MakeNoteOn(int program, float note, float volume, float pan, SpuCommand (&out)[16]) const
+{
+    if (program < 0 || program >= 128) return 0;
+    const Program& prog = programs[program];
+
+    // Играем ВСЕ тона, которые подходят под эту ноту
+    int count = 0;
+    for (int i = 0; i < prog.toneCount && count < 16; ++i) {
         const Tone& tone = prog.tones[i];
         if (note >= tone.minNote && note <= tone.maxNote) {
             float shift = (note - (float)tone.centerNote) + ((float)tone.fineTune / 128.0f);
-            float pitch = powf(2.0f, shift / 12.0f);
 
-            //    
-            float finalVol = volume * ((float)tone.vol / 127.0f) * 0.7f;
-
-            spu.PlayNote(&tone, pitch, finalVol, false, pan, (int)note, program);
+            SpuCommand& c = out[count++];
+            c = SpuCommand();
+            c.type = SpuCommandType::NoteOn;
+            c.tone = &tone;
+            c.pitch = powf(2.0f, shift / 12.0f);
+            // Используем громкость конкретного тона
+            c.volume = volume * ((float)tone.vol / 127.0f) * 0.7f;
+            c.pan = pan;
+            c.note = (uint8_t)note;
+            c.program = program;
         }
     }
+    return count;
 }
 
 
-bool AudioSystem::IsProgramReady(int program)
+bool AudioSystem::IsProgramReady(int program, int bankId)
 {
-    if (program < 0 || program >= 128) return false;
-    return programs[program].toneCount > 0;
+    const VabBank* bank = GetBank(bankId);
+    if (program < 0 || program >= 128 || !bank) return false;
+    return bank->programs[program].toneCount > 0;
 }
 
 
-bool AudioSystem::LoadVab(const ByteArray& vhData, const ByteArray& vbData)
+bool AudioSystem::LoadVab(const ByteArray& vhData, const ByteArray& vbData, int bankId)
 {
-    UnloadAll();
-    for (int i = 0; i < 128; i++) programs[i].toneCount = 0;
+    if (bankId < 0 || bankId >= AUDIO_BANK_COUNT) return false;
 
-    if (vhData.size() < 2080) return false;
+    auto decoded = DecodeVab(vhData, vbData, sampleFormat);
+    if (!decoded) {
+        RetireBank(bankId);
+        return false;
+    }
+    SetBank(bankId, std::move(decoded));
+    return banks[bankId]->mappedPrograms > 0;
+}
+
+bool AudioSystem::LoadVab(const std::string& archivePath, int vh, int vb, int bankId)
+{
+    if (bankId < 0 || bankId >= AUDIO_BANK_COUNT) return false;
+
+    const std::string key = VabCache::MakeKey(archivePath, vh, vb);
+
+    // Предзагрузка могла закончиться после последнего Update
+    AcceptPrefetchedVabs();
+    auto cached = vabCache.Find(key);
+    if (!cached)
+    {
+        auto tFile = ResourceManager::LoadTFile(archivePath);
+        if (!tFile || vh < 0 || vb < 0 ||
+            static_cast<size_t>(vh) >= tFile->getNumFiles() || static_cast<size_t>(vb) >= tFile->getNumFiles()) {
+            TraceLog(LOG_WARNING, "VAB: pair %i/%i is out of range for %s", vh, vb, archivePath.c_str());
+            return false;
+        }
+        cached = DecodeVab(tFile->getFile(vh), tFile->getFile(vb), sampleFormat);
+        if (!cached) return false;
+        vabCache.Insert(key, cached);
+    }
+
+    // Тот же банк уже в слоте - музыка продолжает играть с ним
+    if (banks[bankId] != cached)
+        SetBank(bankId, cached);
+    return cached->mappedPrograms > 0;
+}
+
+std::shared_ptr<VabBank> AudioSystem::DecodeVab(const ByteArray& vhData, const ByteArray& vbData, SampleFormat format)
+{
+    if (vhData.size() < 2080) return nullptr;
+
+    auto newBank = std::make_shared<VabBank>();
+    Program* programs = newBank->programs;
+    SamplePool& samplePool = newBank->samples;
 
-    // 1. 
+    // 1. Заголовки
     uint16_t progCount = *reinterpret_cast<const uint16_t*>(vhData.data() + 18);
     uint16_t vagCount = *reinterpret_cast<const uint16_t*>(vhData.data() + 22);
 
-    // ---  1:  (  32768) ---
-    std::vector<std::vector<float>> allSamples;
+    // --- ЭТАП 1: НАРЕЗКА (Делим на 32768) ---
     size_t offsetTableAddr = 2080 + (static_cast<size_t>(progCount) * 512) + 2;
+    if (offsetTableAddr + static_cast<size_t>(vagCount) * 2 > vhData.size()) return nullptr;
     const uint16_t* sizeTable = reinterpret_cast<const uint16_t*>(vhData.data() + offsetTableAddr);
-    uint32_t currentOffset = 0;
 
+    // Смещения считаем заранее - дальше каждый VAG независим и пишет только в свой слот
+    std::vector<uint32_t> vagOffsets(vagCount), vagSizes(vagCount);
+    uint32_t currentOffset = 0;
     for (int i = 0; i < vagCount; ++i) {
-        uint32_t vagSize = static_cast<uint32_t>(sizeTable[i]) * 8;
-        std::vector<float> floatData;
-        if (vagSize > 16) {
-            std::vector<int16_t> pcm = DecodeADPCM(vbData.data() + currentOffset, vagSize);
-            for (int16_t s : pcm) floatData.push_back((float)s / 32768.0f);
-        }
-        allSamples.push_back(floatData);
-        currentOffset += vagSize;
+        vagOffsets[i] = currentOffset;
+        vagSizes[i] = static_cast<uint32_t>(sizeTable[i]) * 8;
+        currentOffset += vagSizes[i];
     }
 
+    samplePool.Resize(vagCount);
+    auto decodeVag = [&](size_t i) {
+        uint32_t vagSize = vagSizes[i];
+        if (vagSize <= 16 || vagOffsets[i] + vagSize > vbData.size()) return;
+        // Сразу в формат хранения банка, без промежуточных копий
+        const uint8_t* vag = vbData.data() + vagOffsets[i];
+        if (format == SampleFormat::Adpcm) {
+            // Без декодирования: голоса распакуют блоки сами, когда до них дойдут
+            samplePool.SetAdpcm(i, std::vector<uint8_t>(vag, vag + vagSize));
+            return;
+        }
+        // Петля из флагов блоков: запас после сэмпла повторяет её начало
+        const AdpcmLoop loop = PsxAdpcm::ScanLoop(vag, vagSize);
+        const size_t count = loop.blocks * ADPCM_BLOCK_SAMPLES;
+        const uint32_t loopStart = loop.looped ? (uint32_t)loop.LoopStartSample() : SPU_NO_LOOP;
+        if (format == SampleFormat::Int16) {
+            auto samples = SamplePool::MakePadded<int16_t>(count);
+            PsxAdpcm::Decode(vag, vagSize, samples.data() + SPU_GUARD_SAMPLES);
+            samplePool.SetPadded(i, std::move(samples), loopStart);
+        }
+        else {
+            auto samples = SamplePool::MakePadded<float>(count);
+            PsxAdpcm::Decode(vag, vagSize, samples.data() + SPU_GUARD_SAMPLES);
+            samplePool.SetPadded(i, std::move(samples), loopStart);
+        }
+    };
+
+    if (!decodePool) decodePool = std::make_unique<ThreadPool>();
+    decodePool->ParallelFor(vagCount, decodeVag);
+
     uint8_t vabMainVol = vhData[24];
-    this->currentVabMasterVol = (float)vabMainVol / 127.0f;
+    newBank->masterVol = (float)vabMainVol / 127.0f;
 
     
 
-    // ---  2:  (Sony libsnd Standard) ---
+    // --- ЭТАП 2: МАППИНГ (Sony libsnd Standard) ---
     const uint8_t* progAttrPtr = vhData.data() + 32;
     const uint8_t* toneAttrPtr = vhData.data() + 2080;
 
+    // MakeADSR прогоняет огибающую по сэмплам - одинаковые регистры считаем один раз
+    std::unordered_map<uint32_t, AdsrSettings> adsrSeconds;
+
     int totalMapped = 0;
     for (int p = 0; p < 128; p++) {
         uint8_t numTones = progAttrPtr[p * 16];
@@ -262,14 +519,16 @@ bool AudioSystem::LoadVab(const ByteArray& vhData, const ByteArray& vbData)
             const uint8_t* toneData = toneGroup + (t * 32);
             uint16_t vagID = *reinterpret_cast<const uint16_t*>(toneData + 22);
 
-            if (vagID -1 < allSamples.size() && !allSamples[vagID].empty())
+            // Номера VAG в тонах с единицы
+            SampleRef sample = (vagID > 0) ? samplePool.Get(vagID - 1) : SampleRef();
+            if (!sample.empty())
             {
                 Tone& tone = programs[p].tones[added];
-                tone.data = allSamples[vagID -1];
+                tone.data = sample;   // ссылка, не копия
                 
                 tone.sampleCount = (uint32_t)tone.data.size();
                 tone.type = InstrumentType::Sample;
-                tone.loop = false;
+                tone.loop = sample.looped();   // петля VAG (флаги блоков); голос берёт её из сэмпла
 
                 uint8_t toneVol = toneData[2];
                 float volFactor = ((float)progVol / 127.0f) * ((float)toneVol / 127.0f);
@@ -277,18 +536,18 @@ bool AudioSystem::LoadVab(const ByteArray& vhData, const ByteArray& vbData)
                 if (tone.vol == 0)
                 {
                     TraceLog(LOG_WARNING, "tone vol = 0!  set 100");
-                    tone.vol = 100; // 
+                    tone.vol = 100; // Защита
                 }
 
-                // :  KF min/max   
+                // Важно: в KF min/max могут быть перепутаны
                 uint8_t n1 = toneData[6];
                 uint8_t n2 = toneData[7];
                 tone.minNote = (n1 < n2) ? n1 : n2;
                 tone.maxNote = (n1 > n2) ? n1 : n2;
-                //   KF min > max ( 127  0),   
+                // Если в KF min > max (например 127 и 0), меняем их местами
                 if (tone.minNote > tone.maxNote) std::swap(tone.minNote, tone.maxNote);
 
-                //  0  0 ( 0  127),   
+                // Если 0 и 0 (или 0 и 127), ставим полный диапазон
                 if (tone.maxNote == 0) tone.maxNote = 127;
 
                 tone.centerNote = toneData[4];
@@ -299,12 +558,19 @@ bool AudioSystem::LoadVab(const ByteArray& vhData, const ByteArray& vbData)
                 uint16_t ADSR1 = *reinterpret_cast<const uint16_t*>(toneData + 16);
                 uint16_t ADSR2 = *reinterpret_cast<const uint16_t*>(toneData + 18);
 
-                AdsrSettings asdr = spu.MakeADSR(ADSR1, ADSR2);
+                // Голос ведёт огибающую прямо по регистрам, секунды - только для справки
+                tone.adsr1 = ADSR1;
+                tone.adsr2 = ADSR2;
+                const uint32_t adsrKey = ((uint32_t)ADSR1 << 16) | ADSR2;
+                auto adsrIt = adsrSeconds.find(adsrKey);
+                if (adsrIt == adsrSeconds.end())
+                    adsrIt = adsrSeconds.emplace(adsrKey, spu.MakeADSR(ADSR1, ADSR2)).first;
+                const AdsrSettings& asdr = adsrIt->second;
 
-                tone.attack = asdr.attack;  // 5 ()
-                tone.decay = asdr.decay;     // 
-                tone.sustain = asdr.sustain;   //  
-                tone.release = asdr.release;   //  
+                tone.attack = asdr.attack;  // 5мс (быстро)
+                tone.decay = asdr.decay;     // Неважно
+                tone.sustain = asdr.sustain;   // Полная громкость
+                tone.release = asdr.release;   // Средний хвост
 
 
                // printf("a <%f> | d <%f> | s <%f> r | <%f>\n", tone.attack, tone.decay, tone.sustain, tone.release);
@@ -314,7 +580,56 @@ bool AudioSystem::LoadVab(const ByteArray& vhData, const ByteArray& vbData)
         programs[p].toneCount = added;
         if (added > 0) totalMapped++;
     }
-    return totalMapped > 0;
+    newBank->mappedPrograms = totalMapped;
+    return newBank;
+}
+
+std::shared_ptr<VabBank> VabCache::Find(const std::string& key)
+{
+    auto it = index.find(key);
+    if (it == index.end()) return nullptr;
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->bank;
+}
+
+void VabCache::Insert(const std::string& key, std::shared_ptr<VabBank> bank)
+{
+    auto it = index.find(key);
+    if (it != index.end()) {
+        bytes -= it->second->bytes;
+        entries.erase(it->second);
+        index.erase(it);
+    }
+
+    const size_t bankBytes = bank->GetMemoryBytes();
+    entries.push_front(Entry{ key, std::move(bank), bankBytes });
+    index[key] = entries.begin();
+    bytes += bankBytes;
+    Trim();
+}
+
+void VabCache::SetBudget(size_t newBudget)
+{
+    budget = newBudget;
+    Trim();
+}
+
+void VabCache::Trim()
+{
+    // Самый свежий не трогаем, даже если он один больше бюджета
+    while (bytes > budget && entries.size() > 1) {
+        const Entry& last = entries.back();
+        bytes -= last.bytes;
+        index.erase(last.key);
+        entries.pop_back();
+    }
+}
+
+void VabCache::Clear()
+{
+    entries.clear();
+    index.clear();
+    bytes = 0;
 }
 
 void AudioSystem::Play(int index)
@@ -323,7 +638,7 @@ void AudioSystem::Play(int index)
     {
         if (IsSoundValid(sounds[index]))
         {
-            //   ,    (  )
+            // Небольшая рандомизация питча, чтобы звучало живее (как в игре)
             SetSoundPitch(sounds[index], 1.0f);
             PlaySound(sounds[index]);
         }
@@ -379,61 +694,9 @@ Sound AudioSystem::GetSound(int index)
 
 std::vector<int16_t> AudioSystem::DecodeADPCM(const uint8_t* src, size_t size)
 {
-    std::vector<int16_t> buffer;
-    buffer.reserve(size * 4); //  
-
-    double s_1 = 0.0; //  
-    double s_2 = 0.0; // - 
-
-    //    16 
-    for (size_t i = 0; i < size; i += 16)
-    {
-        //      
-        if (i + 16 > size) break;
-
-        const uint8_t* block = src + i;
-
-        //  0:    
-        int shift = block[0] & 0x0F;
-        int filter = (block[0] >> 4) & 0x0F;
-
-        //  1: 
-        uint8_t flags = block[1];
-
-        //   ( 5,   - )
-        if (filter >= 5) filter = 0;
-
-        //  28  (14  )
-        for (int j = 2; j < 16; ++j)
-        {
-            uint8_t byte = block[j];
-
-            //     (nibbles)
-            for (int k = 0; k < 2; ++k) {
-                int8_t nibble = (k == 0) ? (byte & 0x0F) : (byte >> 4);
-
-                //   4- -> 8-
-                if (nibble & 0x08) nibble |= 0xF0;
-
-                double sample = (double)(nibble << (12 - shift));
-                double output = sample + s_1 * K0[filter] + s_2 * K1[filter];
-
-                s_2 = s_1;
-                s_1 = output;
-
-                buffer.push_back(MATH::Clamp16((int32_t)output));
-            }
-        }
-
-        // ===   ===
-        //    (Bit 0)
-        //   == 1 (Loop End)  3 (Loop End + Loop Start),   ,
-        //     .      .
-        if ((flags & 1) != 0) {
-            break; //  ,   
-        }
-    }
-
+    // Размер известен заранее: 28 сэмплов на блок до флага конца
+    std::vector<int16_t> buffer(PsxAdpcm::CountSamples(src, size));
+    PsxAdpcm::Decode(src, size, buffer.data());
     return buffer;
 }
 
@@ -443,22 +706,13 @@ void AudioSystem::SetPitchBend(int channel, float bend)
 
     channelBends[channel] = bend;
 
-    //   ,      
-    for (int i = 0; i < SPU_VOICES_COUNT; i++) {
-        if (spu.voices[i].active && spu.voices[i].parentProgramID == channel) {
-            spu.UpdateVoicePitch(i, bend);
-        }
-    }
+    // Обновляем все голоса, которые сейчас звучат на этом канале
+    spu.SetChannelBend(channel, bend, MUSIC_BANK);
 }
 
-void AudioSystem::NoteOff(int prog, int note)
+void AudioSystem::NoteOff(int prog, int note, int bankId)
 {
-    for (int i = 0; i < SPU_VOICES_COUNT; i++) {
-        auto& v = spu.voices[i];
-        if (v.active && v.parentProgramID == prog && v.currentNote == (uint8_t)note) {
-            v.NoteOff(); //     Release
-        }
-    }
+    spu.ReleaseNote(prog, note, bankId);
 }
 
 int SeqPlayer::FindFreeSlot()
@@ -475,46 +729,46 @@ bool SeqPlayer::Load(const ByteArray& data, int slot)
 {
     if (data.size() < 15) return false;
 
-    //    (83 = 'S', 112 = 'p'    )
+    // Проверка магического числа (83 = 'S', 112 = 'p' в зависимости от порядка)
     if (Utilities::fileIsSEQ(data)) {
         std::cerr << "This is not SEQ Data." << std::endl;
         return false;
     }
     
-    // 2.   ( IDA: seqData[7] == 1)
+    // 2. Проверка версии (в IDA: seqData[7] == 1)
     uint32_t version = data[7];
     if (version != 1) {
         std::cerr << "Unsupported SEQ version: " << version << std::endl;
         return false;
     }
 
-    // 3.  Resolution (TPQN) -  8  9
-    //  IDA: v10 = seqData[8]; v5+74 = seqData[9] | (v10 << 8)
-    //  Big-Endian!
+    // 3. Чтение Resolution (TPQN) - смещение 8 и 9
+    // В IDA: v10 = seqData[8]; v5+74 = seqData[9] | (v10 << 8)
+    // Это Big-Endian!
     int slotIdx = FindFreeSlot();
     if (slotIdx == -1) return -1;
 
     SeqSlot& s = slots[slotIdx];
     s.resolution = (static_cast<uint16_t>(data[8]) << 8) | data[9];
 
-    // 4.   () -  10, 11, 12
-    //  IDA: (v12 << 16) | (v13 << 8) | v11[2]
+    // 4. Чтение темпа (Микросекунды) - смещение 10, 11, 12
+    // В IDA: (v12 << 16) | (v13 << 8) | v11[2]
     uint32_t rawTempo = (static_cast<uint32_t>(data[10]) << 16) |
         (static_cast<uint32_t>(data[11]) << 8) |
         data[12];
 
-    //   IDA: v14 = 60,000,000 / rawTempo
+    // Формула из IDA: v14 = 60,000,000 / rawTempo
     if (rawTempo > 0) {
         s.tempo = rawTempo;
        // s.bpm = 60000000.0 / static_cast<double>(rawTempo);
     }
 
-    // 5.  
-    //  IDA  : *(_DWORD *)(v5 + 4) = v11 + 3;
-    //   SEQ   15-  (0x0F)
+    // 5. Начало данных
+    // В IDA указатель смещается: *(_DWORD *)(v5 + 4) = v11 + 3;
+    // Обычно данные SEQ начинаются с 15-го байта (0x0F)
     //s.dataOffset = 15;
 
-    //     IDA ( do-while  16)
+    // Инициализация каналов как в IDA (цикл do-while до 16)
     for (int i = 0; i < 16; ++i) {
         s.channels[i].volume = 127; // v6 + 78 = 127
         s.channels[i].pan = 64;    // v7 + 23 = 64
@@ -525,10 +779,16 @@ bool SeqPlayer::Load(const ByteArray& data, int slot)
 
 
 void SeqPlayer::StopAll() {
-    for (int i = 0; i < 16; ++i) {
-        slots[i].active = false;
-        slots[i].pData = nullptr;
-    }
+    StopBank(nullptr);
+}
+
+void SeqPlayer::StopBank(const VabBank* bank)
+{
+    if (!spu) return;
+    SpuCommand c;
+    c.type = SpuCommandType::SeqStop;
+    c.bank = bank;
+    spu->Post(c);
 }
 
 SeqPlayer::SeqPlayer()
@@ -536,211 +796,484 @@ SeqPlayer::SeqPlayer()
     for (int i = 0; i < 16; ++i) slots[i].active = false;
 }
 
-
-void SeqPlayer::Update(float deltaTime, AudioSystem* system)
+void SeqPlayer::Attach(PsxSpu* target)
 {
-    for (int i = 0; i < 16; ++i) {
-        if (!slots[i].active) continue;
-        SeqSlot& s = slots[i];
-
-        float bpm = 60000000.0f / (float)s.tempo;
-        float ticksPerSec = (bpm * (float)s.resolution) / 60.0f;
-        s.tickAccumulator += deltaTime * ticksPerSec;
-
-        //   ,   Delta Time = 0
-        while (s.active && s.tickAccumulator >= (float)s.waitTicks) {
-            s.tickAccumulator -= (float)s.waitTicks;
-            if (!ParseNextEvent(s, system)) {
-                s.active = false;
-            //    break;
-            }
-            // ParseNextEvent    waitTicks  .
-            //   0,    .
-        }
-    }
+    spu = target;
+    if (spu) spu->SetSequencer(this);
 }
 
-int SeqPlayer::Play(const ByteArray& data, uint16_t vabID)
+int SeqPlayer::Play(const SeqTrack* track, uint16_t vabID, const VabBank* bank, uint32_t startTick)
 {
-    if (data.size() < 15)
+    if (!track || track->events.empty())
     {
-        printf(" SeqPlayer::Play data.size() < 15  \n");
+        TraceLog(LOG_WARNING, "SeqPlayer::Play: empty track");
         return -1;
     }
 
-    if (!Utilities::fileIsSEQ(data)) {
-        std::cerr << "Not a valid King's Field SEQ file." << std::endl;
-        return -1;
+    if (!spu || !bank) return -1;
+
+    // Слот выберет аудиопоток
+    SpuCommand c;
+    c.type = SpuCommandType::SeqPlay;
+    c.track = track;
+    c.bank = bank;
+    c.program = vabID;
+    c.tick = startTick;
+    if (!spu->Post(c)) return -1;
+    playingTrack = track;
+    return 0;
+}
+
+void SeqPlayer::Seek(uint32_t tick)
+{
+    if (!spu) return;
+    SpuCommand c;
+    c.type = SpuCommandType::SeqSeek;
+    c.tick = tick;
+    spu->Post(c);
+}
+
+void SeqPlayer::SeekSeconds(double seconds)
+{
+    if (playingTrack) Seek(playingTrack->SecondsToTicks(seconds));
+}
+
+double SeqPlayer::GetPositionSeconds() const
+{
+    return playingTrack ? playingTrack->TicksToSeconds(GetPositionTicks()) : 0.0;
+}
+
+void SeqPlayer::Apply(const SpuCommand& c)
+{
+    if (c.type == SpuCommandType::SeqPlay) {
+        Start(c);
+    }
+    else if (c.type == SpuCommandType::SeqSeek) {
+        if (primarySlot >= 0 && slots[primarySlot].active) {
+            // Ноты старой позиции не обрываем, а отпускаем; звуки других банков не трогаем
+            SpuCommand release;
+            release.type = SpuCommandType::ReleaseAll;
+            release.bankId = (int8_t)slots[primarySlot].vabID;
+            spu->Apply(release);
+            Restore(slots[primarySlot], c.tick);
+            positionTicks.store(slots[primarySlot].tick, std::memory_order_relaxed);
+        }
+    }
+    else {
+        for (int i = 0; i < 16; ++i) {
+            if (c.bank && slots[i].bank != c.bank) continue;
+            slots[i].active = false;
+            slots[i].track = nullptr;
+            slots[i].bank = nullptr;
+        }
     }
+    UpdatePlaying();
+}
+
+void SeqPlayer::UpdatePlaying()
+{
+    bool any = false;
+    for (int i = 0; i < 16; ++i) any |= slots[i].active;
+    playing.store(any, std::memory_order_relaxed);
+}
 
+void SeqPlayer::Start(const SpuCommand& c)
+{
+    // Аудиопоток: без printf, отказ считает счётчик, в лог пишет AudioSystem::Update
     int slotIdx = FindFreeSlot();
     if (slotIdx == -1)
     {
-        printf(" SeqPlayer::Play slotIdx == -1  \n");
-        return -1;
+        failedStarts.fetch_add(1, std::memory_order_relaxed);
+        return;
     }
 
     SeqSlot& s = slots[slotIdx];
+    const SeqTrack* track = static_cast<const SeqTrack*>(c.track);
 
-    s.pData = data.data();
-    s.dataSize = (uint32_t)data.size();
-    s.vabID = vabID;
+    s.track = track;
+    s.vabID = (uint16_t)c.program;
+    s.bank = static_cast<const VabBank*>(c.bank);
 
-    //  
-    s.resolution = (static_cast<uint16_t>(data[8]) << 8) | data[9];
-    uint32_t rawTempo = (static_cast<uint32_t>(data[10]) << 16) |
-        (static_cast<uint32_t>(data[11]) << 8) |
-        data[12];
-    s.tempo = (rawTempo > 0) ? rawTempo : 500000;
+    s.resolution = track->resolution;
+    s.active = (s.bank != nullptr);
+    loopCount.store(0, std::memory_order_relaxed);
 
-    //  
-    for (int i = 0; i < 16; ++i) {
-        s.channels[i].volume = 127;
-        s.channels[i].program = 0;
+    s.masterVolFactor = (float)track->masterVol / 127.0f;
+    if (s.masterVolFactor <= 0) s.masterVolFactor = 1.0f;
+
+    // Каналы, темп и курсор - из снимка (с начала трека - значения по умолчанию)
+    Restore(s, c.tick);
+    primarySlot = slotIdx;
+    positionTicks.store(s.tick, std::memory_order_relaxed);
+}
+
+// Событие, которое меняет только состояние канала или темп; false - не такое
+static bool ApplyState(SeqChannelState (&channels)[16], uint32_t& tempo, const SeqEvent& e)
+{
+    SeqChannelState& ch = channels[e.channel];
+    switch (e.type) {
+    case SeqEventType::Volume:     ch.volume = e.a; return true;
+    case SeqEventType::Pan:        ch.pan = e.a; return true;   // 0..127, 64 = центр
+    case SeqEventType::Expression: ch.expression = e.a; return true;
+    case SeqEventType::Program:    ch.program = e.a; return true;
+    case SeqEventType::PitchBend:  ch.bend = (int16_t)e.value; return true;
+    case SeqEventType::Tempo:      tempo = (uint32_t)e.value; return true;
+    default: return false;
     }
-    // -------------------------------
+}
 
-    s.currentPos = 15;    //  
-    s.runningStatus = 0;  //  
-    s.active = true;
-    s.tickAccumulator = 0;
+// Повторы петли из CC 6: 0 и 127 - бесконечно
+static int32_t LoopRepeats(uint8_t count)
+{
+    return (count == 0 || count == 127) ? -1 : count;
+}
 
-    uint8_t seqMasterVol = data[13]; //   -
-    s.masterVolFactor = (float)seqMasterVol / 127.0f;
-    if (s.masterVolFactor <= 0) s.masterVolFactor = 1.0f;
+void SeqPlayer::Restore(SeqSlot& s, uint32_t tick)
+{
+    const SeqTrack& t = *s.track;
+    if (tick > t.lengthTicks) tick = t.lengthTicks;
+
+    const SeqStateSnapshot& snap = t.FindSnapshot(tick);
+    s.tempo = snap.tempo;
+    for (int i = 0; i < 16; ++i) s.channels[i] = snap.channels[i];
+    s.loopIndex = snap.loopIndex;
+    s.loopsLeft = (snap.loopIndex >= 0) ? LoopRepeats(t.events[snap.loopIndex].a) : 0;
+
+    // От снимка до tick - не больше интервала снимков; ноты пропускаем.
+    // Последнее событие стоит на lengthTicks, поэтому цикл не выходит за массив
+    uint32_t i = snap.eventIndex;
+    for (; t.events[i].tick < tick; ++i) {
+        if (ApplyState(s.channels, s.tempo, t.events[i])) continue;
+        if (t.events[i].type == SeqEventType::LoopStart) {
+            s.loopIndex = (int32_t)i;
+            s.loopsLeft = LoopRepeats(t.events[i].a);
+        }
+    }
 
-    
-    //  pData  ,  ReadVLQ !
-    s.waitTicks = ReadVLQ(s.pData, s.currentPos, s.dataSize);
-    //printf("masterVolFactor <%f>  \t\r", s.masterVolFactor);
-    //TraceLog(LOG_INFO, "SEQ Started: %d bytes, Resolution=%d", s.dataSize, s.resolution);
+    s.cursor = i;
+    s.tick = tick;
+    s.position = tick;
+    s.samplesToEvent = (t.events[i].tick - tick) * SamplesPerTick(s);
+}
+
+void SeqPlayer::BuildSnapshots(SeqTrack& track)
+{
+    SeqStateSnapshot state;
+    state.tempo = track.tempo;
+
+    const uint32_t count = track.lengthTicks / track.snapshotTicks + 1;
+    track.snapshots.reserve(count);
+    uint32_t e = 0;
+    for (uint32_t k = 0; k < count; ++k) {
+        const uint32_t boundary = k * track.snapshotTicks;
+        for (; track.events[e].tick < boundary; ++e) {
+            if (!ApplyState(state.channels, state.tempo, track.events[e])
+                && track.events[e].type == SeqEventType::LoopStart)
+                state.loopIndex = (int32_t)e;
+        }
+        state.tick = boundary;
+        state.eventIndex = e;
+        track.snapshots.push_back(state);
+    }
+}
 
-    return slotIdx;
+double SeqTrack::TicksToSeconds(uint32_t tick) const
+{
+    const double resolution = (this->resolution > 0) ? this->resolution : 480.0;
+    double seconds = 0.0;
+    for (size_t i = 0; i < tempoMap.size(); ++i) {
+        const uint32_t from = tempoMap[i].tick;
+        if (from >= tick) break;
+        const uint32_t to = (i + 1 < tempoMap.size() && tempoMap[i + 1].tick < tick) ? tempoMap[i + 1].tick : tick;
+        seconds += (double)(to - from) * tempoMap[i].tempo / 1000000.0 / resolution;
+    }
+    return seconds;
 }
 
-bool SeqPlayer::ParseNextEvent(SeqSlot& s, AudioSystem* system)
+uint32_t SeqTrack::SecondsToTicks(double seconds) const
 {
-    if (s.currentPos >= s.dataSize) return false;
+    const double resolution = (this->resolution > 0) ? this->resolution : 480.0;
+    for (size_t i = 0; i < tempoMap.size(); ++i) {
+        const double secondsPerTick = tempoMap[i].tempo / 1000000.0 / resolution;
+        const bool last = (i + 1 == tempoMap.size());
+        const double span = last ? 0.0 : (tempoMap[i + 1].tick - tempoMap[i].tick) * secondsPerTick;
+        if (last || seconds < span)
+            return tempoMap[i].tick + (uint32_t)(std::max(seconds, 0.0) / secondsPerTick);
+        seconds -= span;
+    }
+    return 0;
+}
 
-    // --- 1.  - ---
-    uint8_t status = s.pData[s.currentPos++];
+double SeqPlayer::SamplesPerTick(const SeqSlot& s)
+{
+    // tempo - микросекунд на четверть, resolution - тиков на четверть
+    const double resolution = (s.resolution > 0) ? s.resolution : 480.0;
+    return (double)SPU_SAMPLE_RATE * (double)s.tempo / 1000000.0 / resolution;
+}
 
-    // Running Status
-    if (status < 0x80) {
-        status = s.runningStatus;
-        s.currentPos--;
+int SeqPlayer::FramesUntilEvent(int maxFrames) const
+{
+    int frames = maxFrames;
+    for (int i = 0; i < 16; ++i) {
+        const SeqSlot& s = slots[i];
+        if (!s.active) continue;
+        if (s.samplesToEvent <= 0.0) return 0;
+        // Событие в дробной позиции играет с ближайшего следующего сэмпла
+        const double wait = std::ceil(s.samplesToEvent);
+        if (wait < frames) frames = (int)wait;
     }
-    else if (status < 0xF0) {
-        s.runningStatus = status;
+    return frames;
+}
+
+void SeqPlayer::Advance(int frames)
+{
+    for (int i = 0; i < 16; ++i) {
+        SeqSlot& s = slots[i];
+        if (!s.active) continue;
+        s.samplesToEvent -= frames;
+        s.position += frames / SamplesPerTick(s);
     }
+    if (primarySlot >= 0 && slots[primarySlot].active)
+        positionTicks.store((uint32_t)slots[primarySlot].position, std::memory_order_relaxed);
+}
 
-    uint8_t event = status & 0xF0;
-    uint8_t chan = status & 0x0F;
+void SeqPlayer::FireDue(PsxSpu& target)
+{
+    for (int i = 0; i < 16; ++i) {
+        SeqSlot& s = slots[i];
 
-    // --- 2.   ---
-    if (event == 0x90) { // Note On
-        uint8_t note = s.pData[s.currentPos++];
-        uint8_t velocity = s.pData[s.currentPos++];
-        if (velocity > 0) 
-        {
-            uint8_t rawPan = s.channels[chan].pan;
-
-            // 2.   float (0.0 - , 1.0 - )
-            float pan = (float)rawPan / 127.0f;
-            float vol = ((float)velocity / 127.0f) *
-                ((float)s.channels[chan].volume / 127.0f) *
-                ((float)s.channels[chan].expression / 127.0f)
-                    * system->currentVabMasterVol;
-            system->PlaySample(s.channels[chan].program, (float)note, vol, pan, chan);
+        // Обрабатываем ВСЕ события, у которых Delta Time = 0.
+        // Предел - от SEQ, в котором вся петля из нулевых задержек
+        int guard = 4096;
+        while (s.active && s.samplesToEvent <= 0.0 && --guard > 0) {
+            const uint32_t index = s.cursor++;
+            const SeqEvent& e = s.track->events[index];
+            s.tick = e.tick;
+            if (!Dispatch(s, e, index, target)) {
+                s.active = false;
+                break;
+            }
+            // Задержка следующего события - уже с новым темпом, если он сменился.
+            // Петля переносит курсор и s.tick, поэтому считаем от s.tick, а не от e.tick
+            s.samplesToEvent += (s.track->events[s.cursor].tick - s.tick) * SamplesPerTick(s);
+            s.position = s.tick;
+        }
+        // Зациклился без задержек - снимаем; счётчик тот же, что у отброшенных стартов
+        if (guard == 0) {
+            s.active = false;
+            failedStarts.fetch_add(1, std::memory_order_relaxed);
         }
-        else
-            system->NoteOff(s.channels[chan].program, note);
     }
-    else if (event == 0x80)
-    { // Note Off
-        //s.currentPos += 2;
-        uint8_t note = s.pData[s.currentPos++];
-        uint8_t vel = s.pData[s.currentPos++];
+    UpdatePlaying();
+}
 
-        //   " "  AudioSystem
-        system->NoteOff(s.channels[chan].program, note);
-    }
-    else if (event == 0xB0) { // Control Change
-        uint8_t controller = s.pData[s.currentPos++];
-        uint8_t value = s.pData[s.currentPos++];
+static void ReleaseNote(PsxSpu& target, int program, int note, int bankId)
+{
+    SpuCommand c;
+    c.type = SpuCommandType::ReleaseNote;
+    c.program = program;
+    c.note = (uint8_t)note;
+    c.bankId = (int8_t)bankId;
+    target.Apply(c);
+}
 
-        if (controller == 7) { // Volume
-            s.channels[chan].volume = value;
-        }
-        else if (controller == 10) { // Pan (0..127, 64 = Center)
-            s.channels[chan].pan = value;
+bool SeqPlayer::Dispatch(SeqSlot& s, const SeqEvent& e, uint32_t index, PsxSpu& target)
+{
+    SeqSlot::Channel& ch = s.channels[e.channel];
+    if (ApplyState(s.channels, s.tempo, e)) {
+        if (e.type == SeqEventType::PitchBend) {
+            // Обновляем питч играющих голосов канала
+            SpuCommand c;
+            c.type = SpuCommandType::ChannelBend;
+            c.channel = (int8_t)e.channel;
+            c.bend = (float)ch.bend / 8192.0f;
+            c.bankId = (int8_t)s.vabID;
+            target.Apply(c);
         }
-        else if (controller == 11) { // Expression
-            s.channels[chan].expression = value; 
+        return true;
+    }
+
+    switch (e.type) {
+    case SeqEventType::NoteOn: {
+        // 2. Переводим в float (0.0 - лево, 1.0 - право)
+        float pan = (float)ch.pan / 127.0f;
+        float vol = ((float)e.b / 127.0f) *
+            ((float)ch.volume / 127.0f) *
+            ((float)ch.expression / 127.0f)
+                * s.bank->masterVol;
+        SpuCommand notes[16];
+        const int count = s.bank->MakeNoteOn(ch.program, (float)e.a, vol, pan, notes);
+        for (int i = 0; i < count; ++i) {
+            notes[i].bankId = (int8_t)s.vabID;   // голоса знают свой банк: NoteOff музыки не трогает звуки
+            notes[i].source = SpuVoiceSource::Music;
+            notes[i].channel = (int8_t)e.channel;
+            notes[i].bend = (float)ch.bend / 8192.0f;   // после Seek бенд восстановлен в ch
+            target.Apply(notes[i]);
         }
+        break;
     }
-    else if (event == 0xC0) { s.channels[chan].program = s.pData[s.currentPos++]; }
-    else if (event == 0xE0) { // Pitch Bend
-        uint8_t lsb = s.pData[s.currentPos++];
-        uint8_t msb = s.pData[s.currentPos++];
-        //    (-8192  +8191)
-        int bendValue = ((msb << 7) | lsb) - 8192;
-        //   ,      
-        
-        
-        system->SetPitchBend(chan, (float)bendValue / 8192.0f);
+    case SeqEventType::NoteOff:
+        // Отпускаем клавишу прямо в голосах
+        ReleaseNote(target, ch.program, e.a, s.vabID);
+        break;
+    case SeqEventType::LoopStart:
+        s.loopIndex = (int32_t)index;
+        s.loopsLeft = LoopRepeats(e.a);
+        break;
+    case SeqEventType::LoopEnd:
+        if (s.loopIndex >= 0 && s.loopsLeft != 0) {
+            if (s.loopsLeft > 0) --s.loopsLeft;
+            loopCount.fetch_add(1, std::memory_order_relaxed);
+            // Назад на событие после LoopStart, тик - тик метки
+            s.cursor = (uint32_t)s.loopIndex + 1;
+            s.tick = s.track->events[s.loopIndex].tick;
+        }
+        break;
+    case SeqEventType::End:
+        // Без printf: это аудиопоток, проходы видны через GetLoopCount
+        loopCount.fetch_add(1, std::memory_order_relaxed);
+        // Трек заново; время и темп продолжают идти от конца трека
+        s.cursor = 0;
+        s.tick = 0;
+        s.loopIndex = -1;
+        s.loopsLeft = 0;
+        break;
+    default:    // Stop
+        return false;
     }
-    else if (status == 0xFF) {
-        uint8_t type = s.pData[s.currentPos++];
-        uint8_t len = s.pData[s.currentPos++];
-        if (type == 0x2F)
-        {
-            printf(" SeqPlayer: Track finished. Looping...\n");
-
-            // 1.      (  )
-            s.currentPos = 15;
+    return true;
+}
 
-            // 2.     
-            s.tickAccumulator = 0;
-            s.runningStatus = 0;
+std::shared_ptr<SeqTrack> SeqPlayer::Compile(const ByteArray& data)
+{
+    if (data.size() < 15 || !Utilities::fileIsSEQ(data)) return nullptr;
+
+    auto track = std::make_shared<SeqTrack>();
+    const uint8_t* p = data.data();
+    const uint32_t size = (uint32_t)data.size();
+
+    // Заголовок: TPQN и темп big-endian
+    track->resolution = (static_cast<uint16_t>(p[8]) << 8) | p[9];
+    uint32_t rawTempo = (static_cast<uint32_t>(p[10]) << 16) |
+        (static_cast<uint32_t>(p[11]) << 8) |
+        p[12];
+    track->tempo = (rawTempo > 0) ? rawTempo : 500000;
+    track->masterVol = p[13]; // Обычно здесь мастер-громкость
+    track->tempoMap.push_back({ 0, track->tempo });
+
+    uint32_t pos = 15;      // Начало данных
+    uint32_t tick = 0;
+    uint8_t runningStatus = 0;
+    uint8_t nrpn = 0;               // последний CC 99
+    int32_t lastLoopStart = -1;     // куда писать число повторов из CC 6
+    // Сколько байт события ещё есть в файле; обрезанное событие - конец трека
+    auto has = [&](uint32_t bytes) { return pos + bytes <= size; };
+    auto emit = [&](SeqEventType type, uint8_t channel, uint8_t a, uint8_t b, int32_t value) {
+        SeqEvent e;
+        e.tick = tick;
+        e.type = type;
+        e.channel = channel;
+        e.a = a;
+        e.b = b;
+        e.value = value;
+        track->events.push_back(e);
+    };
+
+    bool ended = false;
+    if (has(1)) tick += ReadVLQ(p, pos, size);
+    else ended = true;
+
+    while (!ended) {
+        if (!has(1)) break;
+        // --- 1. СТАТУС-БАЙТ ---
+        uint8_t status = p[pos++];
+
+        // Running Status
+        if (status < 0x80) {
+            status = runningStatus;
+            pos--;
+        }
+        else if (status < 0xF0) {
+            runningStatus = status;
+        }
 
-            // 3.      
-            if (s.currentPos < s.dataSize) {
-                s.waitTicks = ReadVLQ(s.pData, s.currentPos, s.dataSize);
+        const uint8_t event = status & 0xF0;
+        const uint8_t chan = status & 0x0F;
+
+        // --- 2. СОБЫТИЕ ---
+        if (event == 0x90 || event == 0x80) {
+            if (!has(2)) break;
+            const uint8_t note = p[pos++];
+            const uint8_t velocity = p[pos++];
+            // Note On с нулевой скоростью - то же, что Note Off
+            if (event == 0x90 && velocity > 0) emit(SeqEventType::NoteOn, chan, note, velocity, 0);
+            else emit(SeqEventType::NoteOff, chan, note, 0, 0);
+        }
+        else if (event == 0xB0) { // Control Change
+            if (!has(2)) break;
+            const uint8_t controller = p[pos++];
+            const uint8_t value = p[pos++];
+            if (controller == 7) emit(SeqEventType::Volume, chan, value, 0, 0);
+            else if (controller == 10) emit(SeqEventType::Pan, chan, value, 0, 0);
+            else if (controller == 11) emit(SeqEventType::Expression, chan, value, 0, 0);
+            else if (controller == 99) { // NRPN: метки петли libsnd
+                nrpn = value;
+                if (value == 20) {
+                    lastLoopStart = (int32_t)track->events.size();
+                    emit(SeqEventType::LoopStart, chan, 0, 0, 0);
+                }
+                else if (value == 30) emit(SeqEventType::LoopEnd, chan, 0, 0, 0);
             }
-            else {
-                return false; //   - 
+            else if (controller == 6 && nrpn == 20 && lastLoopStart >= 0) { // Data Entry: повторы петли
+                track->events[lastLoopStart].a = value;
             }
-
-            // 4.  true,    
-            return true;
         }
-        else if (type == 0x51) {
-            // TEMPO CHANGE:  PS1 SEQ     !
-            //   3  
-            uint32_t val = (s.pData[s.currentPos] << 16) |
-                (s.pData[s.currentPos + 1] << 8) |
-                s.pData[s.currentPos + 2];
-            s.currentPos += 3;
-            s.tempo = val;
+        else if (event == 0xC0) {
+            if (!has(1)) break;
+            emit(SeqEventType::Program, chan, p[pos++], 0, 0);
         }
-        else {
-            //       (  MIDI), 
-            //   PS1  .
-            //uint8_t len = s.pData[s.currentPos++];
-            s.currentPos += len;
+        else if (event == 0xE0) { // Pitch Bend
+            if (!has(2)) break;
+            const uint8_t lsb = p[pos++];
+            const uint8_t msb = p[pos++];
+            emit(SeqEventType::PitchBend, chan, 0, 0, ((msb << 7) | lsb) - 8192);
+        }
+        else if (status == 0xFF) {
+            if (!has(2)) break;
+            const uint8_t type = p[pos++];
+            const uint8_t len = p[pos++];
+            if (type == 0x2F) {
+                emit(SeqEventType::End, 0, 0, 0, 0);
+                ended = true;
+                break;
+            }
+            else if (type == 0x51) {
+                // Темп: 3 байта данных сразу после байта, прочитанного как длина (так читает игра)
+                if (!has(3)) break;
+                const uint32_t tempo = (p[pos] << 16) | (p[pos + 1] << 8) | p[pos + 2];
+                pos += 3;
+                emit(SeqEventType::Tempo, 0, 0, 0, (int32_t)tempo);
+                track->tempoMap.push_back({ tick, tempo });
+            }
+            else {
+                // Неизвестная мета - пропускаем по длине
+                pos += len;
+            }
         }
-    }
 
-    // --- 3.      ---
-    if (s.currentPos < s.dataSize) {
-        s.waitTicks = ReadVLQ(s.pData, s.currentPos, s.dataSize);
-    }
-    else {
-        return false;
+        // --- 3. ЗАДЕРЖКА ДО СЛЕДУЮЩЕГО СОБЫТИЯ ---
+        if (!has(1)) break;
+        tick += ReadVLQ(p, pos, size);
     }
 
-    return true;
+    if (!ended)
+        emit(SeqEventType::Stop, 0, 0, 0, 0);
+    track->lengthTicks = track->events.back().tick;
+    track->events.shrink_to_fit();
+
+    track->snapshotTicks = (track->resolution > 0 ? track->resolution : 480) * 4u;
+    BuildSnapshots(*track);
+    return track;
 }
 
 uint32_t SeqPlayer::ReadVLQ(const uint8_t* data, uint32_t& pos, uint32_t size)
@@ -749,10 +1282,10 @@ uint32_t SeqPlayer::ReadVLQ(const uint8_t* data, uint32_t& pos, uint32_t size)
     uint8_t byte;
     int safety = 0;
     do {
-     //   if (pos >= size) return 0; //  
+        if (pos >= size) break; // Конец данных
         byte = data[pos++];
         value = (value << 7) | (byte & 0x7F);
-        if (++safety > 4) break; //    
+        if (++safety > 4) break; // Защита от бесконечного цикла
     } while (byte & 0x80);
     return value;
 }
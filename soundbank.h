@@ -1,32 +1,133 @@
 #pragma once
 #include <vector>
 #include <cstdint>
+#include <atomic>
 #include "PsxAudio.h"
 #include "types.h"
+#include "ThreadPool.h"
+#include "GpuUploadQueue.h"
+#include <memory>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 
+struct VabBank;
+
+enum class SeqEventType : uint8_t
+{
+    NoteOn,
+    NoteOff,
+    Volume,         // CC 7
+    Pan,            // CC 10
+    Expression,     // CC 11
+    Program,
+    PitchBend,
+    Tempo,
+    LoopStart,      // NRPN 99 = 20, a - число повторов из CC 6 (0 - бесконечно)
+    LoopEnd,        // NRPN 99 = 30
+    End,            // FF 2F: трек начинается заново
+    Stop            // данные кончились без FF 2F
+};
+
+// Событие SEQ после разбора: running status, VLQ и мета уже раскрыты
+struct SeqEvent
+{
+    uint32_t tick = 0;      // от начала трека
+    SeqEventType type = SeqEventType::Stop;
+    uint8_t channel = 0;
+    uint8_t a = 0;          // нота / значение контроллера / программа
+    uint8_t b = 0;          // скорость нажатия
+    int32_t value = 0;      // темп (мкс на четверть) или бенд (-8192..8191)
+};
+
+// Смена темпа для пересчёта тиков во время
+struct SeqTempoPoint
+{
+    uint32_t tick = 0;
+    uint32_t tempo = 500000;
+};
+
+// Состояние канала, которое копят события до ноты
+struct SeqChannelState
+{
+    uint8_t volume = 127;
+    uint8_t pan = 64;
+    uint8_t program = 0;        // Текущий инструмент (номер звука в VAB)
+    uint8_t expression = 127;
+    int16_t bend = 0;           // -8192..8191
+};
+
+// Всё, что нужно слоту, чтобы начать играть с тика tick, не проигрывая трек с начала
+struct SeqStateSnapshot
+{
+    uint32_t tick = 0;
+    uint32_t eventIndex = 0;    // первое событие с тиком >= tick
+    uint32_t tempo = 500000;
+    int32_t loopIndex = -1;     // последний LoopStart до tick
+    SeqChannelState channels[16];
+};
+
+/*
+   SEQ, разобранный один раз (SeqPlayer::Compile): аудиопоток идёт курсором по events
+   и байты файла больше не читает. Неизвестные события выброшены, их задержки
+   перенесены в следующее событие. Последнее событие всегда End или Stop.
+   Каждые snapshotTicks тиков хранится состояние каналов - перемотка восстанавливает
+   ближайший снимок и доигрывает не больше одного интервала событий.
+*/
+struct SeqTrack
+{
+    std::vector<SeqEvent> events;
+    std::vector<SeqTempoPoint> tempoMap;   // первая точка - темп заголовка на тике 0
+    std::vector<SeqStateSnapshot> snapshots;
+    uint32_t snapshotTicks = 1920;         // такт 4/4
+    uint16_t resolution = 480;             // TPQN
+    uint32_t tempo = 500000;               // из заголовка
+    uint8_t masterVol = 127;
+    uint32_t lengthTicks = 0;              // тик последнего события
+
+    // Снимок не позже tick
+    const SeqStateSnapshot& FindSnapshot(uint32_t tick) const
+    {
+        const size_t index = tick / snapshotTicks;
+        return snapshots[index < snapshots.size() ? index : snapshots.size() - 1];
+    }
+    // Время по карте темпа от начала трека (без учёта перехода темпа через петлю)
+    double TicksToSeconds(uint32_t tick) const;
+    uint32_t SecondsToTicks(double seconds) const;
+    double GetDurationSeconds() const { return TicksToSeconds(lengthTicks); }
+
+    size_t GetMemoryBytes() const
+    {
+        return sizeof(SeqTrack) + events.capacity() * sizeof(SeqEvent) + tempoMap.capacity() * sizeof(SeqTempoPoint)
+            + snapshots.capacity() * sizeof(SeqStateSnapshot);
+    }
+};
+
 struct SeqSlot {
     bool active = false;
-    const uint8_t* pData = nullptr; //     MIDI
-    uint32_t dataSize = 0;
-    uint32_t currentPos = 0;        //     SEQ
+    const SeqTrack* track = nullptr;
+    uint32_t cursor = 0;            // Следующее событие трека
+    const VabBank* bank = nullptr;  // Чьими тонами играем
 
     float masterVolFactor = 1.0f;
-    // 
-    uint32_t waitTicks = 0;         //      
-    float    tickAccumulator = 0.0f; //   ( )
-
-    //   
-    uint16_t resolution = 0;        // TPQN ( )
-    uint32_t tempo = 500000;        //  ( )
-    uint16_t vabID = 0;             //    
-    uint8_t runningStatus = 0;
-    struct Channel {
-        uint8_t volume = 127;
-        uint8_t pan = 64;
-        uint8_t program = 0;        //   (   VAB)
-        uint8_t expression = 127;        //   (   VAB)
-    } channels[16];
+    // Тайминги
+    double   samplesToEvent = 0.0;  // Сэмплов выхода до следующего события (дробная часть копится)
+    uint32_t tick = 0;              // Тик, от которого считается samplesToEvent
+    double   position = 0.0;        // Текущий тик с дробной частью (для GetPosition)
+
+    // Петля NRPN: индекс LoopStart и сколько повторов осталось (-1 - бесконечно)
+    int32_t loopIndex = -1;
+    int32_t loopsLeft = 0;
+
+    // Параметры из заголовка
+    uint16_t resolution = 0;        // TPQN (из файла)
+    uint32_t tempo = 500000;        // Темп (из файла)
+    uint16_t vabID = 0;             // Какую библиотеку звуков используем
+    using Channel = SeqChannelState;
+    Channel channels[16];
 };
 
 
@@ -41,56 +142,199 @@ struct MusicMap
 };
 
 
-class SeqPlayer 
+/*
+   Проигрыватель SEQ. Слоты живут в аудиопотоке (SpuSequencer): время идёт в сэмплах
+   внутри колбэка, ноты стартуют точно в своём сэмпле. Главный поток только
+   отправляет Play/StopAll через очередь команд SPU. Байты SEQ разбираются
+   заранее (Compile), слот играет готовый SeqTrack.
+*/
+class SeqPlayer : public SpuSequencer
 {
 public:
     SeqPlayer();
 
     bool Load(const ByteArray& data, int slot);
 
-    void Update(float deltaTime, class AudioSystem* system);
-    int  Play(const ByteArray& data, uint16_t vabID);
+    // Разбор SEQ в поток событий; nullptr - не SEQ
+    static std::shared_ptr<SeqTrack> Compile(const ByteArray& data);
+
+    // --- Главный поток ---
+    void Attach(PsxSpu* target);
+    // track и bank должны жить, пока снимок SPU не покажет применённый StopAll после них.
+    // startTick - продолжить с места (GetPositionTicks прошлого запуска)
+    int  Play(const SeqTrack* track, uint16_t vabID, const VabBank* bank, uint32_t startTick = 0);
 
     void StopAll();
+    // Только слоты, которые играют из bank
+    void StopBank(const VabBank* bank);
+
+    // Перемотка последнего запущенного трека; звучащие ноты уходят в release
+    void Seek(uint32_t tick);
+    void SeekSeconds(double seconds);
+
+    // Позиция последнего запущенного трека (обновляет аудиопоток) и его длина
+    uint32_t GetPositionTicks() const { return positionTicks.load(std::memory_order_relaxed); }
+    double GetPositionSeconds() const;
+    double GetDurationSeconds() const { return playingTrack ? playingTrack->GetDurationSeconds() : 0.0; }
+
+    // Сколько раз SEQ дошёл до конца и начался заново / играет ли что-нибудь (с любого потока)
+    uint32_t GetLoopCount() const { return loopCount.load(std::memory_order_relaxed); }
+    bool IsPlaying() const { return playing.load(std::memory_order_relaxed); }
+    // Сколько SEQ аудиопоток отбросил: все 16 слотов заняты или трек остановлен
+    // как зациклившийся (бесконечная цепочка событий без задержки)
+    uint32_t GetFailedStarts() const { return failedStarts.load(std::memory_order_relaxed); }
+
+    // --- Аудиопоток ---
+    int FramesUntilEvent(int maxFrames) const override;
+    void Advance(int frames) override;
+    void FireDue(PsxSpu& target) override;
+    void Apply(const SpuCommand& c) override;
 
     int FindFreeSlot();
 
 private:
     SeqSlot slots[16];
-    bool ParseNextEvent(SeqSlot& s, class AudioSystem* system);
+    PsxSpu* spu = nullptr;
+    const SeqTrack* playingTrack = nullptr;   // главный поток: для пересчёта секунд
+    int primarySlot = -1;                     // аудиопоток: слот последнего Play
+    std::atomic<uint32_t> loopCount{ 0 };
+    std::atomic<uint32_t> positionTicks{ 0 };
+    std::atomic<uint32_t> failedStarts{ 0 };
+    std::atomic<bool> playing{ false };
+    void Start(const SpuCommand& c);
+    static void Restore(SeqSlot& s, uint32_t tick);
+    void UpdatePlaying();
+    bool Dispatch(SeqSlot& s, const SeqEvent& e, uint32_t index, PsxSpu& target);
+    static void BuildSnapshots(SeqTrack& track);
+    static double SamplesPerTick(const SeqSlot& s);
     static uint32_t ReadVLQ(const uint8_t* data, uint32_t& pos, uint32_t size);
 };
 
+// Сколько памяти держат декодированные банки, которые сейчас не играют
+constexpr size_t VAB_CACHE_BUDGET = 24 * 1024 * 1024;
+
+// Банки, загруженные одновременно (как Music_PlaySEQ / PlaySoundEffect в оригинале)
+constexpr int AUDIO_BANK_COUNT = 4;
+constexpr int MUSIC_BANK = 0;   // VAB текущего SEQ
+constexpr int SFX_BANK = 1;     // звуки локации
+
+// Декодированный VAB: программы + сэмплы, на которые ссылаются их тоны
+struct VabBank
+{
+    Program programs[128];
+    SamplePool samples;
+    float masterVol = 0.75f;
+    int mappedPrograms = 0;
+
+    size_t GetMemoryBytes() const { return sizeof(VabBank) + samples.GetMemoryBytes(); }
+
+    // NoteOn (без handle) для всех тонов программы, в зону которых попадает нота; возвращает их число
+    int MakeNoteOn(int program, float note, float volume, float pan, SpuCommand (&out)[16]) const;
+};
+
+/*
+   Кеш декодированных банков по (архив, VH, VB) с вытеснением давно не игравших
+   (LRU) при превышении бюджета. Играющий банк держит AudioSystem, поэтому вытеснение
+   его не освобождает.
+*/
+class VabCache
+{
+public:
+    explicit VabCache(size_t budgetBytes = VAB_CACHE_BUDGET) : budget(budgetBytes) {}
+
+    static std::string MakeKey(const std::string& archive, int vh, int vb)
+    {
+        return archive + "_" + std::to_string(vh) + "_" + std::to_string(vb);
+    }
+
+    // nullptr, если нет; найденный становится самым свежим
+    std::shared_ptr<VabBank> Find(const std::string& key);
+    // Без обновления свежести
+    bool Contains(const std::string& key) const { return index.count(key) != 0; }
+    void Insert(const std::string& key, std::shared_ptr<VabBank> bank);
+    void Clear();
+
+    void SetBudget(size_t bytes);
+    size_t GetBudget() const { return budget; }
+    size_t GetMemoryBytes() const { return bytes; }
+    size_t GetCount() const { return entries.size(); }
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<VabBank> bank;
+        size_t bytes;
+    };
+
+    void Trim();
+
+    std::list<Entry> entries;   // спереди - самые свежие
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t budget;
+    size_t bytes = 0;
+};
+
 class AudioSystem {
 public:
     AudioSystem();
     ~AudioSystem();
 
     void InitSPUSystem();
-    //    (VH - , VB - )
+    // Без звукового устройства, для Render
+    void InitOffline() { spu.InitOffline(); }
+    // Загрузить пару файлов (VH - заголовок, VB - данные)
     bool Load(const ByteArray& vhData, const ByteArray& vbData);
 
     void UnloadAll();
 
-    bool LoadVab(const ByteArray& vhData, const ByteArray& vbData);
+    // Банк в слот bankId (0..AUDIO_BANK_COUNT-1); прежний банк слота и его голоса снимаются,
+    // остальные банки продолжают звучать
+    bool LoadVab(const ByteArray& vhData, const ByteArray& vbData, int bankId = MUSIC_BANK);
+    // Через кеш: банк, который уже декодировали, включается без распаковки
+    bool LoadVab(const std::string& archivePath, int vh, int vb, int bankId = MUSIC_BANK);
+    // Предзагрузка в кеш (AreaPrefetcher): распаковка на рабочем потоке очереди загрузки,
+    // в кеш банк попадает в Update(). Отменённый cancel - банк выбрасывается
+    void RequestVab(const std::string& archivePath, int vh, int vb, UploadPriority priority = UploadPriority::Prefetch,
+        GpuUploadQueue::CancelToken cancel = nullptr);
+    bool IsVabCached(const std::string& archivePath, int vh, int vb) const { return vabCache.Contains(VabCache::MakeKey(archivePath, vh, vb)); }
+    void UnloadBank(int bankId);
+    const VabBank* GetBank(int bankId) const;
+    // Освобождает все декодированные банки, кроме играющих
+    void ClearVabCache() { vabCache.Clear(); }
+    // Формат сэмплов для банков, которые будут декодированы дальше (уже закешированные не меняются)
+    void SetSampleFormat(SampleFormat format) { sampleFormat = format; }
+    SampleFormat GetSampleFormat() const { return sampleFormat; }
     
 
 
     void PlaySfx(int index, float volume = 1.0f, float pitch = 1.0f);
+    // Звук из банка SPU поверх музыки; handle общий для всех тонов (для StopVoice / SetVoice3D)
+    // source - приоритет при нехватке голосов (меню - SpuVoiceSource::Ui)
+    uint32_t PlaySoundEffect(int program, int note = 60, float volume = 1.0f, float pan = 0.5f, int bankId = SFX_BANK,
+        SpuVoiceSource source = SpuVoiceSource::Sfx);
+    // То же с 3D-смесью PositionalAudio в самом NoteOn: gain - доля громкости программы, pitchScale - доплер
+    uint32_t PlaySoundEffect3D(int program, int note, float gain, float pan, float pitchScale, int bankId = SFX_BANK);
+    void StopVoice(uint32_t handle) { spu.StopVoice(handle); }
+    void SetVoice3D(uint32_t handle, float volume, float pan) { spu.SetVoice3D(handle, volume, pan); }
+    // gain - доля громкости запуска, pitchScale - доплер (PositionalAudio)
+    void SetVoice3D(uint32_t handle, float gain, float pan, float pitchScale) { spu.SetVoice3D(handle, gain, pan, pitchScale); }
+    // Пределы голосов по источникам и счётчики кражи/потерь (снимок аудиопотока)
+    void SetVoiceLimit(SpuVoiceSource source, int limit) { spu.SetVoiceLimit(source, limit); }
+    const SpuVoiceStats& GetVoiceStats(SpuVoiceSource source) { return spu.GetVoiceStats(source); }
     
     void Update();
-    //     SEQ
+    // Вспомогательный метод для плеера SEQ
     void PlaySample(int program, float note, float volume, float pan, int channel);
-    bool IsProgramReady(int program);
+    bool IsProgramReady(int program, int bankId = MUSIC_BANK);
 
     void Play(int index);
     void Stop(int index);
     void StopAll();
     bool IsPlayering(int index);
 
-    void NoteOff(int prog, int note);
+    void NoteOff(int prog, int note, int bankId = MUSIC_BANK);
     bool IsSoundReady(Sound s);
-    //    Raylib
+    // Получить звук для Raylib
     Sound GetSound(int index);
     size_t GetSoundCount() const { return sounds.size(); }
 
@@ -102,6 +346,20 @@ public:
     void SetPitchBend(int channel, float bend);
 
     void PlaySEQMusic(int id);
+    // SEQ номер seqIndex из архива под банк vh/vb того же архива; startTick - продолжить с места
+    bool PlaySEQ(const std::string& archivePath, int seqIndex, int vh, int vb, uint32_t startTick = 0);
+
+    // Без звукового устройства (офлайн-рендер): микшер считает в buffer в этом же потоке.
+    // С запущенным устройством не вызывать - голоса принадлежат его колбэку
+    void Render(short* buffer, unsigned int frames) { spu.GenerateAudio(buffer, frames); }
+    void ReleaseAllVoices(int bankId = SPU_ALL_BANKS) { spu.ReleaseAllVoices(bankId); }
+    int GetActiveVoiceCount() { return spu.GetSnapshot().activeCount; }
+    // Состояние голосов на конец последнего колбэка; команда n применена, когда appliedCommands >= n
+    const SpuSnapshot& GetSpuSnapshot() { return spu.GetSnapshot(); }
+    uint64_t GetPostedCount() const { return spu.GetPostedCount(); }
+
+    // Реверб SPU (SsUtSetReverbType / SsUtSetReverbDepth)
+    void SetReverb(SpuReverbMode mode, float depth) { spu.SetReverbMode(mode); spu.SetReverbDepth(depth); }
 
     float currentVabMasterVol = 0.75f;
 private:
@@ -109,13 +367,49 @@ private:
     
     
 
-    int PlayMusic(const ByteArray& seqData);
+    int PlayMusic(std::shared_ptr<const SeqTrack> track, uint32_t startTick = 0);
     PsxSpu spu;
 
-    Program programs[128];
-    float channelBends[16];
-    std::vector<Sound> sounds; //   Raylib
+    // Потоки распаковки VAG (создаются при первой загрузке банка)
+    std::unique_ptr<ThreadPool> decodePool;
+
+    // Загруженные банки; переключение трека - замена указателя в слоте MUSIC_BANK
+    std::shared_ptr<VabBank> banks[AUDIO_BANK_COUNT];
+    void SetBank(int bankId, std::shared_ptr<VabBank> newBank);
+    void RetireBank(int bankId);
+    // Трек, который играет секвенсор
+    std::shared_ptr<const void> musicSource;
+    // Разобранные SEQ по (архив, номер): повторный запуск трека без разбора
+    std::unordered_map<std::string, std::shared_ptr<const SeqTrack>> seqCache;
+    // Снятые банки и SEQ ждут, пока аудиопоток применит StopAll (номер команды)
+    struct RetiredBank {
+        std::shared_ptr<VabBank> bank;
+        std::shared_ptr<const void> source;
+        uint64_t stopCommand;
+    };
+    std::vector<RetiredBank> retiredBanks;
+    void ReleaseRetiredBanks();
+    uint32_t reportedSeqFailures = 0;   // GetFailedStarts, о которых уже написали в лог
+    VabCache vabCache;
+    SampleFormat sampleFormat = SampleFormat::Int16;
+
+    // Банки, распакованные RequestVab: рабочие потоки кладут, главный поток переносит в кеш
+    struct PrefetchedVab {
+        std::string key;
+        std::shared_ptr<VabBank> bank;   // nullptr - отменён или не распаковался
+    };
+    std::mutex prefetchMutex;
+    std::vector<PrefetchedVab> prefetchedVabs;
+    std::unordered_set<std::string> vabRequests;   // ключи в работе (главный поток)
+    void AcceptPrefetchedVabs();
+
+    // Потокобезопасно: читает только аргументы и decodePool (создаётся в главном потоке)
+    std::shared_ptr<VabBank> DecodeVab(const ByteArray& vhData, const ByteArray& vbData, SampleFormat format);
+    // Тоны звука в очередь SPU под одним handle
+    uint32_t PostSoundEffect(SpuCommand* notes, int count, int bankId, SpuVoiceSource source);
+    float channelBends[16] = {};
+    std::vector<Sound> sounds; // Готовые звуки Raylib
 
-    //  Sony ADPCM -> PCM 16-bit
+    // Декодер Sony ADPCM -> PCM 16-bit
     static std::vector<int16_t> DecodeADPCM(const uint8_t* src, size_t size);
 };